@@ -0,0 +1,148 @@
+#include "Arena.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/mman.h>
+
+Arena::Arena()
+{
+  huge_pages = HUGE_PAGES_DEFAULT;
+}
+
+Arena::~Arena()
+{
+  for (unsigned c = 0; c < chunks.size(); c++)
+    munmap(chunks[c].base, chunks[c].size);
+}
+
+void Arena::set_huge_pages(HugePages kind)
+{
+  huge_pages = kind;
+}
+
+Arena::Chunk Arena::map_chunk(size_t size)
+{
+  Chunk chunk;
+  chunk.size = (size + ARENA_HUGE_PAGE - 1) & ~(size_t)(ARENA_HUGE_PAGE - 1);
+  chunk.used = 0;
+  chunk.live = 0;
+
+  if (huge_pages == HUGE_PAGES_EXPLICIT)
+  {
+    void *base = mmap(NULL, chunk.size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base == MAP_FAILED)
+    {
+      printf("Failed to map %zu MiB of huge pages "
+             "(see /proc/sys/vm/nr_hugepages)\n", chunk.size >> 20);
+      exit(1);
+    }
+    chunk.base = (char*)base;
+    return chunk;
+  }
+
+  // Over-allocate, and trim the mapping to a huge page boundary, where the
+  // kernel can back it with transparent huge pages
+  size_t padded = chunk.size + ARENA_HUGE_PAGE;
+  char *base = (char*)mmap(NULL, padded, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+  {
+    printf("Failed to map %zu MiB for the arena\n", chunk.size >> 20);
+    exit(1);
+  }
+  uintptr_t aligned = ((uintptr_t)base + ARENA_HUGE_PAGE - 1) &
+                      ~(uintptr_t)(ARENA_HUGE_PAGE - 1);
+  chunk.base = (char*)aligned;
+  if (chunk.base > base)
+    munmap(base, chunk.base - base);
+  if (base + padded > chunk.base + chunk.size)
+    munmap(chunk.base + chunk.size, base + padded - (chunk.base + chunk.size));
+
+  if (huge_pages == HUGE_PAGES_TRANSPARENT)
+    madvise(chunk.base, chunk.size, MADV_HUGEPAGE);
+  else if (huge_pages == HUGE_PAGES_NONE)
+    madvise(chunk.base, chunk.size, MADV_NOHUGEPAGE);
+  return chunk;
+}
+
+void* Arena::allocate_bytes(size_t size)
+{
+  // Keep every allocation (even an empty one) on its own cache lines
+  size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+  if (size == 0)
+    size = ARENA_ALIGNMENT;
+
+  unsigned c = 0;
+  while (c < chunks.size() && chunks[c].used + size > chunks[c].size)
+    c++;
+  if (c == chunks.size())
+    chunks.push_back(map_chunk(size > ARENA_CHUNK_SIZE ? size
+                                                       : ARENA_CHUNK_SIZE));
+
+  void *ptr = chunks[c].base + chunks[c].used;
+  chunks[c].used += size;
+  chunks[c].live++;
+  return ptr;
+}
+
+void Arena::release(const void *ptr)
+{
+  for (unsigned c = 0; c < chunks.size(); c++)
+  {
+    Chunk& chunk = chunks[c];
+    if (ptr >= chunk.base && ptr < chunk.base + chunk.size)
+    {
+      // The space is only reused once the whole chunk is free
+      if (--chunk.live == 0)
+        chunk.used = 0;
+      return;
+    }
+  }
+}
+
+void Arena::usage(size_t *mapped, size_t *huge) const
+{
+  *mapped = 0;
+  for (unsigned c = 0; c < chunks.size(); c++)
+    *mapped += chunks[c].size;
+
+  // Explicit huge pages are reserved when mapped
+  if (huge_pages == HUGE_PAGES_EXPLICIT)
+  {
+    *huge = *mapped;
+    return;
+  }
+
+  // Otherwise add up the transparent huge pages that smaps reports for
+  // the mappings that start in a chunk
+  *huge = 0;
+  FILE *smaps = fopen("/proc/self/smaps", "r");
+  if (smaps == NULL)
+    return;
+
+  char line[256];
+  bool in_arena = false;
+  while (fgets(line, sizeof(line), smaps))
+  {
+    unsigned long start, end, kb;
+    if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+    {
+      in_arena = false;
+      for (unsigned c = 0; c < chunks.size(); c++)
+      {
+        uintptr_t base = (uintptr_t)chunks[c].base;
+        in_arena |= start >= base && start < base + chunks[c].size;
+      }
+    }
+    else if (in_arena && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+    {
+      *huge += kb << 10;
+    }
+  }
+  fclose(smaps);
+
+  if (*huge > *mapped)
+    *huge = *mapped;
+}
@@ -0,0 +1,309 @@
+#include "CPUContext.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+template<int R, int C, ECCMode mode>
+CPUContext<R,C,mode>::CPUContext()
+{
+  TileECC<R,C>::init();
+
+  num_corrected  = 0;
+  check_interval = 1;
+  spmv_count     = 0;
+  check_result   = NOT_CHECKED;
+}
+
+template<int R, int C, ECCMode mode>
+cg_matrix* CPUContext<R,C,mode>::create_matrix(const uint32_t *columns,
+                                               const uint32_t *rows,
+                                               const double *values,
+                                               int N, int nnz)
+{
+  cg_matrix *M = new cg_matrix;
+
+  M->N              = N;
+  M->num_block_rows = (N + R - 1) / R;
+  M->num_block_cols = (N + C - 1) / C;
+  M->rows           = new uint32_t[M->num_block_rows+1];
+
+  std::vector<tile>     tiles;
+  std::vector<uint32_t> block_cols;
+
+  // Elements are sorted by row, so each block row is a contiguous range
+  int i = 0;
+  for (unsigned I = 0; I < M->num_block_rows; I++)
+  {
+    int start = i;
+    while (i < nnz && rows[i] < (I+1)*R)
+      i++;
+
+    // Find the tiles that this block row needs
+    block_cols.clear();
+    for (int e = start; e < i; e++)
+      block_cols.push_back(columns[e] / C);
+    std::sort(block_cols.begin(), block_cols.end());
+    block_cols.erase(std::unique(block_cols.begin(), block_cols.end()),
+                     block_cols.end());
+
+    M->rows[I] = tiles.size();
+    for (unsigned t = 0; t < block_cols.size(); t++)
+    {
+      tile T = {block_cols[t], 0, {0.0}};
+      tiles.push_back(T);
+    }
+
+    // Scatter the elements into their tiles
+    for (int e = start; e < i; e++)
+    {
+      uint32_t J = columns[e] / C;
+      unsigned t = std::lower_bound(block_cols.begin(), block_cols.end(), J)
+                 - block_cols.begin();
+      uint32_t r = rows[e] - I*R;
+      uint32_t c = columns[e] - J*C;
+      tiles[M->rows[I] + t].values[r*C + c] = values[e];
+    }
+  }
+  M->rows[M->num_block_rows] = tiles.size();
+
+  M->nnz = tiles.size();
+  tile *data = new tile[M->nnz];
+  for (unsigned t = 0; t < M->nnz; t++)
+  {
+    data[t] = tiles[t];
+    ecc_generate<R,C,mode>(data[t]);
+  }
+  M->tiles = data;
+
+  return M;
+}
+
+template<int R, int C, ECCMode mode>
+void CPUContext<R,C,mode>::destroy_matrix(cg_matrix *mat)
+{
+  delete[] mat->rows;
+  delete[] (tile*)mat->tiles;
+  delete mat;
+}
+
+template<int R, int C, ECCMode mode>
+cg_vector* CPUContext<R,C,mode>::create_vector(int N)
+{
+  // Pad to a whole number of tiles, so that the last block column can be
+  // multiplied without bounds checks (the padding stays zero)
+  cg_vector *result = new cg_vector;
+  result->N    = N;
+  result->data = new double[(N + C - 1) / C * C]();
+  return result;
+}
+
+template<int R, int C, ECCMode mode>
+void CPUContext<R,C,mode>::destroy_vector(cg_vector *vec)
+{
+  delete[] vec->data;
+  delete vec;
+}
+
+template<int R, int C, ECCMode mode>
+double* CPUContext<R,C,mode>::map_vector(cg_vector *v)
+{
+  return v->data;
+}
+
+template<int R, int C, ECCMode mode>
+void CPUContext<R,C,mode>::unmap_vector(cg_vector *v, double *h)
+{
+}
+
+template<int R, int C, ECCMode mode>
+void CPUContext<R,C,mode>::copy_vector(cg_vector *dst, const cg_vector *src)
+{
+#pragma omp parallel for simd
+  for (int i = 0; i < dst->N; i++)
+  {
+    dst->data[i] = src->data[i];
+  }
+}
+
+template<int R, int C, ECCMode mode>
+double CPUContext<R,C,mode>::dot(const cg_vector *a, const cg_vector *b)
+{
+  double ret = 0.0;
+#pragma omp parallel for simd reduction(+:ret)
+  for (int i = 0; i < a->N; i++)
+  {
+    ret += a->data[i] * b->data[i];
+  }
+  return ret;
+}
+
+template<int R, int C, ECCMode mode>
+double CPUContext<R,C,mode>::calc_xr(cg_vector *x, cg_vector *r,
+                                     const cg_vector *p, const cg_vector *w,
+                                     double alpha)
+{
+  double ret = 0.0;
+#pragma omp parallel for simd reduction(+:ret)
+  for (int i = 0; i < x->N; i++)
+  {
+    x->data[i] += alpha * p->data[i];
+    r->data[i] -= alpha * w->data[i];
+
+    ret += r->data[i] * r->data[i];
+  }
+  return ret;
+}
+
+template<int R, int C, ECCMode mode>
+void CPUContext<R,C,mode>::calc_p(cg_vector *p, const cg_vector *r,
+                                  double beta)
+{
+#pragma omp parallel for simd
+  for (int i = 0; i < p->N; i++)
+  {
+    p->data[i] = r->data[i] + beta*p->data[i];
+  }
+}
+
+template<int R, int C, ECCMode mode>
+void CPUContext<R,C,mode>::spmv(const cg_matrix *mat, const cg_vector *vec,
+                                cg_vector *result)
+{
+  spmv_dot(mat, vec, result);
+}
+
+template<int R, int C, ECCMode mode>
+double CPUContext<R,C,mode>::spmv_dot(const cg_matrix *mat,
+                                      const cg_vector *vec,
+                                      cg_vector *result)
+{
+  // Skip the checks on all but every check_interval'th call
+  if (++spmv_count < check_interval)
+  {
+    check_result = NOT_CHECKED;
+    return tile_spmv_dot<false>(mat, vec, result);
+  }
+  spmv_count = 0;
+
+  unsigned corrected = num_corrected;
+  double ret = tile_spmv_dot<true>(mat, vec, result);
+  check_result = num_corrected > corrected ? CHECK_CORRECTED : CHECK_PASSED;
+  return ret;
+}
+
+template<int R, int C, ECCMode mode>
+template<bool checked>
+double CPUContext<R,C,mode>::tile_spmv_dot(const cg_matrix *mat,
+                                           const cg_vector *vec,
+                                           cg_vector *result)
+{
+  double ret = 0.0;
+  unsigned corrected = 0;
+#pragma omp parallel reduction(+:ret,corrected)
+  {
+    // Private copies of the matrix and vector descriptors, which recording
+    // an error cannot change, so that the compiler does not reload them for
+    // every tile
+    const cg_matrix M     = *mat;
+    tile           *tiles = (tile*)M.tiles;
+    const double   *v     = vec->data;
+
+#pragma omp for
+    for (unsigned I = 0; I < M.num_block_rows; I++)
+    {
+      double tmp[R] = {0.0};
+
+      uint32_t start = M.rows[I];
+      uint32_t end   = M.rows[I+1];
+      for (uint32_t t = start; t < end; t++)
+      {
+        if (checked)
+          corrected += ecc_check<R,C,mode>(tiles[t], t, this->error_log);
+
+        // Skip indices corrupted since the last check, or that the check
+        // could not correct, unless the matrix is not checked at all
+        uint32_t J = tiles[t].col;
+        if (mode != ECC_NONE && J >= M.num_block_cols)
+          continue;
+
+        const double *x = v + J*C;
+        for (int r = 0; r < R; r++)
+        {
+          for (int c = 0; c < C; c++)
+          {
+            tmp[r] += tiles[t].values[r*C + c] * x[c];
+          }
+        }
+      }
+
+      for (int r = 0; r < R && I*R + r < M.N; r++)
+      {
+        uint32_t row = I*R + r;
+        result->data[row] = tmp[r];
+        ret += tmp[r] * v[row];
+      }
+    }
+  }
+  num_corrected += corrected;
+  return ret;
+}
+
+template<int R, int C, ECCMode mode>
+void CPUContext<R,C,mode>::inject_bitflip(cg_matrix *mat, BitFlipKind kind,
+                                          int num_flips)
+{
+  tile *tiles = (tile*)mat->tiles;
+
+  int index = rand() % mat->nnz;
+
+  // Bits 0 to 31 are the block column index, 32 onwards the values
+  int start = 0;
+  int end   = 32 + 64*R*C;
+  if (kind == VALUE)
+    start = 32;
+  else if (kind == INDEX)
+    end = 32;
+
+  for (int i = 0; i < num_flips; i++)
+  {
+    int bit = (rand() % (end-start)) + start;
+    if (bit >= 32)
+      bit += 32;
+    printf("*** flipping bit %d at index %d ***\n", bit, index);
+    TileECC<R,C>::flip_bit(tiles[index], bit);
+  }
+}
+
+template<int R, int C, ECCMode mode>
+void CPUContext<R,C,mode>::set_check_interval(int k)
+{
+  check_interval = k;
+}
+
+template<int R, int C, ECCMode mode>
+CGContext::CheckResult CPUContext<R,C,mode>::last_check()
+{
+  return check_result;
+}
+
+namespace
+{
+  static CGContext::Register< CPUContext<2,2,ECC_NONE> >   A("cpu", "none");
+  static CGContext::Register< CPUContext<2,2,ECC_SED> >    B("cpu", "sed");
+  static CGContext::Register< CPUContext<2,2,ECC_SEC> >    C("cpu", "sec");
+  static CGContext::Register< CPUContext<2,2,ECC_SECDED> > D("cpu", "secded");
+
+  static CGContext::Register< CPUContext<3,3,ECC_NONE> >   E("cpu3x3", "none");
+  static CGContext::Register< CPUContext<3,3,ECC_SED> >    F("cpu3x3", "sed");
+  static CGContext::Register< CPUContext<3,3,ECC_SEC> >    G("cpu3x3", "sec");
+  static CGContext::Register< CPUContext<3,3,ECC_SECDED> >
+    H("cpu3x3", "secded");
+
+  static CGContext::Register< CPUContext<4,4,ECC_NONE> >   I("cpu4x4", "none");
+  static CGContext::Register< CPUContext<4,4,ECC_SED> >    J("cpu4x4", "sed");
+  static CGContext::Register< CPUContext<4,4,ECC_SEC> >    K("cpu4x4", "sec");
+  static CGContext::Register< CPUContext<4,4,ECC_SECDED> >
+    L("cpu4x4", "secded");
+}
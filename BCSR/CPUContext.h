@@ -0,0 +1,70 @@
+#include "CGContext.h"
+
+#include "ecc.h"
+
+struct cg_vector
+{
+  int N;
+  double *data;
+};
+
+// Block CSR matrix made of dense tiles. The tile type depends on the block
+// size of the context that created the matrix.
+struct cg_matrix
+{
+  unsigned N;
+  unsigned nnz;             // number of tiles
+  unsigned num_block_rows;
+  unsigned num_block_cols;
+  uint32_t *rows;           // index of the first tile of each block row
+  void     *tiles;
+};
+
+template<int R, int C, ECCMode mode>
+class CPUContext : public CGContext
+{
+public:
+  CPUContext();
+
+private:
+  typedef bcsr_tile<R,C> tile;
+
+  // Number of matrix errors corrected so far
+  unsigned num_corrected;
+
+  // Periodic checking state
+  int         check_interval;
+  int         spmv_count;
+  CheckResult check_result;
+
+  virtual cg_matrix* create_matrix(const uint32_t *columns,
+                                   const uint32_t *rows,
+                                   const double *values,
+                                   int N, int nnz);
+  virtual void destroy_matrix(cg_matrix *mat);
+
+  virtual cg_vector* create_vector(int N);
+  virtual void destroy_vector(cg_vector *vec);
+  virtual double* map_vector(cg_vector *v);
+  virtual void unmap_vector(cg_vector *v, double *h);
+  virtual void copy_vector(cg_vector *dst, const cg_vector *src);
+
+  virtual double dot(const cg_vector *a, const cg_vector *b);
+  virtual double calc_xr(cg_vector *x, cg_vector *r,
+                         const cg_vector *p, const cg_vector *w,
+                         double alpha);
+  virtual void calc_p(cg_vector *p, const cg_vector *r, double beta);
+
+  virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
+                    cg_vector *result);
+  virtual double spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                          cg_vector *result);
+  template<bool checked>
+  double tile_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                       cg_vector *result);
+
+  virtual void inject_bitflip(cg_matrix *mat, BitFlipKind kind, int num_flips);
+
+  virtual void set_check_interval(int k);
+  virtual CheckResult last_check();
+};
@@ -0,0 +1,209 @@
+#ifndef ECC_H
+#define ECC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ErrorLog.h"
+
+// An R x C dense tile of the matrix, stored row-major. The codeword covers
+// the whole tile (the block column index and every value), with the check
+// bits kept in a separate word rather than in the high bits of the index:
+// bits 0 to hamming_bits-1 are the Hamming bits, bit 31 the overall parity.
+template<int R, int C>
+struct bcsr_tile
+{
+  uint32_t col;
+  uint32_t ecc;
+  double   values[R*C];
+};
+
+enum ECCMode {ECC_NONE, ECC_SED, ECC_SEC, ECC_SECDED};
+
+// Smallest number of Hamming bits m that can cover n data bits
+static constexpr int ecc_hamming_bits(int n, int m = 1)
+{
+  return (1 << m) >= n + m + 1 ? m : ecc_hamming_bits(n, m+1);
+}
+
+// Hamming code over a bcsr_tile<R,C>, viewed as an array of 64-bit words
+// where the first word holds the index (low half) and the check bits (high
+// half). Bit numbers refer to this view.
+template<int R, int C>
+class TileECC
+{
+public:
+  static const int words        = 1 + R*C;
+  static const int data_bits    = 32 + 64*R*C;
+  static const int hamming_bits = ecc_hamming_bits(data_bits);
+
+  // Returned by flipped_bit for syndromes that do not match a single bit
+  static const uint32_t INVALID_BIT = 0xFFFF;
+
+  // Build the parity masks and the syndrome decode table
+  static void init()
+  {
+    if (initialized)
+      return;
+
+    memset(masks, 0, sizeof(masks));
+    for (uint32_t s = 0; s < (1U << hamming_bits); s++)
+      decode[s] = INVALID_BIT;
+
+    // Check bits sit at the power of 2 positions
+    for (int j = 0; j < hamming_bits; j++)
+    {
+      masks[j][0] |= 0x1ULL << (32+j);
+      decode[1U << j] = 32+j;
+    }
+
+    // Data bits take the remaining positions, in order
+    uint32_t pos = 3;
+    for (uint32_t bit = 0; bit < 64*words; bit++)
+    {
+      if (bit >= 32 && bit < 64)
+        continue;
+
+      for (int j = 0; j < hamming_bits; j++)
+      {
+        if (pos & (0x1U << j))
+          masks[j][bit/64] |= 0x1ULL << (bit % 64);
+      }
+      decode[pos] = bit;
+
+      pos++;
+      if (!(pos & (pos-1)))
+        pos++;
+    }
+
+    initialized = true;
+  }
+
+  // Hamming syndrome of a tile (the check bits when generating)
+  static inline uint32_t syndrome(const bcsr_tile<R,C>& tile)
+  {
+    uint64_t data[words];
+    memcpy(data, &tile, sizeof(data));
+
+    uint32_t result = 0;
+    for (int j = 0; j < hamming_bits; j++)
+    {
+      uint64_t p = 0;
+      for (int w = 0; w < words; w++)
+        p ^= data[w] & masks[j][w];
+      result |= __builtin_parityll(p) << j;
+    }
+    return result;
+  }
+
+  // Overall parity of a tile, including the check bits
+  static inline uint32_t overall_parity(const bcsr_tile<R,C>& tile)
+  {
+    uint64_t data[words];
+    memcpy(data, &tile, sizeof(data));
+
+    uint64_t p = 0;
+    for (int w = 0; w < words; w++)
+      p ^= data[w];
+    return __builtin_parityll(p);
+  }
+
+  static inline uint32_t flipped_bit(uint32_t syndrome)
+  {
+    return decode[syndrome];
+  }
+
+  static inline void flip_bit(bcsr_tile<R,C>& tile, uint32_t bit)
+  {
+    uint64_t data[words];
+    memcpy(data, &tile, sizeof(data));
+    data[bit/64] ^= 0x1ULL << (bit % 64);
+    memcpy(&tile, data, sizeof(data));
+  }
+
+private:
+  static bool     initialized;
+  static uint64_t masks[hamming_bits][words];
+  static uint16_t decode[1 << hamming_bits];
+};
+
+template<int R, int C> bool TileECC<R,C>::initialized = false;
+template<int R, int C>
+uint64_t TileECC<R,C>::masks[TileECC<R,C>::hamming_bits][TileECC<R,C>::words];
+template<int R, int C>
+uint16_t TileECC<R,C>::decode[1 << TileECC<R,C>::hamming_bits];
+
+// Generate the check bits of a tile for the given mode
+template<int R, int C, ECCMode mode>
+static inline void ecc_generate(bcsr_tile<R,C>& tile)
+{
+  tile.ecc = 0;
+  if (mode == ECC_SEC || mode == ECC_SECDED)
+    tile.ecc = TileECC<R,C>::syndrome(tile);
+  if (mode == ECC_SED || mode == ECC_SECDED)
+    tile.ecc |= TileECC<R,C>::overall_parity(tile) << 31;
+}
+
+// Check (and correct in place) a tile for the given mode, recording what it
+// finds in log. Returns 1 if the tile was corrected. A tile that cannot be
+// corrected is left as it is, so callers must keep its index in range.
+template<int R, int C, ECCMode mode>
+static inline unsigned ecc_check(bcsr_tile<R,C>& tile, uint32_t i,
+                                 ErrorLog& log)
+{
+  typedef TileECC<R,C> ECC;
+
+  if (mode == ECC_NONE)
+    return 0;
+
+  uint32_t overall_parity = 0;
+  if (mode != ECC_SEC)
+  {
+    overall_parity = ECC::overall_parity(tile);
+    if (mode == ECC_SED)
+    {
+      if (overall_parity)
+        log.record(ERROR_DETECTED, ERROR_ELEMENT, i);
+      return 0;
+    }
+  }
+
+  uint32_t syndrome = ECC::syndrome(tile);
+  if (mode == ECC_SECDED && !overall_parity)
+  {
+    // Overall parity fine but error in syndrome
+    // Must be double-bit error - cannot correct this
+    if (syndrome)
+      log.record(ERROR_UNCORRECTABLE, ERROR_ELEMENT, i);
+    return 0;
+  }
+
+  if (syndrome)
+  {
+    uint32_t bit = ECC::flipped_bit(syndrome);
+    if (bit == ECC::INVALID_BIT)
+    {
+      log.record(ERROR_UNCORRECTABLE, ERROR_ELEMENT, i);
+      return 0;
+    }
+
+    // Unflip bit
+    ECC::flip_bit(tile, bit);
+
+    log.record(ERROR_CORRECTED, ERROR_ELEMENT, i, bit);
+    return 1;
+  }
+  else if (mode == ECC_SECDED)
+  {
+    // Correct overall parity bit (bit 63 in the TileECC view)
+    tile.ecc ^= 0x1U << 31;
+
+    log.record(ERROR_CORRECTED, ERROR_ELEMENT, i, 63);
+    return 1;
+  }
+  return 0;
+}
+
+#endif // ECC_H
@@ -24,6 +24,141 @@ CGContext* CGContext::create(const char *target, const char *mode)
   return NULL;
 }
 
+cg_matrix* CGContext::create_block_matrix(const uint32_t *columns,
+                                          const uint32_t *rows,
+                                          const double *values,
+                                          int N, int nnz, int num_blocks)
+{
+  std::cerr << "Implicit blocks not supported by this implementation"
+            << std::endl;
+  exit(1);
+  return NULL;
+}
+
+bool CGContext::save_matrix(const cg_matrix *mat, FILE *file)
+{
+  return false;
+}
+
+cg_matrix* CGContext::map_matrix(void *data, int N, int nnz)
+{
+  std::cerr << "Matrix cache not supported by this implementation"
+            << std::endl;
+  exit(1);
+  return NULL;
+}
+
+const char* CGContext::matrix_format()
+{
+  return "";
+}
+
+size_t CGContext::matrix_cache_size(int N, int nnz)
+{
+  return 0;
+}
+
+double CGContext::spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                           cg_vector *result)
+{
+  // Contexts that can fuse the dot product into their spmv override this
+  spmv(mat, vec, result);
+  return dot(vec, result);
+}
+
+double CGContext::calc_xr_wr(cg_vector *x, cg_vector *r,
+                             const cg_vector *p, const cg_vector *w,
+                             double alpha, double *wr)
+{
+  // Contexts that can fuse the dot product into their update override this
+  *wr = dot(w, r);
+  return calc_xr(x, r, p, w, alpha);
+}
+
+void CGContext::set_check_interval(int k)
+{
+  // Contexts that can skip their checks override this
+}
+
+CGContext::CheckResult CGContext::last_check()
+{
+  return CHECK_PASSED;
+}
+
+void CGContext::inject_vector_bitflip(cg_vector *vec, int num_flips)
+{
+  std::cerr << "Vector bit-flips not supported by this implementation"
+            << std::endl;
+  exit(1);
+}
+
+void CGContext::set_vector_checksums(bool enable)
+{
+  if (enable)
+  {
+    std::cerr << "Vector checksums not supported by this implementation"
+              << std::endl;
+    exit(1);
+  }
+}
+
+void CGContext::set_numa_replication(bool enable)
+{
+  if (enable)
+  {
+    std::cerr << "NUMA replication not supported by this implementation"
+              << std::endl;
+    exit(1);
+  }
+}
+
+void CGContext::spmv_bandwidth(std::vector<int>& nodes,
+                               std::vector<double>& bandwidth)
+{
+  // Contexts that model their spmv traffic override this
+}
+
+void CGContext::set_huge_pages(HugePages kind)
+{
+  if (kind != HUGE_PAGES_DEFAULT)
+  {
+    std::cerr << "Huge pages not supported by this implementation"
+              << std::endl;
+    exit(1);
+  }
+}
+
+void CGContext::huge_page_usage(size_t *mapped, size_t *huge)
+{
+  *mapped = 0;
+  *huge   = 0;
+}
+
+void CGContext::set_scrub_interval(int interval_ms)
+{
+  if (interval_ms >= 0)
+  {
+    std::cerr << "Scrubbing not supported by this implementation"
+              << std::endl;
+    exit(1);
+  }
+}
+
+void CGContext::set_iteration(int itr)
+{
+  error_log.set_iteration(itr);
+}
+
+unsigned CGContext::num_errors(ErrorKind kind) const
+{
+  return error_log.count(kind);
+}
+
+void CGContext::take_errors(std::vector<ErrorEvent>& events)
+{
+  error_log.take(events);
+}
+
 void CGContext::list_contexts()
 {
   std::cout << std::endl
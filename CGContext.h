@@ -1,5 +1,10 @@
 #include <cstdint>
+#include <cstdio>
 #include <list>
+#include <vector>
+
+#include "Arena.h"
+#include "ErrorLog.h"
 
 // Opaque types
 struct cg_matrix;
@@ -9,6 +14,7 @@ class CGContext
 {
 public:
   enum BitFlipKind {ANY, VALUE, INDEX};
+  enum CheckResult {NOT_CHECKED, CHECK_PASSED, CHECK_CORRECTED};
 
   virtual ~CGContext(){};
 
@@ -16,8 +22,27 @@ public:
                                    const uint32_t *rows,
                                    const double *values,
                                    int N, int nnz) = 0;
+  // Create a matrix of num_blocks copies of the N x N block given, along
+  // its diagonal, that stores the block only once. Its spmv multiplies each
+  // copy by its slice of the vector in turn, so the block stays in cache.
+  virtual cg_matrix* create_block_matrix(const uint32_t *columns,
+                                         const uint32_t *rows,
+                                         const double *values,
+                                         int N, int nnz, int num_blocks);
   virtual void       destroy_matrix(cg_matrix *mat) = 0;
 
+  // Write the arrays that store mat to file (see MatrixCache.h), or return
+  // false if the context cannot
+  virtual bool       save_matrix(const cg_matrix *mat, FILE *file);
+  // Create a matrix from a mapping of what save_matrix wrote, which it may
+  // write to, and which the caller unmaps after destroying the matrix
+  virtual cg_matrix* map_matrix(void *data, int N, int nnz);
+  // Name of the format that save_matrix stores a matrix in, and the bytes
+  // that it writes for an N x N matrix of nnz non-zeros, which a cache must
+  // match before it is mapped
+  virtual const char* matrix_format();
+  virtual size_t     matrix_cache_size(int N, int nnz);
+
   virtual cg_vector* create_vector(int N) = 0;
   virtual void       destroy_vector(cg_vector *vec) = 0;
   virtual double*    map_vector(cg_vector *v) = 0;
@@ -28,12 +53,59 @@ public:
   virtual double     calc_xr(cg_vector *x, cg_vector *r,
                              const cg_vector *p, const cg_vector *w,
                              double alpha) = 0;
+  // As calc_xr, also setting wr to wT * r, with r from before the update
+  virtual double     calc_xr_wr(cg_vector *x, cg_vector *r,
+                                const cg_vector *p, const cg_vector *w,
+                                double alpha, double *wr);
   virtual void       calc_p(cg_vector *p, const cg_vector *r, double beta) = 0;
   virtual void       spmv(const cg_matrix *mat, const cg_vector *vec,
                           cg_vector *result) = 0;
+  // result = mat*vec, returning vecT * result
+  virtual double     spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                              cg_vector *result);
 
   virtual void       inject_bitflip(cg_matrix *mat,
                                     BitFlipKind kind, int num_flips) = 0;
+  // Flip num_flips random bits of a random element of vec, without updating
+  // its checksums
+  virtual void       inject_vector_bitflip(cg_vector *vec, int num_flips);
+
+  // Only check the matrix for errors on every k-th spmv
+  virtual void       set_check_interval(int k);
+  // Outcome of the matrix check made by the most recent spmv
+  virtual CheckResult last_check();
+
+  // Protect the vectors created from now on with block checksums
+  virtual void       set_vector_checksums(bool enable);
+
+  // Keep a copy of the vector that the spmv gathers from on each NUMA node
+  // that runs the kernels, refreshed by every spmv
+  virtual void       set_numa_replication(bool enable);
+  // Estimated memory bandwidth (GB/s) of the spmvs so far on each NUMA
+  // node that runs the kernels, numbered as in nodes, or none if the
+  // context does not estimate it. The bytes are modelled from the arrays
+  // that the node's rows stream, not read from memory traffic counters.
+  virtual void       spmv_bandwidth(std::vector<int>& nodes,
+                                    std::vector<double>& bandwidth);
+
+  // Allocate the matrices and vectors created from now on in an arena
+  // backed by huge pages of kind
+  virtual void       set_huge_pages(HugePages kind);
+  // Bytes that the arena has mapped, and how many of them are backed by
+  // huge pages
+  virtual void       huge_page_usage(size_t *mapped, size_t *huge);
+
+  // Scrub the matrices created from now on in a background thread, pausing
+  // interval_ms between sweeps (or not at all if 0), or not if negative.
+  // Corrections made by the scrubber count as found by the next spmv.
+  virtual void       set_scrub_interval(int interval_ms);
+
+  // Errors found by the checks so far. Checks record errors and carry on,
+  // so the caller should take them after each step and decide how to
+  // recover from any that were not corrected.
+  void               set_iteration(int itr);
+  unsigned           num_errors(ErrorKind kind) const;
+  void               take_errors(std::vector<ErrorEvent>& events);
 
   static CGContext* create(const char *impl, const char *mode);
   static void       list_contexts();
@@ -64,4 +136,6 @@ public:
 
 protected:
   CGContext(){};
+
+  ErrorLog error_log;
 };
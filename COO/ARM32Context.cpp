@@ -43,7 +43,8 @@ static uint8_t PARITY_TABLE[256] =
 
 class ARM32Context_SED : public CPUContext_SED
 {
-  virtual void spmv(const cg_matrix *mat, const cg_vector *vec, cg_vector *result)
+  virtual double checked_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                  cg_vector *result)
   {
     // Initialize result vector to zero
     for (unsigned i = 0; i < mat->N; i++)
@@ -104,11 +105,15 @@ class ARM32Context_SED : public CPUContext_SED
       : "cc", "r0", "r1", "r2", "r3", "r4", "d5", "d6", "d7", "memory"
       );
 
+    // (the loop stops at the error, leaving the rest of the matrix out)
     if (elements < mat->elements+mat->nnz)
-    {
-      printf("[ECC] error detected at index %d\n", (elements - mat->elements));
-      exit(1);
-    }
+      error_log.record(ERROR_DETECTED, ERROR_ELEMENT,
+                       elements - mat->elements);
+
+    double ret = 0.0;
+    for (unsigned i = 0; i < mat->N; i++)
+      ret += result->data[i] * vec->data[i];
+    return ret;
   }
 };
 
@@ -1,9 +1,172 @@
 #include "CPUContext.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#ifdef _OPENMP
+  #include <omp.h>
+#else
+  static inline int omp_get_thread_num() { return 0; }
+  static inline int omp_get_num_threads() { return 1; }
+#endif
+
+CPUContext::CPUContext()
+{
+  num_partials = 0;
+  end_rows     = NULL;
+  end_sums     = NULL;
+
+  num_corrected    = 0;
+  scrub_interval   = -1;
+  vector_checksums = false;
+  spmv_vec         = NULL;
+  spmv_result      = NULL;
+  spmv_offset      = 0;
+  check_interval   = 1;
+  spmv_count       = 0;
+  check_result     = NOT_CHECKED;
+}
+
+CPUContext::~CPUContext()
+{
+  delete[] end_rows;
+  delete[] end_sums;
+}
+
+// Returns this thread's partial result for a parallel spmv of vec into
+// result, whose elements the thread must take in a contiguous slice that
+// follows the slice of the thread before it (as schedule(static) gives).
+// Must be called by every thread of the enclosing parallel region.
+spmv_partial CPUContext::begin_spmv(const cg_vector *vec, cg_vector *result)
+{
+#pragma omp single
+  {
+    int nthreads = omp_get_num_threads();
+    if (nthreads > num_partials)
+    {
+      delete[] end_rows;
+      delete[] end_sums;
+      num_partials = nthreads;
+      end_rows     = new uint32_t[2*nthreads];
+      end_sums     = new double[2*nthreads];
+    }
+  }
+
+  spmv_partial partial;
+  partial.result    = result->data;
+  partial.x         = vec->data;
+  partial.N         = result->N;
+  partial.first_row = NO_ROW;
+  partial.first_sum = 0.0;
+  partial.row       = NO_ROW;
+  partial.sum       = 0.0;
+  partial.dot       = 0.0;
+  return partial;
+}
+
+// Combines the first and last runs of every thread's slice into the result,
+// and zeroes the empty rows between the slices. With one thread this only
+// writes the two rows at the ends of the matrix.
+// Returns this thread's share of vecT * result.
+// Must be called by every thread of the enclosing parallel region.
+double CPUContext::end_spmv(spmv_partial partial, checksum_gather& x_sums)
+{
+  // The current run is the last, unless the slice only has the one
+  int tid = omp_get_thread_num();
+  if (partial.first_row == NO_ROW)
+  {
+    end_rows[2*tid]   = partial.row;
+    end_sums[2*tid]   = partial.sum;
+    end_rows[2*tid+1] = NO_ROW;
+  }
+  else
+  {
+    end_rows[2*tid]   = partial.first_row;
+    end_sums[2*tid]   = partial.first_sum;
+    end_rows[2*tid+1] = partial.row;
+    end_sums[2*tid+1] = partial.sum;
+  }
+#pragma omp barrier
+
+  double ret = partial.dot;
+#pragma omp single
+  {
+    // The ends are in row order, so the runs of a row that spans slices
+    // are adjacent
+    double  *result = partial.result;
+    uint32_t row    = NO_ROW;
+    double   sum    = 0.0;
+    uint32_t next   = 0;
+    for (int e = 0; e < 2*omp_get_num_threads(); e++)
+    {
+      uint32_t r = end_rows[e];
+      if (r == NO_ROW)
+        continue;
+      if (r == row)
+      {
+        sum += end_sums[e];
+        continue;
+      }
+
+      if (row != NO_ROW)
+      {
+        result[row] = sum;
+        x_sums.check(row);
+        ret += sum * partial.x[row];
+      }
+
+      // The rows between a slice's first and last runs are its own
+      if (e % 2 == 0)
+      {
+        for (uint32_t i = next; i < r && i < partial.N; i++)
+          result[i] = 0.0;
+      }
+      row  = r;
+      sum  = end_sums[e];
+      next = r + 1;
+    }
+    if (row != NO_ROW)
+    {
+      result[row] = sum;
+      x_sums.check(row);
+      ret += sum * partial.x[row];
+    }
+    for (uint32_t i = next; i < partial.N; i++)
+      result[i] = 0.0;
+  }
+  return ret;
+}
+
+checksum_gather CPUContext::gather_checksums()
+{
+  return begin_gather(spmv_vec->data, spmv_vec->N, spmv_vec->checksums,
+                      gather_states.data(), error_log, spmv_offset);
+}
+
+checksum_rows CPUContext::result_checksums()
+{
+  return begin_rows(spmv_result->data, spmv_result->N,
+                    spmv_result->checksums, row_done.data(), spmv_offset);
+}
+
+bool CPUContext::spmv_guarded() const
+{
+  return spmv_vec->checksums || spmv_result->checksums;
+}
+
+void CPUContext::rewrote_rows(unsigned first, unsigned last)
+{
+  if (spmv_result->checksums == NULL || first >= last)
+    return;
+  for (size_t b = (spmv_offset + first) / CHECKSUM_BLOCK;
+       b <= (spmv_offset + last - 1) / CHECKSUM_BLOCK; b++)
+  {
+    row_done[b] = 0;
+  }
+}
+
 void CPUContext::generate_ecc_bits(coo_element& element)
 {
 }
@@ -15,10 +178,21 @@ cg_matrix* CPUContext::create_matrix(const uint32_t *columns,
 {
   cg_matrix *M = new cg_matrix;
 
-  M->N         = N;
-  M->nnz       = nnz;
-  M->elements  = new coo_element[nnz];
-
+  M->N          = N;
+  M->nnz        = nnz;
+  M->elements   = arena.allocate<coo_element>(nnz);
+  M->checksums  = NULL;
+  M->scrubber   = NULL;
+  M->mapped     = false;
+  M->num_blocks = 1;
+
+  // The bounds are left for the policy, which knows the column mask
+  M->gather_bounds = arena.allocate<uint32_t>(
+    2*((nnz + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK));
+
+  // Encode the elements with the same static partition as the spmv kernels,
+  // which places each page on the node of the thread that uses it
+#pragma omp parallel for
   for (int i = 0; i < nnz; i++)
   {
     coo_element element;
@@ -36,41 +210,146 @@ cg_matrix* CPUContext::create_matrix(const uint32_t *columns,
 
 void CPUContext::destroy_matrix(cg_matrix *mat)
 {
-  delete[] mat->elements;
+  // Stop the scrubber before freeing what it sweeps
+  delete mat->scrubber;
+
+  if (!mat->mapped)
+    arena.release(mat->elements);
+  arena.release(mat->gather_bounds);
   delete mat;
 }
 
+bool CPUContext::save_matrix(const cg_matrix *mat, FILE *file)
+{
+  write_cache_array(file, mat->elements, mat->nnz*sizeof(coo_element));
+  return true;
+}
+
+cg_matrix* CPUContext::map_matrix(void *data, int N, int nnz)
+{
+  cg_matrix *M = new cg_matrix;
+
+  M->N          = N;
+  M->nnz        = nnz;
+  M->elements   = (coo_element*)data;
+  M->checksums  = NULL;
+  M->scrubber   = NULL;
+  M->mapped     = true;
+  M->num_blocks = 1;
+
+  // The bounds are left for the policy, which knows the column mask
+  M->gather_bounds = arena.allocate<uint32_t>(
+    2*((nnz + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK));
+
+  return M;
+}
+
+const char* CPUContext::matrix_format()
+{
+  return "coo";
+}
+
+size_t CPUContext::matrix_cache_size(int N, int nnz)
+{
+  return cache_array_size(nnz*sizeof(coo_element));
+}
+
+cg_matrix* CPUContext::create_block_matrix(const uint32_t *columns,
+                                           const uint32_t *rows,
+                                           const double *values,
+                                           int N, int nnz, int num_blocks)
+{
+  cg_matrix *M = create_matrix(columns, rows, values, N, nnz);
+  M->num_blocks = num_blocks;
+  return M;
+}
+
 cg_vector* CPUContext::create_vector(int N)
 {
   cg_vector *result = new cg_vector;
-  result->N    = N;
-  result->data = new double[N];
+  result->N         = N;
+  result->data      = arena.allocate<double>(N);
+  result->checksums = NULL;
+
+  // Zero the vector (to match the zeroed checksums, if any) with the same
+  // static partition as the vector kernels, which places each page on the
+  // node of the thread that uses it
+#pragma omp parallel for simd
+  for (int i = 0; i < N; i++)
+  {
+    result->data[i] = 0.0;
+  }
+
+  if (vector_checksums)
+    result->checksums = new vector_checksum[checksum_blocks(N)]();
   return result;
 }
 
 void CPUContext::destroy_vector(cg_vector *vec)
 {
-  delete[] vec->data;
+  arena.release(vec->data);
+  delete[] vec->checksums;
   delete vec;
 }
 
 double* CPUContext::map_vector(cg_vector *v)
 {
+  if (v->checksums)
+    verify_vector(v->data, v->N, v->checksums, error_log);
   return v->data;
 }
 
 void CPUContext::unmap_vector(cg_vector *v, double *h)
 {
+  // The host may have written to the vector
+  if (v->checksums)
+    checksum_vector(v->data, v->N, v->checksums);
+}
+
+void CPUContext::inject_vector_bitflip(cg_vector *vec, int num_flips)
+{
+  int index = rand() % vec->N;
+
+  // Only the sign, exponent and high mantissa bits, as a flip of a lower bit
+  // may be within the rounding that the checksums tolerate
+  for (int i = 0; i < num_flips; i++)
+  {
+    int bit = 32 + rand() % 32;
+    printf("*** flipping bit %d of vector element %d ***\n", bit, index);
+    ((uint32_t*)(vec->data+index))[bit/32] ^= 0x1U << (bit % 32);
+  }
 }
 
 void CPUContext::copy_vector(cg_vector *dst, const cg_vector *src)
 {
-  memcpy(dst->data, src->data, dst->N*sizeof(double));
+  if (src->checksums)
+  {
+#pragma omp parallel for
+    for (int b = 0; b < checksum_blocks(src->N); b++)
+    {
+      verify_block(src->data, src->N, src->checksums, b, error_log);
+
+      int end = (b+1)*CHECKSUM_BLOCK < dst->N ? (b+1)*CHECKSUM_BLOCK : dst->N;
+      for (int i = b*CHECKSUM_BLOCK; i < end; i++)
+      {
+        dst->data[i] = src->data[i];
+      }
+      dst->checksums[b] = src->checksums[b];
+    }
+    return;
+  }
+
+#pragma omp parallel for simd
+  for (int i = 0; i < dst->N; i++)
+  {
+    dst->data[i] = src->data[i];
+  }
 }
 
 double CPUContext::dot(const cg_vector *a, const cg_vector *b)
 {
   double ret = 0.0;
+#pragma omp parallel for simd reduction(+:ret)
   for (int i = 0; i < a->N; i++)
   {
     ret += a->data[i] * b->data[i];
@@ -82,19 +361,81 @@ double CPUContext::calc_xr(cg_vector *x, cg_vector *r,
                            const cg_vector *p, const cg_vector *w,
                            double alpha)
 {
-  double ret = 0.0;
+  double wr;
+  return calc_xr_wr(x, r, p, w, alpha, &wr);
+}
+
+double CPUContext::calc_xr_wr(cg_vector *x, cg_vector *r,
+                              const cg_vector *p, const cg_vector *w,
+                              double alpha, double *wr)
+{
+  double ret = 0.0, ret_wr = 0.0;
+  if (x->checksums)
+  {
+    // Check the inputs and checksum the outputs one block at a time, while
+    // the block is still in cache
+#pragma omp parallel for reduction(+:ret,ret_wr)
+    for (int b = 0; b < checksum_blocks(x->N); b++)
+    {
+      verify_block(x->data, x->N, x->checksums, b, error_log);
+      verify_block(r->data, r->N, r->checksums, b, error_log);
+      verify_block(p->data, p->N, p->checksums, b, error_log);
+      verify_block(w->data, w->N, w->checksums, b, error_log);
+
+      int end = (b+1)*CHECKSUM_BLOCK < x->N ? (b+1)*CHECKSUM_BLOCK : x->N;
+#pragma omp simd reduction(+:ret,ret_wr)
+      for (int i = b*CHECKSUM_BLOCK; i < end; i++)
+      {
+        ret_wr += w->data[i] * r->data[i];
+        x->data[i] += alpha * p->data[i];
+        r->data[i] -= alpha * w->data[i];
+
+        ret += r->data[i] * r->data[i];
+      }
+
+      checksum_block(x->data, x->N, x->checksums, b);
+      checksum_block(r->data, r->N, r->checksums, b);
+    }
+    *wr = ret_wr;
+    return ret;
+  }
+
+#pragma omp parallel for simd reduction(+:ret,ret_wr)
   for (int i = 0; i < x->N; i++)
   {
+    ret_wr += w->data[i] * r->data[i];
     x->data[i] += alpha * p->data[i];
     r->data[i] -= alpha * w->data[i];
 
     ret += r->data[i] * r->data[i];
   }
+  *wr = ret_wr;
   return ret;
 }
 
 void CPUContext::calc_p(cg_vector *p, const cg_vector *r, double beta)
 {
+  if (p->checksums)
+  {
+#pragma omp parallel for
+    for (int b = 0; b < checksum_blocks(p->N); b++)
+    {
+      verify_block(r->data, r->N, r->checksums, b, error_log);
+      verify_block(p->data, p->N, p->checksums, b, error_log);
+
+      int end = (b+1)*CHECKSUM_BLOCK < p->N ? (b+1)*CHECKSUM_BLOCK : p->N;
+#pragma omp simd
+      for (int i = b*CHECKSUM_BLOCK; i < end; i++)
+      {
+        p->data[i] = r->data[i] + beta*p->data[i];
+      }
+
+      checksum_block(p->data, p->N, p->checksums, b);
+    }
+    return;
+  }
+
+#pragma omp parallel for simd
   for (int i = 0; i < p->N; i++)
   {
     p->data[i] = r->data[i] + beta*p->data[i];
@@ -104,20 +445,112 @@ void CPUContext::calc_p(cg_vector *p, const cg_vector *r, double beta)
 void CPUContext::spmv(const cg_matrix *mat, const cg_vector *vec,
                       cg_vector *result)
 {
-  // Initialize result vector to zero
-  for (unsigned i = 0; i < mat->N; i++)
-    result->data[i] = 0.0;
+  spmv_dot(mat, vec, result);
+}
 
-  // Loop over non-zeros in matrix
-  for (unsigned i = 0; i < mat->nnz; i++)
+double CPUContext::spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                            cg_vector *result)
+{
+  // The kernels verify the blocks of a protected vector as they first
+  // gather from them, and checksum the blocks of the result as they write
+  // them
+  spmv_vec    = vec;
+  spmv_result = result;
+  if (vec->checksums &&
+      gather_states.size() < (size_t)checksum_blocks(vec->N))
   {
-    // Load non-zero element
-    coo_element element = mat->elements[i];
+    std::vector< std::atomic<unsigned char> >(checksum_blocks(vec->N))
+      .swap(gather_states);
+  }
+  if (result->checksums &&
+      row_done.size() < (size_t)checksum_blocks(result->N))
+  {
+    row_done.resize(checksum_blocks(result->N), 0);
+  }
 
-    // Multiply element value by the corresponding vector value
-    // and accumulate into result vector
-    result->data[element.col] += element.value * vec->data[element.row];
+  // Skip the checks on all but every check_interval'th call
+  bool checked = ++spmv_count >= check_interval;
+  if (checked)
+    spmv_count = 0;
+  unsigned corrected = num_corrected;
+
+  // Multiply each block by its slice of vec, into its slice of result (the
+  // whole of each, unless the blocks are implicit)
+  double ret = 0.0;
+  for (unsigned b = 0; b < mat->num_blocks; b++)
+  {
+    spmv_offset = (size_t)b*mat->N;
+    cg_vector x = {(int)mat->N, vec->data + spmv_offset, NULL};
+    cg_vector y = {(int)mat->N, result->data + spmv_offset, NULL};
+    ret += checked ? checked_spmv_dot(mat, &x, &y)
+                   : unchecked_spmv_dot(mat, &x, &y);
   }
+  spmv_offset = 0;
+
+  if (!checked)
+    check_result = NOT_CHECKED;
+  else
+    check_result = num_corrected > corrected ? CHECK_CORRECTED : CHECK_PASSED;
+
+  // The scrubber may have corrected an element after an spmv used it
+  if (mat->scrubber && mat->scrubber->take_corrections())
+    check_result = CHECK_CORRECTED;
+
+  // Finish the blocks that the threads shared
+  if (vec->checksums)
+    finish_gather(gather_states.data(), vec->N);
+  if (result->checksums)
+    finish_rows(result->data, result->N, result->checksums, row_done.data());
+
+  return ret;
+}
+
+template<bool guarded>
+double CPUContext::unchecked_kernel(const cg_matrix *mat,
+                                    const cg_vector *vec,
+                                    cg_vector *result)
+{
+  double ret = 0.0;
+#pragma omp parallel reduction(+:ret)
+  {
+    spmv_partial    partial = begin_spmv(vec, result);
+    checksum_gather x_sums  = gather_checksums();
+    checksum_rows   y_sums  = result_checksums();
+    const unsigned  chunks  = (mat->nnz + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK;
+
+    // Loop over non-zeros in matrix, a chunk at a time
+#pragma omp for schedule(static) nowait
+    for (unsigned c = 0; c < chunks; c++)
+    {
+      unsigned first = c*CHECKSUM_CHUNK;
+      unsigned last  = std::min(first + CHECKSUM_CHUNK, mat->nnz);
+      if (guarded)
+        gather_elements(x_sums, mat, first, last);
+
+      for (unsigned i = first; i < last; i++)
+      {
+        // Load non-zero element
+        coo_element element = mat->elements[i];
+
+        // Multiply element value by the corresponding vector value
+        // and accumulate into the run of its row
+        partial.add(element.row, element.value * vec->data[element.col]);
+      }
+      if (guarded)
+        partial.finished(y_sums);
+    }
+
+    ret += end_spmv(partial, x_sums);
+  }
+  return ret;
+}
+
+double CPUContext::unchecked_spmv_dot(const cg_matrix *mat,
+                                      const cg_vector *vec,
+                                      cg_vector *result)
+{
+  return spmv_guarded() ? unchecked_kernel<true>(mat, vec, result)
+                        : unchecked_kernel<false>(mat, vec, result);
 }
 
 void CPUContext::inject_bitflip(cg_matrix *mat, BitFlipKind kind, int num_flips)
@@ -139,251 +572,393 @@ void CPUContext::inject_bitflip(cg_matrix *mat, BitFlipKind kind, int num_flips)
   }
 }
 
-void CPUContext_Constraints::spmv(const cg_matrix *mat, const cg_vector *vec,
-                                  cg_vector *result)
+void CPUContext::set_check_interval(int k)
 {
-  // Initialize result vector to zero
-  for (unsigned i = 0; i < mat->N; i++)
-    result->data[i] = 0.0;
-
-  // Loop over non-zeros in matrix
-  for (unsigned i = 0; i < mat->nnz; i++)
-  {
-    // Load non-zero element
-    coo_element element = mat->elements[i];
+  check_interval = k;
+}
 
-    // Check index size constraints
-    if (element.row >= mat->N)
-    {
-      printf("row size constraint violated for index %d\n", i);
-      exit(1);
-    }
-    if (element.col >= mat->N)
-    {
-      printf("column size constraint violated for index %d\n", i);
-      exit(1);
-    }
+CGContext::CheckResult CPUContext::last_check()
+{
+  return check_result;
+}
 
-    // Check index order constraints
-    // Skip last row
-    if (i < mat->nnz - 1)
-    {
-      // Compare this row index to the next row index
-      uint32_t next_row = mat->elements[i+1].row;
-      if (element.row > next_row)
-      {
-        printf("row index order violated at index %d\n", i);
-        exit(1);
-      }
-      else if (element.row == next_row)
-      {
-        // Compare this column index to the next column index (if same row)
-        uint32_t next_col = mat->elements[i+1].col;
-        if (element.col >= next_col)
-        {
-          printf("column index order violated at index %d\n", i);
-          exit(1);
-        }
-      }
-    }
+void CPUContext::set_vector_checksums(bool enable)
+{
+  vector_checksums = enable;
+}
 
-    // Multiply element value by the corresponding vector value
-    // and accumulate into result vector
-    result->data[element.col] += element.value * vec->data[element.row];
-  }
+void CPUContext::set_huge_pages(HugePages kind)
+{
+  arena.set_huge_pages(kind);
 }
 
-void CPUContext_SED::generate_ecc_bits(coo_element& element)
+void CPUContext::huge_page_usage(size_t *mapped, size_t *huge)
 {
-  element.col |= ecc_compute_overall_parity(element) << 31;
+  arena.usage(mapped, huge);
 }
 
-void CPUContext_SED::spmv(const cg_matrix *mat, const cg_vector *vec,
-                          cg_vector *result)
+template<class Policy>
+void PolicyContext<Policy>::generate_ecc_bits(coo_element& element)
 {
-  // Initialize result vector to zero
-  for (unsigned i = 0; i < mat->N; i++)
-    result->data[i] = 0.0;
+  Policy::generate(element);
+}
 
-  // Loop over non-zeros in matrix
-  for (unsigned i = 0; i < mat->nnz; i++)
+// Check and correct elements [first, last)
+template<class Policy>
+static unsigned scrub_elements(const cg_matrix *mat, unsigned first,
+                               unsigned last, ErrorLog& log)
+{
+  unsigned corrected = 0;
+  for (unsigned i = first; i < last; i++)
   {
-    // Load non-zero element
     coo_element element = mat->elements[i];
-
-    // Check overall parity bit
-    if (ecc_compute_overall_parity(element))
+    if (Policy::check(element, i, log))
     {
-      printf("[ECC] error detected at index %d\n", i);
-      exit(1);
+      mat->elements[i] = element;
+      corrected++;
     }
-
-    // Mask out ECC from high order column bits
-    element.col &= 0x00FFFFFF;
-
-    // Multiply element value by the corresponding vector value
-    // and accumulate into result vector
-    result->data[element.col] += element.value * vec->data[element.row];
   }
+  return corrected;
 }
 
-void CPUContext_SEC7::generate_ecc_bits(coo_element& element)
+template<class Policy>
+cg_matrix* PolicyContext<Policy>::create_matrix(const uint32_t *columns,
+                                                const uint32_t *rows,
+                                                const double *values,
+                                                int N, int nnz)
 {
-  element.col |= ecc_compute_col8(element);
+  cg_matrix *M = CPUContext::create_matrix(columns, rows, values, N, nnz);
+  bound_gathers(M, Policy::column_mask);
+  start_scrubber(M);
+  return M;
 }
 
-void CPUContext_SEC7::spmv(const cg_matrix *mat, const cg_vector *vec,
-                           cg_vector *result)
+template<class Policy>
+cg_matrix* PolicyContext<Policy>::map_matrix(void *data, int N, int nnz)
 {
-  // Initialize result vector to zero
-  for (unsigned i = 0; i < mat->N; i++)
-    result->data[i] = 0.0;
+  cg_matrix *M = CPUContext::map_matrix(data, N, nnz);
+  bound_gathers(M, Policy::column_mask);
+  start_scrubber(M);
+  return M;
+}
 
-  // Loop over non-zeros in matrix
-  for (unsigned i = 0; i < mat->nnz; i++)
+template<class Policy>
+void PolicyContext<Policy>::start_scrubber(cg_matrix *M)
+{
+  if (scrub_interval >= 0)
   {
-    // Load non-zero element
-    coo_element element = mat->elements[i];
+    M->scrubber = new Scrubber(M->nnz, scrub_interval,
+                               [M](unsigned first, unsigned last,
+                                   ErrorLog& log)
+                               {
+                                 return scrub_elements<Policy>(M, first,
+                                                               last, log);
+                               },
+                               error_log);
+  }
+}
 
-    // Check ECC
-    uint32_t syndrome = ecc_compute_col8(element);
-    if (syndrome)
+template<class Policy>
+template<bool guarded>
+double PolicyContext<Policy>::checked_kernel(const cg_matrix *mat,
+                                             const cg_vector *vec,
+                                             cg_vector *result)
+{
+  double ret = 0.0;
+  unsigned corrected = 0;
+#pragma omp parallel reduction(+:ret,corrected)
+  {
+    spmv_partial partial = begin_spmv(vec, result);
+
+    // Private copies of the matrix and vector descriptors, which recording
+    // an error cannot change, so that the compiler does not reload them for
+    // every element
+    coo_element   *elements = mat->elements;
+    const unsigned N        = mat->N;
+    const unsigned nnz      = mat->nnz;
+    const double  *x        = vec->data;
+
+    checksum_gather x_sums = gather_checksums();
+    checksum_rows   y_sums = result_checksums();
+    const unsigned  chunks = (nnz + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK;
+
+    // Loop over non-zeros in matrix, a chunk at a time
+#pragma omp for schedule(static) nowait
+    for (unsigned c = 0; c < chunks; c++)
     {
-      // Unflip bit
-      uint32_t bit = ecc_get_flipped_bit_col8(syndrome);
-      ((uint32_t*)(&element))[bit/32] ^= 0x1U << (bit % 32);
-      mat->elements[i] = element;
+      unsigned first = c*CHECKSUM_CHUNK;
+      unsigned last  = std::min(first + CHECKSUM_CHUNK, nnz);
+      if (guarded)
+        gather_elements(x_sums, mat, first, last);
 
-      printf("[ECC] corrected bit %u at index %d\n", bit, i);
-    }
+      for (unsigned i = first; i < last; i++)
+      {
+        // Load non-zero element
+        coo_element element = elements[i];
+
+        if (Policy::check(element, i, error_log))
+        {
+          elements[i] = element;
+          corrected++;
+        }
 
-    // Mask out ECC from high order column bits
-    element.col &= 0x00FFFFFF;
+        // Mask out ECC from high order column bits
+        element.col &= Policy::column_mask;
+
+        // Check the indices against the element before, which this thread
+        // has already corrected unless it is the first of its slice
+        coo_element prev = elements[i > 0 ? i-1 : 0];
+        prev.col &= Policy::column_mask;
+        Policy::check_indices(element, prev, i, N, error_log);
+
+        // Skip indices that the checks could not correct
+        if (Policy::checks && (element.col >= N || element.row >= N))
+          continue;
+
+        // Multiply element value by the corresponding vector value
+        // and accumulate into the run of its row, unless the row is out of
+        // order, so that a bad row index only loses its own element
+        double value = element.value * x[element.col];
+        if (Policy::checks)
+          partial.add_in_order(element.row, value, elements, i, nnz,
+                               !Policy::corrects);
+        else
+          partial.add(element.row, value);
+      }
+      if (guarded)
+        partial.finished(y_sums);
+    }
 
-    // Multiply element value by the corresponding vector value
-    // and accumulate into result vector
-    result->data[element.col] += element.value * vec->data[element.row];
+    ret += end_spmv(partial, x_sums);
   }
+  num_corrected += corrected;
+  return ret;
 }
 
-void CPUContext_SEC8::generate_ecc_bits(coo_element& element)
+template<class Policy>
+double PolicyContext<Policy>::checked_spmv_dot(const cg_matrix *mat,
+                                               const cg_vector *vec,
+                                               cg_vector *result)
 {
-  element.col |= ecc_compute_col8(element);
-  element.col |= ecc_compute_overall_parity(element) << 24;
+  return spmv_guarded() ? checked_kernel<true>(mat, vec, result)
+                        : checked_kernel<false>(mat, vec, result);
 }
 
-void CPUContext_SEC8::spmv(const cg_matrix *mat, const cg_vector *vec,
-                           cg_vector *result)
+template<class Policy>
+template<bool guarded>
+double PolicyContext<Policy>::unchecked_kernel(const cg_matrix *mat,
+                                               const cg_vector *vec,
+                                               cg_vector *result)
 {
-  // Initialize result vector to zero
-  for (unsigned i = 0; i < mat->N; i++)
-    result->data[i] = 0.0;
-
-  // Loop over non-zeros in matrix
-  for (unsigned i = 0; i < mat->nnz; i++)
+  double ret = 0.0;
+#pragma omp parallel reduction(+:ret)
   {
-    // Load non-zero element
-    coo_element element = mat->elements[i];
-
-    // Check overall parity bit
-    if (ecc_compute_overall_parity(element))
+    spmv_partial    partial = begin_spmv(vec, result);
+    checksum_gather x_sums  = gather_checksums();
+    checksum_rows   y_sums  = result_checksums();
+    const unsigned  chunks  = (mat->nnz + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK;
+
+    // Loop over non-zeros in matrix, a chunk at a time
+#pragma omp for schedule(static) nowait
+    for (unsigned c = 0; c < chunks; c++)
     {
-      // Compute error syndrome from hamming bits
-      uint32_t syndrome = ecc_compute_col8(element);
-      if (syndrome)
-      {
-        // Unflip bit
-        uint32_t bit = ecc_get_flipped_bit_col8(syndrome);
-        ((uint32_t*)(&element))[bit/32] ^= 0x1U << (bit % 32);
+      unsigned first = c*CHECKSUM_CHUNK;
+      unsigned last  = std::min(first + CHECKSUM_CHUNK, mat->nnz);
+      if (guarded)
+        gather_elements(x_sums, mat, first, last);
 
-        printf("[ECC] corrected bit %u at index %d\n", bit, i);
-      }
-      else
+      for (unsigned i = first; i < last; i++)
       {
-        // Correct overall parity bit
-        element.col ^= 0x1U << 24;
-
-        printf("[ECC] corrected overall parity bit at index %d\n", i);
+        // Load non-zero element
+        coo_element element = mat->elements[i];
+
+        // Mask out ECC from high order column bits
+        element.col &= Policy::column_mask;
+
+        // Skip indices corrupted since the last check, which the next check
+        // will correct (and the solver will roll back past)
+        if (Policy::checks && (element.col >= mat->N || element.row >= mat->N))
+          continue;
+
+        // Multiply element value by the corresponding vector value
+        // and accumulate into the run of its row, unless the row is out of
+        // order
+        double value = element.value * vec->data[element.col];
+        if (Policy::checks)
+          partial.add_in_order(element.row, value, mat->elements, i,
+                               mat->nnz, true);
+        else
+          partial.add(element.row, value);
       }
-      mat->elements[i] = element;
+      if (guarded)
+        partial.finished(y_sums);
     }
 
-    // Mask out ECC from high order column bits
-    element.col &= 0x00FFFFFF;
+    ret += end_spmv(partial, x_sums);
+  }
+  return ret;
+}
+
+template<class Policy>
+double PolicyContext<Policy>::unchecked_spmv_dot(const cg_matrix *mat,
+                                                 const cg_vector *vec,
+                                                 cg_vector *result)
+{
+  return spmv_guarded() ? unchecked_kernel<true>(mat, vec, result)
+                        : unchecked_kernel<false>(mat, vec, result);
+}
 
-    // Multiply element value by the corresponding vector value
-    // and accumulate into result vector
-    result->data[element.col] += element.value * vec->data[element.row];
+template<class Policy>
+void PolicyContext<Policy>::set_scrub_interval(int interval_ms)
+{
+  // Only the elements of the ECC modes can be scrubbed
+  if (Policy::column_mask == 0xFFFFFFFF)
+  {
+    CGContext::set_scrub_interval(interval_ms);
+    return;
   }
+  scrub_interval = interval_ms;
 }
 
-void CPUContext_SECDED::generate_ecc_bits(coo_element& element)
+cg_matrix* CPUContext_Checksum::create_matrix(const uint32_t *columns,
+                                              const uint32_t *rows,
+                                              const double *values,
+                                              int N, int nnz)
 {
-  element.col |= ecc_compute_col8(element);
-  element.col |= ecc_compute_overall_parity(element) << 24;
+  cg_matrix *M = CPUContext::create_matrix(columns, rows, values, N, nnz);
+  bound_gathers(M, 0xFFFFFFFF);
+
+  // Element (row, col) contributes to result[col]
+  M->checksums = create_matrix_checksums(rows, columns, values, N, nnz);
+  return M;
 }
 
-void CPUContext_SECDED::spmv(const cg_matrix *mat, const cg_vector *vec,
-                             cg_vector *result)
+void CPUContext_Checksum::destroy_matrix(cg_matrix *mat)
 {
-  // Initialize result vector to zero
-  for (unsigned i = 0; i < mat->N; i++)
-    result->data[i] = 0.0;
+  destroy_matrix_checksums(mat->checksums);
+  CPUContext::destroy_matrix(mat);
+}
 
-  // Loop over non-zeros in matrix
-  for (unsigned i = 0; i < mat->nnz; i++)
+// The column checksums are built from the input, which a cache would not
+// hold
+bool CPUContext_Checksum::save_matrix(const cg_matrix *mat, FILE *file)
+{
+  return CGContext::save_matrix(mat, file);
+}
+
+cg_matrix* CPUContext_Checksum::map_matrix(void *data, int N, int nnz)
+{
+  return CGContext::map_matrix(data, N, nnz);
+}
+
+template<bool guarded>
+double CPUContext_Checksum::checked_kernel(const cg_matrix *mat,
+                                           const cg_vector *vec,
+                                           cg_vector *result)
+{
+  double ret = 0.0;
+#pragma omp parallel reduction(+:ret)
   {
-    // Load non-zero element
-    coo_element element = mat->elements[i];
+    spmv_partial    partial = begin_spmv(vec, result);
+    checksum_gather x_sums  = gather_checksums();
+    checksum_rows   y_sums  = result_checksums();
+    const unsigned  chunks  = (mat->nnz + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK;
 
-    // Check parity bits
-    uint32_t overall_parity = ecc_compute_overall_parity(element);
-    uint32_t syndrome = ecc_compute_col8(element);
-    if (overall_parity)
+#pragma omp for schedule(static) nowait
+    for (unsigned c = 0; c < chunks; c++)
     {
-      if (syndrome)
-      {
-        // Unflip bit
-        uint32_t bit = ecc_get_flipped_bit_col8(syndrome);
-        ((uint32_t*)(&element))[bit/32] ^= 0x1U << (bit % 32);
+      unsigned first = c*CHECKSUM_CHUNK;
+      unsigned last  = std::min(first + CHECKSUM_CHUNK, mat->nnz);
+      if (guarded)
+        gather_elements(x_sums, mat, first, last);
 
-        printf("[ECC] corrected bit %u at index %d\n", bit, i);
-      }
-      else
+      for (unsigned i = first; i < last; i++)
       {
-        // Correct overall parity bit
-        element.col ^= 0x1U << 24;
+        coo_element element = mat->elements[i];
+
+        // Skip elements with corrupted indices, including a row that is out
+        // of order, for the checksums to catch (rather than adding them to
+        // another row, which would split its run)
+        if (element.col >= mat->N || element.row >= mat->N)
+          continue;
 
-        printf("[ECC] corrected overall parity bit at index %d\n", i);
+        partial.add_in_order(element.row,
+                             element.value * vec->data[element.col],
+                             mat->elements, i, mat->nnz, true);
       }
-      mat->elements[i] = element;
+      if (guarded)
+        partial.finished(y_sums);
     }
-    else
+
+    ret += end_spmv(partial, x_sums);
+  }
+
+  if (verify_matrix_checksums(mat->checksums, vec->data, result->data))
+    return ret;
+
+  num_corrected += recover_matrix_checksums(mat->checksums,
+                                            vec->data, result->data,
+                                            error_log,
+    [&](unsigned first, unsigned last)
     {
-      if (syndrome)
+      for (unsigned i = first; i < last; i++)
+        result->data[i] = 0.0;
+      for (unsigned i = 0; i < mat->nnz; i++)
       {
-        // Overall parity fine but error in syndrom
-        // Must be double-bit error - cannot correct this
-        printf("[ECC] double-bit error detected\n");
-        exit(1);
+        coo_element element = mat->elements[i];
+        if (element.row >= first && element.row < last &&
+            element.col < mat->N)
+        {
+          result->data[element.row] += element.value * vec->data[element.col];
+        }
       }
-    }
+      rewrote_rows(first, last);
+    });
 
-    // Mask out ECC from high order column bits
-    element.col &= 0x00FFFFFF;
-
-    // Multiply element value by the corresponding vector value
-    // and accumulate into result vector
-    result->data[element.col] += element.value * vec->data[element.row];
+  ret = 0.0;
+#pragma omp parallel for simd reduction(+:ret)
+  for (unsigned i = 0; i < mat->N; i++)
+  {
+    ret += result->data[i] * vec->data[i];
   }
+  return ret;
 }
 
+double CPUContext_Checksum::checked_spmv_dot(const cg_matrix *mat,
+                                             const cg_vector *vec,
+                                             cg_vector *result)
+{
+  return spmv_guarded() ? checked_kernel<true>(mat, vec, result)
+                        : checked_kernel<false>(mat, vec, result);
+}
+
+// Used by the contexts in the other source files
+template class PolicyContext<SED>;
+template class PolicyContext<SEC7>;
+template class PolicyContext<SEC8>;
+template class PolicyContext<SECDED>;
+
 namespace
 {
-  static CGContext::Register<CPUContext> A("cpu", "none");
-  static CGContext::Register<CPUContext_Constraints> B("cpu", "constraints");
-  static CGContext::Register<CPUContext_SED> C("cpu", "sed");
-  static CGContext::Register<CPUContext_SEC7> D("cpu", "sec7");
-  static CGContext::Register<CPUContext_SEC8> E("cpu", "sec8");
-  static CGContext::Register<CPUContext_SECDED> F("cpu", "secded");
+  // Register PolicyContext<P> under target for each P in Policies
+  template<class... Policies>
+  struct RegisterPolicies
+  {
+    RegisterPolicies(const char *target)
+    {
+      int registered[] =
+      {
+        (CGContext::Register< PolicyContext<Policies> >(
+           target, Policies::name()), 0)...
+      };
+      (void)registered;
+    }
+  };
+
+  static RegisterPolicies<None, Constraints, SED, SEC7, SEC8, SECDED,
+                          Combined<Constraints, SED>,
+                          Combined<Constraints, SEC7>,
+                          Combined<Constraints, SEC8>,
+                          Combined<Constraints, SECDED> > A("cpu");
+  static CGContext::Register<CPUContext_Checksum> B("cpu", "checksum");
 }
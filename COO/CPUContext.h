@@ -1,11 +1,19 @@
 #include "CGContext.h"
 
 #include "ecc.h"
+#include "MatrixCache.h"
+#include "MatrixChecksums.h"
+#include "Policies.h"
+#include "Scrubber.h"
+#include "VectorChecksums.h"
 
 struct cg_vector
 {
   int N;
   double *data;
+
+  // Block checksums, or NULL if the vector is not protected
+  vector_checksum *checksums;
 };
 
 struct cg_matrix
@@ -13,16 +21,247 @@ struct cg_matrix
   unsigned N;
   unsigned nnz;
   coo_element *elements;
+
+  // Column checksums, used by the checksum mode
+  matrix_checksums *checksums;
+
+  // Background scrubber, or NULL if the matrix is not scrubbed
+  Scrubber *scrubber;
+
+  // Whether the elements are in a mapping of a matrix cache, rather than
+  // in the context's arena
+  bool mapped;
+
+  // Number of copies of these elements along the diagonal of the matrix
+  // that the spmv multiplies by, which all share the array
+  unsigned num_blocks;
+
+  // Lowest and highest index of the vector that each chunk of
+  // CHECKSUM_CHUNK elements gathers from in an spmv (see bound_gathers)
+  uint32_t *gather_bounds;
+};
+
+// Row of a run that has not started
+#define NO_ROW UINT32_MAX
+
+// A thread's contiguous slice of the elements in a parallel spmv. The
+// elements are sorted by row, so the slice is a sequence of runs that each
+// sum one row. The rows after its first run and before its last are the
+// thread's alone and are written straight into the result, along with the
+// empty rows between them, while the first and last runs, which may
+// continue into the slices either side, are left for end_spmv to combine.
+struct spmv_partial
+{
+  double       *result;
+  const double *x;
+  uint32_t      N;
+
+  uint32_t first_row;  // row of the first run, once it has ended
+  double   first_sum;
+  uint32_t row;        // row of the current run
+  double   sum;
+  double   dot;        // this thread's share of x'result so far
+
+  inline void add(uint32_t r, double value)
+  {
+    if (r != row)
+      next_run(r);
+    sum += value;
+  }
+
+  // End the current run and start one for row r
+  inline void next_run(uint32_t r)
+  {
+    if (first_row == NO_ROW)
+    {
+      first_row = row;
+      first_sum = sum;
+    }
+    else
+    {
+      result[row] = sum;
+      dot        += sum * x[row];
+    }
+    if (row != NO_ROW)
+    {
+      for (uint32_t i = row + 1; i < r && i < N; i++)
+        result[i] = 0.0;
+    }
+    row = r;
+    sum = 0.0;
+  }
+
+  // As add, for element i of nnz, but skip it if its row is out of order
+  // with the elements around it, which are sorted by row, so that the row
+  // must be corrupted: before the current run, or after the next element
+  // when that continues the current run. Adding it would end a run that is
+  // still going, and overwrite or zero rows that are already correct. The
+  // next element is only looked at if ahead is set, as a check that
+  // corrects indices may not have corrected it yet.
+  inline void add_in_order(uint32_t r, double value,
+                           const coo_element *elements, uint32_t i,
+                           uint32_t nnz, bool ahead)
+  {
+    if (r != row)
+    {
+      uint32_t current = row == NO_ROW ? 0 : row;
+      if (r < current)
+        return;
+      if (ahead && i + 1 < nnz)
+      {
+        uint32_t next = elements[i+1].row;
+        if (r > next && next >= current)
+          return;
+      }
+      next_run(r);
+    }
+    sum += value;
+  }
+
+  // Checksum the blocks of the result that the runs so far have finished
+  inline void finished(checksum_rows& y_sums) const
+  {
+    if (first_row != NO_ROW)
+      y_sums.written(first_row + 1, row);
+  }
 };
 
+// Record the lowest and highest index of the vector that each chunk of
+// CHECKSUM_CHUNK elements of a new matrix gathers from in an spmv, including
+// their rows (for the dot product), so that the kernels can verify the
+// blocks of a protected vector that a chunk gathers from without searching
+// it. The columns carry ECC bits outside column_mask. An index corrupted
+// later is either corrected back within the bounds, or skipped, before it is
+// gathered from, unless the matrix is not checked at all.
+static inline void bound_gathers(cg_matrix *M, uint32_t column_mask)
+{
+  int chunks = (M->nnz + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK;
+#pragma omp parallel for
+  for (int c = 0; c < chunks; c++)
+  {
+    uint32_t first = c*CHECKSUM_CHUNK;
+    uint32_t last  = std::min(first + CHECKSUM_CHUNK, M->nnz);
+    uint32_t lo    = UINT32_MAX, hi = 0;
+    for (uint32_t i = first; i < last; i++)
+    {
+      uint32_t col = M->elements[i].col & column_mask;
+      lo = std::min(lo, std::min(col, M->elements[i].row));
+      hi = std::max(hi, std::max(col, M->elements[i].row));
+    }
+    M->gather_bounds[2*c]   = lo;
+    M->gather_bounds[2*c+1] = hi;
+  }
+}
+
+// Verify the blocks of the vector that elements [first, last) of a matrix
+// gather from in an spmv
+static inline void gather_elements(checksum_gather& x_sums,
+                                   const cg_matrix *M,
+                                   unsigned first, unsigned last)
+{
+  if (x_sums.checksums == NULL || first >= last)
+    return;
+
+  uint32_t lo = UINT32_MAX, hi = 0;
+  for (unsigned c = first / CHECKSUM_CHUNK;
+       c <= (last - 1) / CHECKSUM_CHUNK; c++)
+  {
+    lo = std::min(lo, M->gather_bounds[2*c]);
+    hi = std::max(hi, M->gather_bounds[2*c+1]);
+  }
+  x_sums.check(lo);
+  x_sums.check(hi);
+}
+
 class CPUContext : public CGContext
 {
-  virtual void generate_ecc_bits(coo_element& element);
+public:
+  CPUContext();
+  virtual ~CPUContext();
+
+protected:
+  // Number of matrix errors corrected so far
+  unsigned num_corrected;
+
+  // Pause between sweeps of the scrubber of new matrices, or -1 for none
+  int scrub_interval;
+
+  // Storage of the matrix and vector arrays
+  Arena arena;
+
+  // (the partial is passed by value, so that it never escapes the kernel
+  // and can stay in registers across the calls that record errors, and the
+  // rows that end_spmv combines are checked with x_sums)
+  spmv_partial begin_spmv(const cg_vector *vec, cg_vector *result);
+  double       end_spmv(spmv_partial partial, checksum_gather& x_sums);
+
+  // The calling thread's guards of its gathers from the vector and writes
+  // to the result in an spmv, which verify and checksum the blocks of the
+  // whole vectors as the kernel reaches them (see VectorChecksums.h)
+  checksum_gather gather_checksums();
+  checksum_rows   result_checksums();
+
+  // Whether the vectors of the current spmv are protected, so that its
+  // kernel must verify and checksum their blocks. The kernels are
+  // instantiated both ways, so that an unprotected spmv has no guards.
+  bool spmv_guarded() const;
+
+  // Mark rows [first, last) of the result as written again after the
+  // kernel, so that their blocks are checksummed again
+  void rewrote_rows(unsigned first, unsigned last);
+
   virtual cg_matrix* create_matrix(const uint32_t *columns,
                                    const uint32_t *rows,
                                    const double *values,
                                    int N, int nnz);
   virtual void destroy_matrix(cg_matrix *mat);
+  virtual bool save_matrix(const cg_matrix *mat, FILE *file);
+  virtual cg_matrix* map_matrix(void *data, int N, int nnz);
+  virtual const char* matrix_format();
+  virtual size_t matrix_cache_size(int N, int nnz);
+
+  virtual double checked_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                  cg_vector *result) = 0;
+  virtual double unchecked_spmv_dot(const cg_matrix *mat,
+                                    const cg_vector *vec,
+                                    cg_vector *result);
+
+private:
+  // The kernel, instantiated with and without the guards of protected
+  // vectors (see spmv_guarded)
+  template<bool guarded>
+  double unchecked_kernel(const cg_matrix *mat, const cg_vector *vec,
+                          cg_vector *result);
+
+  // The first and last runs of each thread's slice of the elements in a
+  // parallel spmv
+  int       num_partials;
+  uint32_t *end_rows;
+  double   *end_sums;
+
+  // Whether new vectors are protected with checksums
+  bool vector_checksums;
+
+  // The whole vector and result of the current spmv, the offset of the
+  // block of them that the kernel multiplies, and which of their blocks the
+  // kernel has verified and checksummed
+  const cg_vector                          *spmv_vec;
+  cg_vector                                *spmv_result;
+  size_t                                    spmv_offset;
+  std::vector< std::atomic<unsigned char> > gather_states;
+  std::vector<unsigned char>                row_done;
+
+  // Periodic checking state
+  int         check_interval;
+  int         spmv_count;
+  CheckResult check_result;
+
+  virtual void generate_ecc_bits(coo_element& element);
+
+  virtual cg_matrix* create_block_matrix(const uint32_t *columns,
+                                         const uint32_t *rows,
+                                         const double *values,
+                                         int N, int nnz, int num_blocks);
 
   virtual cg_vector* create_vector(int N);
   virtual void destroy_vector(cg_vector *vec);
@@ -34,44 +273,79 @@ class CPUContext : public CGContext
   virtual double calc_xr(cg_vector *x, cg_vector *r,
                          const cg_vector *p, const cg_vector *w,
                          double alpha);
+  virtual double calc_xr_wr(cg_vector *x, cg_vector *r,
+                            const cg_vector *p, const cg_vector *w,
+                            double alpha, double *wr);
   virtual void calc_p(cg_vector *p, const cg_vector *r, double beta);
 
   virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
                     cg_vector *result);
+  virtual double spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                          cg_vector *result);
 
   virtual void inject_bitflip(cg_matrix *mat, BitFlipKind kind, int num_flips);
-};
+  virtual void inject_vector_bitflip(cg_vector *vec, int num_flips);
 
-class CPUContext_Constraints : public CPUContext
-{
-  virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
-                    cg_vector *result);
+  virtual void set_check_interval(int k);
+  virtual CheckResult last_check();
+  virtual void set_vector_checksums(bool enable);
+  virtual void set_huge_pages(HugePages kind);
+  virtual void huge_page_usage(size_t *mapped, size_t *huge);
 };
 
-class CPUContext_SED : public CPUContext
+// COO context whose checked spmv kernel is specialised for a checking
+// Policy (see Policies.h). The members are defined and explicitly
+// instantiated in CPUContext.cpp.
+template<class Policy>
+class PolicyContext : public CPUContext
 {
+protected:
   virtual void generate_ecc_bits(coo_element& element);
-  virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
-                    cg_vector *result);
-};
+  virtual cg_matrix* create_matrix(const uint32_t *columns,
+                                   const uint32_t *rows,
+                                   const double *values,
+                                   int N, int nnz);
+  virtual cg_matrix* map_matrix(void *data, int N, int nnz);
+  virtual double checked_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                  cg_vector *result);
+  virtual double unchecked_spmv_dot(const cg_matrix *mat,
+                                    const cg_vector *vec,
+                                    cg_vector *result);
 
-class CPUContext_SEC7 : public CPUContext
-{
-  virtual void generate_ecc_bits(coo_element& element);
-  virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
-                    cg_vector *result);
-};
+  virtual void set_scrub_interval(int interval_ms);
 
-class CPUContext_SEC8 : public CPUContext
-{
-  virtual void generate_ecc_bits(coo_element& element);
-  virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
-                    cg_vector *result);
+private:
+  void start_scrubber(cg_matrix *M);
+
+  // The kernels, instantiated with and without the guards of protected
+  // vectors (see spmv_guarded)
+  template<bool guarded>
+  double checked_kernel(const cg_matrix *mat, const cg_vector *vec,
+                        cg_vector *result);
+  template<bool guarded>
+  double unchecked_kernel(const cg_matrix *mat, const cg_vector *vec,
+                          cg_vector *result);
 };
 
-class CPUContext_SECDED : public CPUContext
+typedef PolicyContext<SED>    CPUContext_SED;
+typedef PolicyContext<SEC7>   CPUContext_SEC7;
+typedef PolicyContext<SEC8>   CPUContext_SEC8;
+typedef PolicyContext<SECDED> CPUContext_SECDED;
+
+// Huang-Abraham column checksums instead of ECC
+class CPUContext_Checksum : public CPUContext
 {
-  virtual void generate_ecc_bits(coo_element& element);
-  virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
-                    cg_vector *result);
+  virtual cg_matrix* create_matrix(const uint32_t *columns,
+                                   const uint32_t *rows,
+                                   const double *values,
+                                   int N, int nnz);
+  virtual void destroy_matrix(cg_matrix *mat);
+  virtual bool save_matrix(const cg_matrix *mat, FILE *file);
+  virtual cg_matrix* map_matrix(void *data, int N, int nnz);
+  virtual double checked_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                  cg_vector *result);
+
+  template<bool guarded>
+  double checked_kernel(const cg_matrix *mat, const cg_vector *vec,
+                        cg_vector *result);
 };
@@ -0,0 +1,145 @@
+#ifndef POLICIES_H
+#define POLICIES_H
+
+#include "ecc.h"
+
+#include <string>
+
+// Matrix checking policies for PolicyContext. A policy provides:
+//   name()          - the mode it is registered as
+//   checks          - whether it checks anything
+//   column_mask     - the bits of a column index that hold the index itself
+//   corrects        - whether check() corrects the indices
+//   generate()      - add the check bits to a new element
+//   check()         - check (and correct in place) element i, returning 1
+//                     if it was corrected
+//   check_indices() - check the (corrected) indices of element i, given the
+//                     element before it (when i > 0)
+// The checks record the errors they find in an ErrorLog and carry on, so the
+// kernel must keep whatever they could not correct in range. A policy that
+// checks nothing leaves the indices unguarded, as without checking.
+
+template<ECCMode mode>
+struct ElementECC
+{
+  static const char *name()
+  {
+    switch (mode)
+    {
+      case ECC_NONE: return "none";
+      case ECC_SED:  return "sed";
+      case ECC_SEC7: return "sec7";
+      case ECC_SEC8: return "sec8";
+      default:       return "secded";
+    }
+  }
+
+  static const bool     checks      = mode != ECC_NONE;
+  static const uint32_t column_mask = mode == ECC_NONE ? 0xFFFFFFFF
+                                                       : 0x00FFFFFF;
+  static const bool     corrects    = mode != ECC_NONE && mode != ECC_SED;
+
+  static inline void generate(coo_element& element)
+  {
+    ecc_generate<mode>(element);
+  }
+
+  static inline unsigned check(coo_element& element, uint32_t i,
+                               ErrorLog& log)
+  {
+    return ecc_check<mode>(element, i, log);
+  }
+
+  static inline void check_indices(const coo_element& element,
+                                   const coo_element& prev,
+                                   uint32_t i, uint32_t N, ErrorLog& log)
+  {
+  }
+};
+
+typedef ElementECC<ECC_NONE>   None;
+typedef ElementECC<ECC_SED>    SED;
+typedef ElementECC<ECC_SEC7>   SEC7;
+typedef ElementECC<ECC_SEC8>   SEC8;
+typedef ElementECC<ECC_SECDED> SECDED;
+
+// Check that the indices describe a valid matrix, sorted by row and column
+struct Constraints
+{
+  static const char *name()
+  {
+    return "constraints";
+  }
+
+  static const bool     checks      = true;
+  static const uint32_t column_mask = 0xFFFFFFFF;
+  static const bool     corrects    = false;
+
+  static inline void generate(coo_element& element)
+  {
+  }
+
+  static inline unsigned check(coo_element& element, uint32_t i,
+                               ErrorLog& log)
+  {
+    return 0;
+  }
+
+  static inline void check_indices(const coo_element& element,
+                                   const coo_element& prev,
+                                   uint32_t i, uint32_t N, ErrorLog& log)
+  {
+    // Check index size constraints
+    if (element.row >= N)
+      log.record(ERROR_DETECTED, ERROR_ROW_CONSTRAINT, i);
+    else if (element.col >= N)
+      log.record(ERROR_DETECTED, ERROR_COLUMN_CONSTRAINT, i);
+
+    // Check index order constraints against the previous element, unless
+    // it has already been reported as outside the matrix
+    else if (i > 0 && prev.row < N && prev.col < N)
+    {
+      if (prev.row > element.row)
+        log.record(ERROR_DETECTED, ERROR_ROW_CONSTRAINT, i-1);
+      else if (prev.row == element.row && prev.col >= element.col)
+        log.record(ERROR_DETECTED, ERROR_COLUMN_CONSTRAINT, i-1);
+    }
+  }
+};
+
+// Apply both P and Q, registered as "P+Q"
+template<class P, class Q>
+struct Combined
+{
+  static const char *name()
+  {
+    static const std::string name = std::string(P::name()) + "+" + Q::name();
+    return name.c_str();
+  }
+
+  static const bool     checks      = P::checks || Q::checks;
+  static const uint32_t column_mask = P::column_mask & Q::column_mask;
+  static const bool     corrects    = P::corrects || Q::corrects;
+
+  static inline void generate(coo_element& element)
+  {
+    P::generate(element);
+    Q::generate(element);
+  }
+
+  static inline unsigned check(coo_element& element, uint32_t i,
+                               ErrorLog& log)
+  {
+    return P::check(element, i, log) + Q::check(element, i, log);
+  }
+
+  static inline void check_indices(const coo_element& element,
+                                   const coo_element& prev,
+                                   uint32_t i, uint32_t N, ErrorLog& log)
+  {
+    P::check_indices(element, prev, i, N, log);
+    Q::check_indices(element, prev, i, N, log);
+  }
+};
+
+#endif // POLICIES_H
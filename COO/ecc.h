@@ -2,7 +2,12 @@
 #define ECC_H
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+#include "ErrorLog.h"
 
 // 128-bit matrix element
 // Bits  0 to  31 are the colum index
@@ -15,6 +20,8 @@ struct coo_element
   double value;
 };
 
+enum ECCMode {ECC_NONE, ECC_SED, ECC_SEC7, ECC_SEC8, ECC_SECDED};
+
 #define ECC7_P1_0 0x80AAAD5B
 #define ECC7_P1_1 0x55555556
 #define ECC7_P1_2 0xAAAAAAAB
@@ -111,6 +118,16 @@ static inline uint32_t ecc_compute_overall_parity(coo_element element)
   return __builtin_parity(data[0] ^ data[1] ^ data[2] ^ data[3]);
 }
 
+// Flip a single bit of a matrix element (going through memcpy so that the
+// compiler cannot assume the value field is unchanged)
+static inline void ecc_flip_bit(coo_element *element, uint32_t bit)
+{
+  uint32_t data[sizeof(coo_element)/4];
+  memcpy(data, element, sizeof(data));
+  data[bit/32] ^= 0x1U << (bit % 32);
+  memcpy(element, data, sizeof(data));
+}
+
 // This function will use the error 'syndrome' generated from a 7-bit parity
 // check to determine the index of the bit that has been flipped
 static inline uint32_t ecc_get_flipped_bit_col8(uint32_t syndrome)
@@ -133,6 +150,117 @@ static inline uint32_t ecc_get_flipped_bit_col8(uint32_t syndrome)
   return data_bit;
 }
 
+// Generate the ECC bits of a matrix element for the given mode
+template<ECCMode mode>
+static inline void ecc_generate(coo_element& element)
+{
+  if (mode == ECC_SED)
+  {
+    element.col |= ecc_compute_overall_parity(element) << 31;
+  }
+  else if (mode != ECC_NONE)
+  {
+    element.col |= ecc_compute_col8(element);
+    if (mode != ECC_SEC7)
+      element.col |= ecc_compute_overall_parity(element) << 24;
+  }
+}
+
+// Check (and correct in place) a single matrix element for the given mode,
+// recording what it finds in log. Returns 1 if the element was corrected.
+// An element that cannot be corrected is left as it is, so callers must
+// keep its indices in range.
+template<ECCMode mode>
+static inline unsigned ecc_check(coo_element& element, uint32_t i,
+                                 ErrorLog& log)
+{
+  if (mode == ECC_NONE)
+    return 0;
+
+  uint32_t overall_parity = ecc_compute_overall_parity(element);
+  if (mode == ECC_SED)
+  {
+    if (overall_parity)
+      log.record(ERROR_DETECTED, ERROR_ELEMENT, i);
+    return 0;
+  }
+
+  // SEC8 only needs the syndrome when the overall parity is wrong
+  if (mode == ECC_SEC8 && !overall_parity)
+    return 0;
+
+  uint32_t syndrome = ecc_compute_col8(element);
+  if (mode == ECC_SEC7)
+  {
+    if (syndrome)
+    {
+      // Unflip bit
+      uint32_t bit = ecc_get_flipped_bit_col8(syndrome);
+      ecc_flip_bit(&element, bit);
+
+      log.record(ERROR_CORRECTED, ERROR_ELEMENT, i, bit);
+      return 1;
+    }
+    return 0;
+  }
+
+  if (overall_parity)
+  {
+    if (syndrome)
+    {
+      // Unflip bit
+      uint32_t bit = ecc_get_flipped_bit_col8(syndrome);
+      ecc_flip_bit(&element, bit);
+
+      log.record(ERROR_CORRECTED, ERROR_ELEMENT, i, bit);
+    }
+    else
+    {
+      // Correct overall parity bit
+      element.col ^= 0x1U << 24;
+
+      log.record(ERROR_CORRECTED, ERROR_ELEMENT, i,
+                 8*offsetof(coo_element, col) + 24);
+    }
+    return 1;
+  }
+  else if (mode == ECC_SECDED && syndrome)
+  {
+    // Overall parity fine but error in syndrome
+    // Must be double-bit error - cannot correct this
+    log.record(ERROR_UNCORRECTABLE, ERROR_ELEMENT, i);
+  }
+  return 0;
+}
+
+// Lookup tables for the table-driven backend (see TableContext.cpp).
+// ECC_SYNDROME_TABLE[b][v] is the contribution of byte b of an element when it
+// holds the value v, with the 7 Hamming bits in bits 6-0 (P1 in bit 6) and the
+// overall parity in bit 7. ECC_DECODE_TABLE maps a 7-bit Hamming syndrome
+// directly to the index of the flipped bit.
+extern uint8_t ECC_SYNDROME_TABLE[sizeof(coo_element)][256];
+extern uint8_t ECC_DECODE_TABLE[128];
+
+// Table-driven version of ecc_compute_col8 and ecc_compute_overall_parity in
+// a single pass, returning the overall parity in bit 7 and the Hamming
+// syndrome in bits 6-0
+static inline uint32_t ecc_compute_table(coo_element element)
+{
+  uint8_t bytes[sizeof(coo_element)];
+  memcpy(bytes, &element, sizeof(bytes));
+
+  uint32_t result = 0;
+  for (unsigned b = 0; b < sizeof(coo_element); b++)
+    result ^= ECC_SYNDROME_TABLE[b][bytes[b]];
+  return result;
+}
+
+// Table-driven version of ecc_get_flipped_bit_col8
+static inline uint32_t ecc_get_flipped_bit_table(uint32_t syndrome)
+{
+  return ECC_DECODE_TABLE[syndrome >> 25];
+}
+
 /*
 void gen_ecc7_masks()
 {
@@ -43,23 +43,28 @@ static uint8_t PARITY_TABLE[256] =
 
 class ARM32Context_SED : public CPUContext_SED
 {
-  virtual void spmv(const cg_matrix *mat, const cg_vector *vec, cg_vector *result)
+  virtual double checked_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                  cg_vector *result)
   {
-#pragma omp parallel for
+    double ret = 0.0;
+    unsigned corrected = 0;
+#pragma omp parallel for reduction(+:ret,corrected)
     for (unsigned row = 0; row < mat->N; row++)
     {
       double tmp = 0.0;
 
+      uint32_t start = load_row_pointer(mat, row, true, corrected);
+      uint32_t end   = load_row_pointer(mat, row+1, row+1 == mat->N,
+                                        corrected);
+
       int32_t err_index = -1;
       asm (
         // Compute pointers to start of column/value data for this row
-        "ldr     r4, [%[rowptr]]\n\t"
-        "add     r1, %[cols], r4, lsl #2\n\t"
-        "add     r4, %[values], r4, lsl #3\n\t"
+        "add     r1, %[cols], %[start], lsl #2\n\t"
+        "add     r4, %[values], %[start], lsl #3\n\t"
 
         // Compute pointer to end of column data for this row
-        "ldr     r5, [%[rowptr], #4]\n\t"
-        "add     r5, %[cols], r5, lsl #2\n\t"
+        "add     r5, %[cols], %[end], lsl #2\n\t"
 
         ".LOOP_BODY:\n\t"
         // Check if we've reached the end of this row
@@ -106,7 +111,8 @@ class ARM32Context_SED : public CPUContext_SED
         "b       .LOOP_BODY\n"
         ".LOOP_END:\n"
         : [tmp] "+w" (tmp), [err_index] "+r" (err_index)
-        : [rowptr] "r" (mat->rows+row),
+        : [start] "r" (start),
+          [end] "r" (end),
           [cols] "r" (mat->cols),
           [values] "r" (mat->values),
           [vector] "r" (vec->data),
@@ -115,13 +121,14 @@ class ARM32Context_SED : public CPUContext_SED
         );
 
       result->data[row] = tmp;
+      ret += tmp * vec->data[row];
 
+      // (the loop stops at the error, leaving the rest of the row out)
       if (err_index >= 0)
-      {
-        printf("[ECC] error detected at index %d\n", err_index/4);
-        exit(1);
-      }
+        error_log.record(ERROR_DETECTED, ERROR_ELEMENT, err_index/4);
     }
+    num_corrected += corrected;
+    return ret;
   }
 };
 
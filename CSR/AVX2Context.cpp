@@ -0,0 +1,75 @@
+#include "SIMDContext.h"
+
+#include <immintrin.h>
+
+// Fold each 64-bit lane down to 8 bits with the same parity
+static inline __m256i fold_to_byte(__m256i x)
+{
+  x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 32));
+  x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 16));
+  x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 8));
+  return _mm256_and_si256(x, _mm256_set1_epi64x(0xFF));
+}
+
+// Checks four consecutive elements, one per 64-bit lane
+template<ECCMode ecc_mode>
+struct AVX2Checker
+{
+  static const ECCMode mode = ecc_mode;
+  static const int width = 4;
+
+  static bool supported()
+  {
+    return __builtin_cpu_supports("avx2");
+  }
+
+  static inline uint32_t check(const double *values, const uint32_t *cols)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i*)values);
+    __m256i c = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)cols));
+
+    // Gather one byte per parity bit into each lane, Hamming bits in bytes
+    // 0-6 and the overall parity in byte 7
+    __m256i parity = _mm256_setzero_si256();
+    if (mode == ECC_SEC7 || mode == ECC_SECDED)
+    {
+      for (int p = 0; p < 7; p++)
+      {
+        __m256i x = _mm256_xor_si256(
+          _mm256_and_si256(v, _mm256_set1_epi64x(ECC7_VALUE_MASKS[p])),
+          _mm256_and_si256(c, _mm256_set1_epi64x(ECC7_COLUMN_MASKS[p])));
+        parity = _mm256_or_si256(parity, _mm256_slli_epi64(fold_to_byte(x), 8*p));
+      }
+    }
+    if (mode != ECC_SEC7)
+    {
+      __m256i x = fold_to_byte(_mm256_xor_si256(v, c));
+      parity = _mm256_or_si256(parity, _mm256_slli_epi64(x, 56));
+    }
+
+    // Reduce every byte to its parity bit
+    parity = _mm256_xor_si256(parity, _mm256_srli_epi64(parity, 4));
+    parity = _mm256_xor_si256(parity, _mm256_srli_epi64(parity, 2));
+    parity = _mm256_xor_si256(parity, _mm256_srli_epi64(parity, 1));
+    parity = _mm256_and_si256(parity, _mm256_set1_epi64x(0x0101010101010101));
+
+    // Fast path: all four elements are clean
+    if (_mm256_testz_si256(parity, parity))
+      return 0;
+
+    __m256i clean = _mm256_cmpeq_epi64(parity, _mm256_setzero_si256());
+    return ~_mm256_movemask_pd(_mm256_castsi256_pd(clean)) & 0xF;
+  }
+};
+
+namespace
+{
+  static CGContext::Register< SIMDContext<CPUContext_SED, AVX2Checker<ECC_SED> > >
+    A("avx2", "sed");
+  static CGContext::Register< SIMDContext<CPUContext_SEC7, AVX2Checker<ECC_SEC7> > >
+    B("avx2", "sec7");
+  static CGContext::Register< SIMDContext<CPUContext_SEC8, AVX2Checker<ECC_SEC8> > >
+    C("avx2", "sec8");
+  static CGContext::Register< SIMDContext<CPUContext_SECDED, AVX2Checker<ECC_SECDED> > >
+    D("avx2", "secded");
+}
@@ -0,0 +1,76 @@
+#include "SIMDContext.h"
+
+// GCC warns about the deliberately undefined source operands in its own
+// AVX-512 intrinsics
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+
+// Fold each 64-bit lane down to 8 bits with the same parity
+static inline __m512i fold_to_byte(__m512i x)
+{
+  x = _mm512_xor_si512(x, _mm512_srli_epi64(x, 32));
+  x = _mm512_xor_si512(x, _mm512_srli_epi64(x, 16));
+  x = _mm512_xor_si512(x, _mm512_srli_epi64(x, 8));
+  return _mm512_and_si512(x, _mm512_set1_epi64(0xFF));
+}
+
+// Checks eight consecutive elements, one per 64-bit lane
+template<ECCMode ecc_mode>
+struct AVX512Checker
+{
+  static const ECCMode mode = ecc_mode;
+  static const int width = 8;
+
+  static bool supported()
+  {
+    return __builtin_cpu_supports("avx512f");
+  }
+
+  static inline uint32_t check(const double *values, const uint32_t *cols)
+  {
+    __m512i v = _mm512_loadu_si512((const void*)values);
+    __m512i c = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i*)cols));
+
+    // Gather one byte per parity bit into each lane, Hamming bits in bytes
+    // 0-6 and the overall parity in byte 7
+    __m512i parity = _mm512_setzero_si512();
+    if (mode == ECC_SEC7 || mode == ECC_SECDED)
+    {
+      for (int p = 0; p < 7; p++)
+      {
+        // (v & value_mask) ^ (c & column_mask)
+        __m512i x = _mm512_ternarylogic_epi64(
+          v, _mm512_set1_epi64(ECC7_VALUE_MASKS[p]),
+          _mm512_and_si512(c, _mm512_set1_epi64(ECC7_COLUMN_MASKS[p])), 0x6A);
+        parity = _mm512_or_si512(parity, _mm512_slli_epi64(fold_to_byte(x), 8*p));
+      }
+    }
+    if (mode != ECC_SEC7)
+    {
+      __m512i x = fold_to_byte(_mm512_xor_si512(v, c));
+      parity = _mm512_or_si512(parity, _mm512_slli_epi64(x, 56));
+    }
+
+    // Reduce every byte to its parity bit
+    parity = _mm512_xor_si512(parity, _mm512_srli_epi64(parity, 4));
+    parity = _mm512_xor_si512(parity, _mm512_srli_epi64(parity, 2));
+    parity = _mm512_xor_si512(parity, _mm512_srli_epi64(parity, 1));
+
+    // Lanes with any parity bit set need a closer look
+    return _mm512_test_epi64_mask(parity, _mm512_set1_epi64(0x0101010101010101));
+  }
+};
+
+namespace
+{
+  static CGContext::Register< SIMDContext<CPUContext_SED, AVX512Checker<ECC_SED> > >
+    A("avx512", "sed");
+  static CGContext::Register< SIMDContext<CPUContext_SEC7, AVX512Checker<ECC_SEC7> > >
+    B("avx512", "sec7");
+  static CGContext::Register< SIMDContext<CPUContext_SEC8, AVX512Checker<ECC_SEC8> > >
+    C("avx512", "sec8");
+  static CGContext::Register< SIMDContext<CPUContext_SECDED, AVX512Checker<ECC_SECDED> > >
+    D("avx512", "secded");
+}
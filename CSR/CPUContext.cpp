@@ -1,87 +1,329 @@
 #include "CPUContext.h"
+#include "Numa.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
 
-void CPUContext::generate_ecc_bits(csr_element& element)
+#ifdef _OPENMP
+  #include <omp.h>
+#else
+  static inline int omp_get_thread_num() { return 0; }
+  static inline int omp_get_num_threads() { return 1; }
+  static inline int omp_get_max_threads() { return 1; }
+#endif
+
+uint8_t ECC_ROW_TABLE[4][256];
+
+static void init_row_table()
 {
+  for (uint32_t b = 0; b < 4; b++)
+  {
+    for (uint32_t v = 0; v < 256; v++)
+    {
+      uint32_t ptr = v << (8*b);
+      ECC_ROW_TABLE[b][v] = ecc_compute_row_syndrome(ptr) |
+                            __builtin_parity(ptr) << 5;
+    }
+  }
 }
 
-cg_matrix* CPUContext::create_matrix(const uint32_t *columns,
-                                     const uint32_t *rows,
-                                     const double *values,
-                                     int N, int nnz)
+CPUContext::CPUContext()
 {
-  cg_matrix *M = new cg_matrix;
+  static bool row_table_initialized = false;
+  if (!row_table_initialized)
+  {
+    init_row_table();
+    row_table_initialized = true;
+  }
+
+  num_corrected    = 0;
+  scrub_interval   = -1;
+  vector_checksums = false;
+  check_interval   = 1;
+  spmv_count       = 0;
+  check_result     = NOT_CHECKED;
+  numa_replication = false;
+  replica_N        = 0;
+  gather_offset    = 0;
+  spmv_vec         = NULL;
+  spmv_result      = NULL;
+  spmv_time        = 0.0;
+}
+
+CPUContext::~CPUContext()
+{
+  for (unsigned n = 0; n < replicas.size(); n++)
+    arena.release(replicas[n]);
+}
+
+// Rows [begin, end) of thread t of nthreads under the static schedule of an
+// omp for loop over N rows, as libgomp divides them
+static void static_range(unsigned N, int t, int nthreads,
+                         unsigned *begin, unsigned *end)
+{
+  unsigned chunk = N / nthreads;
+  unsigned extra = N % nthreads;
+  if ((unsigned)t < extra)
+  {
+    chunk++;
+    extra = 0;
+  }
+  *begin = chunk*t + extra;
+  *end   = *begin + chunk;
+}
+
+// Find the NUMA node of each OpenMP thread, which stays valid as long as
+// the threads are bound to their CPUs
+void CPUContext::map_threads()
+{
+  if (!thread_nodes.empty())
+    return;
+
+  std::vector<int> nodes(omp_get_max_threads(), 0);
+#pragma omp parallel
+  nodes[omp_get_thread_num()] = numa_current_node();
+
+  thread_nodes.resize(nodes.size());
+  for (unsigned t = 0; t < nodes.size(); t++)
+  {
+    unsigned n = std::find(node_ids.begin(), node_ids.end(), nodes[t]) -
+                 node_ids.begin();
+    if (n == node_ids.size())
+      node_ids.push_back(nodes[t]);
+    thread_nodes[t] = n;
+  }
+  node_bytes.assign(node_ids.size(), 0.0);
+  node_traffic.assign(node_ids.size(), 0.0);
+}
+
+void CPUContext::model_traffic(const cg_matrix *mat, uint32_t row_mask)
+{
+  map_threads();
+
+  size_t element_size = mat->elements ? sizeof(csr_element)
+                                      : sizeof(uint32_t) + sizeof(double);
+
+  // Each thread streams the row pointers, elements, and result and vector
+  // elements of its rows. Its gathers from the vector mostly hit in cache,
+  // so they are left out.
+  std::fill(node_bytes.begin(), node_bytes.end(), 0.0);
+  for (unsigned t = 0; t < thread_nodes.size(); t++)
+  {
+    unsigned first, last;
+    static_range(mat->N, t, thread_nodes.size(), &first, &last);
+    uint32_t start = mat->rows[first] & row_mask;
+    uint32_t end   = mat->rows[last] & row_mask;
+    node_bytes[thread_nodes[t]] +=
+      (last-first)*(sizeof(uint32_t) + 2*sizeof(double)) +
+      (end-start)*element_size;
+  }
+}
+
+const double* CPUContext::gather_vector(const cg_vector *vec) const
+{
+  if (!numa_replication)
+    return vec->data;
+  return replicas[thread_nodes[omp_get_thread_num()]] + gather_offset;
+}
+
+checksum_gather CPUContext::gather_checksums()
+{
+  // A replicated vector was verified as it was copied
+  const vector_checksum *checksums = numa_replication ? NULL
+                                                      : spmv_vec->checksums;
+  return begin_gather(spmv_vec->data, spmv_vec->N, checksums,
+                      gather_states.data(), error_log, gather_offset);
+}
+
+checksum_rows CPUContext::result_checksums()
+{
+  return begin_rows(spmv_result->data, spmv_result->N,
+                    spmv_result->checksums, row_done.data(), gather_offset);
+}
+
+void CPUContext::rewrote_rows(unsigned first, unsigned last)
+{
+  if (spmv_result->checksums == NULL || first >= last)
+    return;
+  for (size_t b = (gather_offset + first) / CHECKSUM_BLOCK;
+       b <= (gather_offset + last - 1) / CHECKSUM_BLOCK; b++)
+  {
+    row_done[b] = 0;
+  }
+}
+
+bool CPUContext::spmv_guarded() const
+{
+  return spmv_vec->checksums || spmv_result->checksums;
+}
+
+unsigned CPUContext::num_chunks(unsigned N) const
+{
+  unsigned skew = gather_offset % CHECKSUM_CHUNK;
+  return (skew + N + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK;
+}
 
-  M->N      = N;
-  M->nnz    = nnz;
-  M->cols   = new uint32_t[nnz];
-  M->rows   = new uint32_t[N+1];
-  M->values = new double[nnz];
+void CPUContext::chunk_rows(unsigned c, unsigned N,
+                            unsigned *first, unsigned *last) const
+{
+  unsigned skew = gather_offset % CHECKSUM_CHUNK;
+  *first = c == 0 ? 0 : c*CHECKSUM_CHUNK - skew;
+  *last  = std::min((c+1)*CHECKSUM_CHUNK - skew, N);
+}
 
-  uint32_t next_row = 0;
-  for (int i = 0; i < nnz; i++)
+// Copy vec to the replica on every node, with the threads of each node
+// sharing its copy, so that each replica's pages are placed on its node
+void CPUContext::replicate_vector(const cg_vector *vec)
+{
+  if (replica_N < vec->N)
   {
-    csr_element element;
-    element.column = columns[i];
-    element.value  = values[i];
+    for (unsigned n = 0; n < replicas.size(); n++)
+      arena.release(replicas[n]);
+    replicas.assign(node_ids.size(), NULL);
+    for (unsigned n = 0; n < replicas.size(); n++)
+      replicas[n] = arena.allocate<double>(vec->N);
+    replica_N = vec->N;
+  }
 
-    generate_ecc_bits(element);
+#pragma omp parallel
+  {
+    int tid  = omp_get_thread_num();
+    int node = thread_nodes[tid];
 
-    M->cols[i]   = element.column;
-    M->values[i] = element.value;
+    int rank = 0, count = 0;
+    for (int t = 0; t < omp_get_num_threads(); t++)
+    {
+      if (thread_nodes[t] == node)
+      {
+        rank += t < tid;
+        count++;
+      }
+    }
+
+    unsigned begin, end;
+    static_range(vec->N, rank, count, &begin, &end);
 
-    while (next_row <= rows[i])
+    // Verify the blocks of a protected vector before copying them (with
+    // the threads of every node sharing the verification)
+    if (begin < end)
     {
-      M->rows[next_row++] = i;
+      checksum_gather gather = begin_gather(vec->data, vec->N,
+                                            vec->checksums,
+                                            gather_states.data(),
+                                            error_log, 0);
+      gather.check(begin);
+      gather.check(end - 1);
     }
+    std::copy(vec->data+begin, vec->data+end, replicas[node]+begin);
   }
-  M->rows[N] = nnz;
-
-  return M;
 }
 
-void CPUContext::destroy_matrix(cg_matrix *mat)
+cg_matrix* CPUContext::create_block_matrix(const uint32_t *columns,
+                                           const uint32_t *rows,
+                                           const double *values,
+                                           int N, int nnz, int num_blocks)
 {
-  delete[] mat->cols;
-  delete[] mat->rows;
-  delete[] mat->values;
-  delete mat;
+  cg_matrix *M = create_matrix(columns, rows, values, N, nnz);
+  M->num_blocks = num_blocks;
+
+  // Every block streams the rows again, though from cache if they fit
+  for (unsigned n = 0; n < node_bytes.size(); n++)
+    node_bytes[n] *= num_blocks;
+  return M;
 }
 
 cg_vector* CPUContext::create_vector(int N)
 {
   cg_vector *result = new cg_vector;
-  result->N    = N;
-  result->data = new double[N];
+  result->N         = N;
+  result->data      = arena.allocate<double>(N);
+  result->checksums = NULL;
+
+  // Zero the vector (to match the zeroed checksums, if any) with the same
+  // static partition as the vector kernels, which places each page on the
+  // node of the thread that uses it
+#pragma omp parallel for simd
+  for (int i = 0; i < N; i++)
+  {
+    result->data[i] = 0.0;
+  }
+
+  if (vector_checksums)
+    result->checksums = new vector_checksum[checksum_blocks(N)]();
   return result;
 }
 
 void CPUContext::destroy_vector(cg_vector *vec)
 {
-  delete[] vec->data;
+  arena.release(vec->data);
+  delete[] vec->checksums;
   delete vec;
 }
 
 double* CPUContext::map_vector(cg_vector *v)
 {
+  if (v->checksums)
+    verify_vector(v->data, v->N, v->checksums, error_log);
   return v->data;
 }
 
 void CPUContext::unmap_vector(cg_vector *v, double *h)
 {
+  // The host may have written to the vector
+  if (v->checksums)
+    checksum_vector(v->data, v->N, v->checksums);
+}
+
+void CPUContext::inject_vector_bitflip(cg_vector *vec, int num_flips)
+{
+  int index = rand() % vec->N;
+
+  // Only the sign, exponent and high mantissa bits, as a flip of a lower bit
+  // may be within the rounding that the checksums tolerate
+  for (int i = 0; i < num_flips; i++)
+  {
+    int bit = 32 + rand() % 32;
+    printf("*** flipping bit %d of vector element %d ***\n", bit, index);
+    ((uint32_t*)(vec->data+index))[bit/32] ^= 0x1U << (bit % 32);
+  }
 }
 
 void CPUContext::copy_vector(cg_vector *dst, const cg_vector *src)
 {
-  memcpy(dst->data, src->data, dst->N*sizeof(double));
+  if (src->checksums)
+  {
+#pragma omp parallel for
+    for (int b = 0; b < checksum_blocks(src->N); b++)
+    {
+      verify_block(src->data, src->N, src->checksums, b, error_log);
+
+      int end = (b+1)*CHECKSUM_BLOCK < dst->N ? (b+1)*CHECKSUM_BLOCK : dst->N;
+      for (int i = b*CHECKSUM_BLOCK; i < end; i++)
+      {
+        dst->data[i] = src->data[i];
+      }
+      dst->checksums[b] = src->checksums[b];
+    }
+    return;
+  }
+
+#pragma omp parallel for simd
+  for (int i = 0; i < dst->N; i++)
+  {
+    dst->data[i] = src->data[i];
+  }
 }
 
 double CPUContext::dot(const cg_vector *a, const cg_vector *b)
 {
   double ret = 0.0;
+#pragma omp parallel for simd reduction(+:ret)
   for (int i = 0; i < a->N; i++)
   {
     ret += a->data[i] * b->data[i];
@@ -93,19 +335,81 @@ double CPUContext::calc_xr(cg_vector *x, cg_vector *r,
                            const cg_vector *p, const cg_vector *w,
                            double alpha)
 {
-  double ret = 0.0;
+  double wr;
+  return calc_xr_wr(x, r, p, w, alpha, &wr);
+}
+
+double CPUContext::calc_xr_wr(cg_vector *x, cg_vector *r,
+                              const cg_vector *p, const cg_vector *w,
+                              double alpha, double *wr)
+{
+  double ret = 0.0, ret_wr = 0.0;
+  if (x->checksums)
+  {
+    // Check the inputs and checksum the outputs one block at a time, while
+    // the block is still in cache
+#pragma omp parallel for reduction(+:ret,ret_wr)
+    for (int b = 0; b < checksum_blocks(x->N); b++)
+    {
+      verify_block(x->data, x->N, x->checksums, b, error_log);
+      verify_block(r->data, r->N, r->checksums, b, error_log);
+      verify_block(p->data, p->N, p->checksums, b, error_log);
+      verify_block(w->data, w->N, w->checksums, b, error_log);
+
+      int end = (b+1)*CHECKSUM_BLOCK < x->N ? (b+1)*CHECKSUM_BLOCK : x->N;
+#pragma omp simd reduction(+:ret,ret_wr)
+      for (int i = b*CHECKSUM_BLOCK; i < end; i++)
+      {
+        ret_wr += w->data[i] * r->data[i];
+        x->data[i] += alpha * p->data[i];
+        r->data[i] -= alpha * w->data[i];
+
+        ret += r->data[i] * r->data[i];
+      }
+
+      checksum_block(x->data, x->N, x->checksums, b);
+      checksum_block(r->data, r->N, r->checksums, b);
+    }
+    *wr = ret_wr;
+    return ret;
+  }
+
+#pragma omp parallel for simd reduction(+:ret,ret_wr)
   for (int i = 0; i < x->N; i++)
   {
+    ret_wr += w->data[i] * r->data[i];
     x->data[i] += alpha * p->data[i];
     r->data[i] -= alpha * w->data[i];
 
     ret += r->data[i] * r->data[i];
   }
+  *wr = ret_wr;
   return ret;
 }
 
 void CPUContext::calc_p(cg_vector *p, const cg_vector *r, double beta)
 {
+  if (p->checksums)
+  {
+#pragma omp parallel for
+    for (int b = 0; b < checksum_blocks(p->N); b++)
+    {
+      verify_block(r->data, r->N, r->checksums, b, error_log);
+      verify_block(p->data, p->N, p->checksums, b, error_log);
+
+      int end = (b+1)*CHECKSUM_BLOCK < p->N ? (b+1)*CHECKSUM_BLOCK : p->N;
+#pragma omp simd
+      for (int i = b*CHECKSUM_BLOCK; i < end; i++)
+      {
+        p->data[i] = r->data[i] + beta*p->data[i];
+      }
+
+      checksum_block(p->data, p->N, p->checksums, b);
+    }
+    return;
+  }
+
+#pragma omp parallel for simd
   for (int i = 0; i < p->N; i++)
   {
     p->data[i] = r->data[i] + beta*p->data[i];
@@ -115,307 +419,802 @@ void CPUContext::calc_p(cg_vector *p, const cg_vector *r, double beta)
 void CPUContext::spmv(const cg_matrix *mat, const cg_vector *vec,
                       cg_vector *result)
 {
-#pragma omp parallel for
-  for (unsigned row = 0; row < mat->N; row++)
+  spmv_dot(mat, vec, result);
+}
+
+double CPUContext::spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                            cg_vector *result)
+{
+  // The kernels verify the blocks of a protected vector as they first
+  // gather from them, and checksum the blocks of the result as they write
+  // them
+  spmv_vec    = vec;
+  spmv_result = result;
+  if (vec->checksums &&
+      gather_states.size() < (size_t)checksum_blocks(vec->N))
+  {
+    std::vector< std::atomic<unsigned char> >(checksum_blocks(vec->N))
+      .swap(gather_states);
+  }
+  if (result->checksums &&
+      row_done.size() < (size_t)checksum_blocks(result->N))
   {
-    double tmp = 0.0;
+    row_done.resize(checksum_blocks(result->N), 0);
+  }
 
-    uint32_t start = mat->rows[row];
-    uint32_t end   = mat->rows[row+1];
-    for (uint32_t i = start; i < end; i++)
-    {
-      uint32_t col = mat->cols[i];
-      tmp += mat->values[i] * vec->data[col];
-    }
+  auto start = std::chrono::steady_clock::now();
 
-    result->data[row] = tmp;
+  if (numa_replication)
+  {
+    replicate_vector(vec);
+    for (unsigned n = 0; n < node_traffic.size(); n++)
+      node_traffic[n] += 2*sizeof(double)*vec->N;
   }
+
+  // Skip the checks on all but every check_interval'th call
+  bool checked = ++spmv_count >= check_interval;
+  if (checked)
+    spmv_count = 0;
+  unsigned corrected = num_corrected;
+
+  // Multiply each block by its slice of vec, into its slice of result (the
+  // whole of each, unless the blocks are implicit)
+  double ret = 0.0;
+  for (unsigned b = 0; b < mat->num_blocks; b++)
+  {
+    gather_offset = (size_t)b*mat->N;
+    cg_vector x = {(int)mat->N, vec->data + gather_offset, NULL};
+    cg_vector y = {(int)mat->N, result->data + gather_offset, NULL};
+    ret += checked ? checked_spmv_dot(mat, &x, &y)
+                   : unchecked_spmv_dot(mat, &x, &y);
+  }
+  gather_offset = 0;
+
+  if (!checked)
+    check_result = NOT_CHECKED;
+  else
+    check_result = num_corrected > corrected ? CHECK_CORRECTED : CHECK_PASSED;
+
+  spmv_time += std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  for (unsigned n = 0; n < node_traffic.size(); n++)
+    node_traffic[n] += node_bytes[n];
+
+  // The scrubber may have corrected an element after an spmv used it
+  if (mat->scrubber && mat->scrubber->take_corrections())
+    check_result = CHECK_CORRECTED;
+
+  // Finish the blocks that the threads shared
+  if (vec->checksums)
+    finish_gather(gather_states.data(), vec->N);
+  if (result->checksums)
+    finish_rows(result->data, result->N, result->checksums, row_done.data());
+
+  return ret;
 }
 
-void CPUContext::inject_bitflip(cg_matrix *mat, BitFlipKind kind, int num_flips)
+void CPUContext::set_check_interval(int k)
 {
-  int index = rand() % mat->nnz;
+  check_interval = k;
+}
 
-  int start = 0;
-  int end   = 96;
-  if (kind == VALUE)
-    end = 64;
-  else if (kind == INDEX)
-    start = 64;
+CGContext::CheckResult CPUContext::last_check()
+{
+  return check_result;
+}
 
-  for (int i = 0; i < num_flips; i++)
-  {
-    int bit = (rand() % (end-start)) + start;
-    printf("*** flipping bit %d at index %d ***\n", bit, index);
-    if (bit < 64)
-    {
-      ((uint32_t*)(mat->values+index))[bit/32] ^= 0x1U << (bit % 32);
-    }
-    else
-    {
-      mat->cols[index] ^= 0x1U << (bit % 32);
-    }
-  }
+void CPUContext::set_vector_checksums(bool enable)
+{
+  vector_checksums = enable;
 }
 
+void CPUContext::set_huge_pages(HugePages kind)
+{
+  arena.set_huge_pages(kind);
+}
 
-void CPUContext_Constraints::spmv(const cg_matrix *mat, const cg_vector *vec,
-                                  cg_vector *result)
+void CPUContext::huge_page_usage(size_t *mapped, size_t *huge)
 {
-#pragma omp parallel for
-  for (unsigned row = 0; row < mat->N; row++)
-  {
-    double tmp = 0.0;
+  arena.usage(mapped, huge);
+}
 
-    uint32_t start = mat->rows[row];
-    uint32_t end   = mat->rows[row+1];
+void CPUContext::set_numa_replication(bool enable)
+{
+  map_threads();
+  numa_replication = enable;
+}
+
+void CPUContext::spmv_bandwidth(std::vector<int>& nodes,
+                                std::vector<double>& bandwidth)
+{
+  nodes = node_ids;
+  bandwidth.clear();
+  for (unsigned n = 0; n < node_traffic.size(); n++)
+    bandwidth.push_back(spmv_time > 0 ? node_traffic[n]/spmv_time*1e-9 : 0);
+}
 
+template<class Layout, class Policy>
+void PolicyContext<Layout,Policy>::generate_ecc_bits(csr_element& element)
+{
+  Policy::generate(element);
+}
+
+// Check and correct the row pointers and elements of rows [first, last)
+template<class Layout, class Policy>
+static unsigned scrub_rows(const cg_matrix *mat, unsigned first,
+                           unsigned last, ErrorLog& log)
+{
+  unsigned corrected = 0;
+  for (unsigned row = first; row < last; row++)
+  {
+    uint32_t start = load_row_pointer(mat, row, true, corrected, log);
+    uint32_t end   = load_row_pointer(mat, row+1, row+1 == mat->N, corrected,
+                                      log);
     if (end > mat->nnz)
-    {
-      printf("row size constraint violated for row %d\n", row);
-      exit(1);
-    }
-    if (end < start)
-    {
-      printf("row order constraint violated for row%d\n", row);
-      exit(1);
-    }
+      end = mat->nnz;
 
     for (uint32_t i = start; i < end; i++)
     {
-      uint32_t col = mat->cols[i];
-
-      if (col >= mat->N)
+      csr_element element = Layout::load(mat, i);
+      if (Policy::check(element, i, log))
       {
-        printf("column size constraint violated at index %d\n", i);
-        exit(1);
+        Layout::store(mat, i, element);
+        corrected++;
       }
-      if (i < end-1)
-      {
-        if (mat->cols[i+1] <= col)
-        {
-          printf("column order constraint violated at index %d\n", i);
-          exit(1);
-        }
-      }
-
-      tmp += mat->values[i] * vec->data[col];
     }
-
-    result->data[row] = tmp;
   }
+  return corrected;
 }
 
-void CPUContext_SED::generate_ecc_bits(csr_element& element)
+template<class Layout, class Policy>
+cg_matrix* PolicyContext<Layout,Policy>::create_matrix(const uint32_t *columns,
+                                                       const uint32_t *rows,
+                                                       const double *values,
+                                                       int N, int nnz)
 {
-  element.column |= ecc_compute_overall_parity(element) << 31L;
-}
+  if (Policy::row_ecc && (uint32_t)nnz > ECC_ROW_MASK)
+  {
+    printf("Too many non-zeros to protect the row pointers\n");
+    exit(1);
+  }
 
-void CPUContext_SED::spmv(const cg_matrix *mat, const cg_vector *vec,
-                          cg_vector *result)
-{
+  cg_matrix *M = new cg_matrix;
+
+  M->N         = N;
+  M->nnz       = nnz;
+  M->rows      = arena.allocate<uint32_t>(N+1);
+  M->checksums = NULL;
+  Layout::allocate(M, arena);
+
+  // Encode each row on the thread that the spmv kernels give it to, so that
+  // its pages are placed on the node of that thread
 #pragma omp parallel for
-  for (unsigned row = 0; row < mat->N; row++)
+  for (int row = 0; row < N; row++)
   {
-    double tmp = 0.0;
+    uint32_t start = std::lower_bound(rows, rows+nnz, (uint32_t)row) - rows;
+    uint32_t end   = std::lower_bound(rows+start, rows+nnz,
+                                      (uint32_t)row+1) - rows;
 
-    uint32_t start = mat->rows[row];
-    uint32_t end   = mat->rows[row+1];
+    M->rows[row] = Policy::row_ecc ? ecc_encode_row(start) : start;
     for (uint32_t i = start; i < end; i++)
     {
       csr_element element;
-      element.value  = mat->values[i];
-      element.column = mat->cols[i];
-
-      // Check overall parity bit
-      if (ecc_compute_overall_parity(element))
-      {
-        printf("[ECC] error detected at index %d\n", i);
-        exit(1);
-      }
+      element.column = columns[i];
+      element.value  = values[i];
 
-      // Mask out ECC from high order column bits
-      element.column &= 0x00FFFFFF;
+      generate_ecc_bits(element);
 
-      tmp += mat->values[i] * vec->data[element.column];
+      Layout::store(M, i, element);
     }
-
-    result->data[row] = tmp;
   }
+  M->rows[N] = Policy::row_ecc ? ecc_encode_row(nnz) : nnz;
+
+  M->golden     = NULL;
+  M->mapped     = false;
+  M->num_blocks = 1;
+  model_traffic(M, Policy::row_ecc ? ECC_ROW_MASK : 0xFFFFFFFF);
+  M->gather_bounds = arena.allocate<uint32_t>(2*checksum_blocks(N));
+  bound_gathers<Layout>(M, Policy::row_ecc ? ECC_ROW_MASK : 0xFFFFFFFF,
+                        Policy::column_mask);
+  start_scrubber(M);
+
+  return M;
 }
 
-void CPUContext_SEC7::generate_ecc_bits(csr_element& element)
+template<class Layout, class Policy>
+void PolicyContext<Layout,Policy>::start_scrubber(cg_matrix *M)
 {
-  element.column |= ecc_compute_col8(element);
+  M->scrubber = NULL;
+  if (scrub_interval >= 0)
+  {
+    M->scrubber = new Scrubber(M->N, scrub_interval,
+                               [M](unsigned first, unsigned last,
+                                   ErrorLog& log)
+                               {
+                                 return scrub_rows<Layout,Policy>(M, first,
+                                                                  last, log);
+                               },
+                               error_log);
+  }
 }
 
-void CPUContext_SEC7::spmv(const cg_matrix *mat, const cg_vector *vec,
-                           cg_vector *result)
+template<class Layout, class Policy>
+void PolicyContext<Layout,Policy>::destroy_matrix(cg_matrix *mat)
 {
-#pragma omp parallel for
-  for (unsigned row = 0; row < mat->N; row++)
+  // Stop the scrubber before freeing what it sweeps
+  delete mat->scrubber;
+
+  if (!mat->mapped)
   {
-    double tmp = 0.0;
+    Layout::release(mat, arena);
+    arena.release(mat->rows);
+  }
+  arena.release(mat->gather_bounds);
+  delete mat;
+}
 
-    uint32_t start = mat->rows[row];
-    uint32_t end   = mat->rows[row+1];
-    for (uint32_t i = start; i < end; i++)
+template<class Layout, class Policy>
+bool PolicyContext<Layout,Policy>::save_matrix(const cg_matrix *mat,
+                                               FILE *file)
+{
+  write_cache_array(file, mat->rows, (mat->N+1)*sizeof(uint32_t));
+  Layout::save(mat, file);
+  return true;
+}
+
+template<class Layout, class Policy>
+cg_matrix* PolicyContext<Layout,Policy>::map_matrix(void *data, int N,
+                                                    int nnz)
+{
+  cg_matrix *M = new cg_matrix;
+
+  M->N          = N;
+  M->nnz        = nnz;
+  M->checksums  = NULL;
+  M->golden     = NULL;
+  M->mapped     = true;
+  M->num_blocks = 1;
+
+  char *cursor = (char*)data;
+  M->rows = (uint32_t*)map_cache_array(&cursor, (N+1)*sizeof(uint32_t));
+  Layout::map(M, &cursor);
+
+  model_traffic(M, Policy::row_ecc ? ECC_ROW_MASK : 0xFFFFFFFF);
+  M->gather_bounds = arena.allocate<uint32_t>(2*checksum_blocks(N));
+  bound_gathers<Layout>(M, Policy::row_ecc ? ECC_ROW_MASK : 0xFFFFFFFF,
+                        Policy::column_mask);
+  start_scrubber(M);
+
+  return M;
+}
+
+template<class Layout, class Policy>
+const char* PolicyContext<Layout,Policy>::matrix_format()
+{
+  return "csr";
+}
+
+template<class Layout, class Policy>
+size_t PolicyContext<Layout,Policy>::matrix_cache_size(int N, int nnz)
+{
+  return cache_array_size((N+1)*sizeof(uint32_t)) + Layout::cache_size(nnz);
+}
+
+template<class Layout, class Policy>
+template<bool guarded>
+double PolicyContext<Layout,Policy>::checked_kernel(const cg_matrix *mat,
+                                                    const cg_vector *vec,
+                                                    cg_vector *result)
+{
+  double ret = 0.0;
+  unsigned corrected = 0;
+#pragma omp parallel reduction(+:ret,corrected)
+  {
+    // Private copies of the matrix and vector descriptors, which recording
+    // an error cannot change, so that the compiler does not reload them for
+    // every element
+    const cg_matrix M = *mat;
+    const double   *x = gather_vector(vec);
+
+    // Verify each block of a protected vector as it is first gathered from,
+    // and checksum each block of a protected result once its rows are
+    // written, a chunk of rows at a time
+    checksum_gather x_sums = gather_checksums();
+    checksum_rows   y_sums = result_checksums();
+    const unsigned  chunks = num_chunks(M.N);
+
+#pragma omp for
+    for (unsigned c = 0; c < chunks; c++)
     {
-      csr_element element;
-      element.value  = mat->values[i];
-      element.column = mat->cols[i];
+      unsigned first, last;
+      chunk_rows(c, M.N, &first, &last);
+
+      if (guarded)
+        gather_rows(x_sums, &M, first, last);
 
-      // Check ECC
-      uint32_t syndrome = ecc_compute_col8(element);
-      if (syndrome)
+      for (unsigned row = first; row < last; row++)
       {
-        // Unflip bit
-        uint32_t bit = ecc_get_flipped_bit_col8(syndrome);
-        ((uint32_t*)(&element))[bit/32] ^= 0x1U << (bit % 32);
-        mat->cols[i] = element.column;
-        mat->values[i] = element.value;
+        double tmp = 0.0;
 
-        printf("[ECC] corrected bit %u at index %d\n", bit, i);
-      }
+        uint32_t start, end;
+        if (Policy::row_ecc)
+        {
+          start = load_row_pointer(&M, row, true, corrected, error_log);
+          end   = load_row_pointer(&M, row+1, row+1 == M.N, corrected,
+                                   error_log);
+        }
+        else
+        {
+          start = M.rows[row];
+          end   = M.rows[row+1];
+        }
+        Policy::check_row(row, start, end, M.nnz, error_log);
 
-      // Mask out ECC from high order column bits
-      element.column &= 0x00FFFFFF;
+        // Keep a row that the checks could not correct in range
+        if (Policy::checks && end > M.nnz)
+          end = M.nnz;
 
-      tmp += mat->values[i] * vec->data[element.column];
-    }
+        uint32_t prev = 0;
+        for (uint32_t i = start; i < end; i++)
+        {
+          csr_element element = Layout::load(&M, i);
+
+          if (Policy::check(element, i, error_log))
+          {
+            Layout::store(&M, i, element);
+            corrected++;
+          }
 
-    result->data[row] = tmp;
+          // Mask out ECC from high order column bits
+          uint32_t col = element.column & Policy::column_mask;
+          Policy::check_column(i, col, prev, i == start, M.N, error_log);
+          prev = col;
+
+          // Skip an index that the checks could not correct
+          if (Policy::checks && col >= M.N)
+            continue;
+
+          tmp += element.value * x[col];
+        }
+
+        result->data[row] = tmp;
+        ret += tmp * x[row];
+      }
+      if (guarded)
+        y_sums.written(first, last);
+    }
   }
+  num_corrected += corrected;
+  return ret;
 }
 
-void CPUContext_SEC8::generate_ecc_bits(csr_element& element)
+template<class Layout, class Policy>
+double PolicyContext<Layout,Policy>::checked_spmv_dot(const cg_matrix *mat,
+                                                      const cg_vector *vec,
+                                                      cg_vector *result)
 {
-  element.column |= ecc_compute_col8(element);
-  element.column |= ecc_compute_overall_parity(element) << 24L;
+  return spmv_guarded() ? checked_kernel<true>(mat, vec, result)
+                        : checked_kernel<false>(mat, vec, result);
 }
 
-void CPUContext_SEC8::spmv(const cg_matrix *mat, const cg_vector *vec,
-                           cg_vector *result)
+template<class Layout, class Policy>
+template<bool guarded>
+double PolicyContext<Layout,Policy>::unchecked_kernel(const cg_matrix *mat,
+                                                      const cg_vector *vec,
+                                                      cg_vector *result)
 {
-#pragma omp parallel for
-  for (unsigned row = 0; row < mat->N; row++)
+  const uint32_t row_mask = Policy::row_ecc ? ECC_ROW_MASK : 0xFFFFFFFF;
+
+  double ret = 0.0;
+#pragma omp parallel reduction(+:ret)
   {
-    double tmp = 0.0;
+    const double   *x = gather_vector(vec);
+    checksum_gather x_sums = gather_checksums();
+    checksum_rows   y_sums = result_checksums();
+    const unsigned  chunks = num_chunks(mat->N);
 
-    uint32_t start = mat->rows[row];
-    uint32_t end   = mat->rows[row+1];
-    for (uint32_t i = start; i < end; i++)
+#pragma omp for
+    for (unsigned c = 0; c < chunks; c++)
     {
-      csr_element element;
-      element.value  = mat->values[i];
-      element.column = mat->cols[i];
+      unsigned first, last;
+      chunk_rows(c, mat->N, &first, &last);
+      if (guarded)
+        gather_rows(x_sums, mat, first, last);
 
-      // Check overall parity bit
-      if (ecc_compute_overall_parity(element))
+      for (unsigned row = first; row < last; row++)
       {
-        // Compute error syndrome from hamming bits
-        uint32_t syndrome = ecc_compute_col8(element);
-        if (syndrome)
+        double tmp = 0.0;
+
+        // Mask out ECC from high order row pointer bits, and keep a pointer
+        // corrupted since the last check in range
+        uint32_t start = mat->rows[row]   & row_mask;
+        uint32_t end   = mat->rows[row+1] & row_mask;
+        if (Policy::checks && end > mat->nnz)
+          end = mat->nnz;
+        for (uint32_t i = start; i < end; i++)
         {
-          // Unflip bit
-          uint32_t bit = ecc_get_flipped_bit_col8(syndrome);
-          ((uint32_t*)(&element))[bit/32] ^= 0x1U << (bit % 32);
+          csr_element element = Layout::load(mat, i);
 
-          printf("[ECC] corrected bit %u at index %d\n", bit, i);
-        }
-        else
-        {
-          // Correct overall parity bit
-          element.column ^= 0x1U << 24;
+          // Mask out ECC from high order column bits
+          uint32_t col = element.column & Policy::column_mask;
+
+          // Skip indices corrupted since the last check, which the next
+          // check will correct (and the solver will roll back past)
+          if (Policy::checks && col >= mat->N)
+            continue;
 
-          printf("[ECC] corrected overall parity bit at index %d\n", i);
+          tmp += element.value * x[col];
         }
-        mat->cols[i] = element.column;
-        mat->values[i] = element.value;
+
+        result->data[row] = tmp;
+        ret += tmp * x[row];
       }
+      if (guarded)
+        y_sums.written(first, last);
+    }
+  }
+  return ret;
+}
 
-      // Mask out ECC from high order column bits
-      element.column &= 0x00FFFFFF;
+template<class Layout, class Policy>
+double PolicyContext<Layout,Policy>::unchecked_spmv_dot(const cg_matrix *mat,
+                                                        const cg_vector *vec,
+                                                        cg_vector *result)
+{
+  return spmv_guarded() ? unchecked_kernel<true>(mat, vec, result)
+                        : unchecked_kernel<false>(mat, vec, result);
+}
 
-      tmp += mat->values[i] * vec->data[element.column];
-    }
+template<class Layout, class Policy>
+void PolicyContext<Layout,Policy>::inject_bitflip(cg_matrix *mat,
+                                                  BitFlipKind kind,
+                                                  int num_flips)
+{
+  int index = rand() % mat->nnz;
+
+  int start = 0;
+  int end   = 96;
+  if (kind == VALUE)
+    end = 64;
+  else if (kind == INDEX)
+    start = 64;
+
+  for (int i = 0; i < num_flips; i++)
+  {
+    int bit = (rand() % (end-start)) + start;
+    printf("*** flipping bit %d at index %d ***\n", bit, index);
+    Layout::flip_bit(mat, index, bit);
+  }
+}
 
-    result->data[row] = tmp;
+template<class Layout, class Policy>
+void PolicyContext<Layout,Policy>::set_scrub_interval(int interval_ms)
+{
+  // Only the elements and row pointers of the ECC modes can be scrubbed
+  if (!Policy::row_ecc)
+  {
+    CGContext::set_scrub_interval(interval_ms);
+    return;
   }
+  scrub_interval = interval_ms;
 }
 
-void CPUContext_SECDED::generate_ecc_bits(csr_element& element)
+cg_matrix* CPUContext_Checksum::create_matrix(const uint32_t *columns,
+                                              const uint32_t *rows,
+                                              const double *values,
+                                              int N, int nnz)
 {
-  element.column |= ecc_compute_col8(element);
-  element.column |= ecc_compute_overall_parity(element) << 24;
+  cg_matrix *M = PolicyContext<SplitLayout, None>::create_matrix(columns, rows,
+                                                  values, N, nnz);
+  M->checksums = create_matrix_checksums(rows, columns, values, N, nnz);
+  return M;
 }
 
-void CPUContext_SECDED::spmv(const cg_matrix *mat, const cg_vector *vec,
-                             cg_vector *result)
+void CPUContext_Checksum::destroy_matrix(cg_matrix *mat)
 {
-#pragma omp parallel for
-  for (unsigned row = 0; row < mat->N; row++)
+  destroy_matrix_checksums(mat->checksums);
+  PolicyContext<SplitLayout, None>::destroy_matrix(mat);
+}
+
+// The column checksums are built from the input, which a cache would not
+// hold
+bool CPUContext_Checksum::save_matrix(const cg_matrix *mat, FILE *file)
+{
+  return CGContext::save_matrix(mat, file);
+}
+
+cg_matrix* CPUContext_Checksum::map_matrix(void *data, int N, int nnz)
+{
+  return CGContext::map_matrix(data, N, nnz);
+}
+
+template<bool guarded>
+double CPUContext_Checksum::checked_kernel(const cg_matrix *mat,
+                                           const cg_vector *vec,
+                                           cg_vector *result)
+{
+  const matrix_checksums *cs = mat->checksums;
+
+  double ret = 0.0;
+  double sum = 0.0, weighted = 0.0;
+  double expected_sum = 0.0, expected_weighted = 0.0, abs = 0.0;
+#pragma omp parallel \
+  reduction(+:ret,sum,weighted,expected_sum,expected_weighted,abs)
   {
-    double tmp = 0.0;
+    const double   *x = gather_vector(vec);
+    checksum_gather x_sums = gather_checksums();
+    checksum_rows   y_sums = result_checksums();
+    const unsigned  chunks = num_chunks(mat->N);
 
-    uint32_t start = mat->rows[row];
-    uint32_t end   = mat->rows[row+1];
-    for (uint32_t i = start; i < end; i++)
+#pragma omp for
+    for (unsigned c = 0; c < chunks; c++)
     {
-      csr_element element;
-      element.value  = mat->values[i];
-      element.column = mat->cols[i];
+      unsigned first, last;
+      chunk_rows(c, mat->N, &first, &last);
+      if (guarded)
+        gather_rows(x_sums, mat, first, last);
 
-      // Check parity bits
-      uint32_t overall_parity = ecc_compute_overall_parity(element);
-      uint32_t syndrome = ecc_compute_col8(element);
-      if (overall_parity)
+      for (unsigned row = first; row < last; row++)
       {
-        if (syndrome)
+        double tmp = 0.0;
+
+        // Keep corrupted indices in range, for the checksums to catch
+        uint32_t start = mat->rows[row];
+        uint32_t end   = mat->rows[row+1];
+        if (end > mat->nnz)
+          end = mat->nnz;
+        for (uint32_t i = start; i < end; i++)
         {
-          // Unflip bit
-          uint32_t bit = ecc_get_flipped_bit_col8(syndrome);
-          ((uint32_t*)(&element))[bit/32] ^= 0x1U << (bit % 32);
+          uint32_t col = mat->cols[i];
+          if (col >= mat->N)
+            continue;
 
-          printf("[ECC] corrected bit %u at index %d\n", bit, i);
+          tmp += mat->values[i] * x[col];
         }
-        else
-        {
-          // Correct overall parity bit
-          element.column ^= 0x1U << 24;
 
-          printf("[ECC] corrected overall parity bit at index %d\n", i);
-        }
-        mat->cols[i] = element.column;
-        mat->values[i] = element.value;
+        result->data[row] = tmp;
+        ret += tmp * x[row];
+
+        // Accumulate both sides of the checksum relations, with the column
+        // checksums indexed by row
+        sum               += tmp;
+        weighted          += MATRIX_CHECKSUM_WEIGHT(row) * tmp;
+        expected_sum      += cs->sums[row] * x[row];
+        expected_weighted += cs->weighted[row] * x[row];
+        abs               += cs->abs[row] * fabs(x[row]);
       }
-      else
+      if (guarded)
+        y_sums.written(first, last);
+    }
+  }
+
+  if (matrix_checksums_match(cs->tolerance, sum, expected_sum,
+                             weighted, expected_weighted, abs))
+    return ret;
+
+  num_corrected += recover_matrix_checksums(cs, vec->data, result->data,
+                                            error_log,
+    [&](unsigned first, unsigned last)
+    {
+      for (unsigned row = first; row < last; row++)
       {
-        if (syndrome)
+        double tmp = 0.0;
+        uint32_t end = mat->rows[row+1] < mat->nnz ? mat->rows[row+1]
+                                                     : mat->nnz;
+        for (uint32_t i = mat->rows[row]; i < end; i++)
         {
-          // Overall parity fine but error in syndrom
-          // Must be double-bit error - cannot correct this
-          printf("[ECC] double-bit error detected\n");
-          exit(1);
+          if (mat->cols[i] < mat->N)
+            tmp += mat->values[i] * vec->data[mat->cols[i]];
         }
+        result->data[row] = tmp;
       }
+      rewrote_rows(first, last);
+    });
 
-      // Mask out ECC from high order column bits
-      element.column &= 0x00FFFFFF;
+  ret = 0.0;
+#pragma omp parallel for simd reduction(+:ret)
+  for (unsigned row = 0; row < mat->N; row++)
+  {
+    ret += result->data[row] * vec->data[row];
+  }
+  return ret;
+}
 
-      tmp += mat->values[i] * vec->data[element.column];
-    }
+double CPUContext_Checksum::checked_spmv_dot(const cg_matrix *mat,
+                                             const cg_vector *vec,
+                                             cg_vector *result)
+{
+  return spmv_guarded() ? checked_kernel<true>(mat, vec, result)
+                        : checked_kernel<false>(mat, vec, result);
+}
 
-    result->data[row] = tmp;
+// Write the encoded row pointers and elements of a matrix to an unlinked
+// temporary file, and map it back read-only
+static golden_copy* create_golden_copy(const cg_matrix *mat)
+{
+  size_t rows_size   = (mat->N+1) * sizeof(uint32_t);
+  size_t cols_size   = mat->nnz * sizeof(uint32_t);
+  size_t values_size = mat->nnz * sizeof(double);
+
+  // (the values start on a double boundary)
+  size_t values_offset = (rows_size + cols_size + 7) & ~(size_t)7;
+
+  const char *dir = getenv("TMPDIR");
+  std::string path = std::string(dir ? dir : "/tmp") + "/cg-golden-XXXXXX";
+  int fd = mkstemp(&path[0]);
+  if (fd < 0)
+  {
+    printf("Failed to create golden copy in '%s'\n", path.c_str());
+    exit(1);
+  }
+  unlink(path.c_str());
+
+  golden_copy *golden = new golden_copy;
+  golden->size = values_offset + values_size;
+  if (ftruncate(fd, golden->size) ||
+      pwrite(fd, mat->rows, rows_size, 0) != (ssize_t)rows_size ||
+      pwrite(fd, mat->cols, cols_size, rows_size) != (ssize_t)cols_size ||
+      pwrite(fd, mat->values, values_size, values_offset) !=
+        (ssize_t)values_size)
+  {
+    printf("Failed to write golden copy\n");
+    exit(1);
   }
+
+  golden->map = mmap(NULL, golden->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (golden->map == MAP_FAILED)
+  {
+    printf("Failed to map golden copy\n");
+    exit(1);
+  }
+
+  const char *base = (const char*)golden->map;
+  golden->rows   = (const uint32_t*)base;
+  golden->cols   = (const uint32_t*)(base + rows_size);
+  golden->values = (const double*)(base + values_offset);
+  return golden;
+}
+
+cg_matrix* CPUContext_SEDRecovery::create_matrix(const uint32_t *columns,
+                                                 const uint32_t *rows,
+                                                 const double *values,
+                                                 int N, int nnz)
+{
+  cg_matrix *M = PolicyContext<SplitLayout, SED>::create_matrix(columns, rows,
+                                                                values, N,
+                                                                nnz);
+  M->golden = create_golden_copy(M);
+  return M;
+}
+
+cg_matrix* CPUContext_SEDRecovery::map_matrix(void *data, int N, int nnz)
+{
+  cg_matrix *M = PolicyContext<SplitLayout, SED>::map_matrix(data, N, nnz);
+  M->golden = create_golden_copy(M);
+  return M;
 }
 
+void CPUContext_SEDRecovery::destroy_matrix(cg_matrix *mat)
+{
+  munmap(mat->golden->map, mat->golden->size);
+  delete mat->golden;
+  PolicyContext<SplitLayout, SED>::destroy_matrix(mat);
+}
+
+template<bool guarded>
+double CPUContext_SEDRecovery::checked_kernel(const cg_matrix *mat,
+                                              const cg_vector *vec,
+                                              cg_vector *result)
+{
+  double ret = 0.0;
+  unsigned corrected = 0;
+#pragma omp parallel reduction(+:ret,corrected)
+  {
+    // Private copies of the descriptors (see PolicyContext)
+    const cg_matrix    M      = *mat;
+    const golden_copy *golden = mat->golden;
+    const double      *x      = gather_vector(vec);
+    checksum_gather    x_sums = gather_checksums();
+    checksum_rows      y_sums = result_checksums();
+    const unsigned     chunks = num_chunks(M.N);
+
+#pragma omp for
+    for (unsigned c = 0; c < chunks; c++)
+    {
+      unsigned first, last;
+      chunk_rows(c, M.N, &first, &last);
+      if (guarded)
+        gather_rows(x_sums, &M, first, last);
+
+      for (unsigned row = first; row < last; row++)
+      {
+        double tmp = 0.0;
+
+        uint32_t start = load_row_pointer(&M, row, true, corrected,
+                                          error_log, golden->rows);
+        uint32_t end   = load_row_pointer(&M, row+1, row+1 == M.N,
+                                          corrected, error_log,
+                                          golden->rows);
+        for (uint32_t i = start; i < end; i++)
+        {
+          csr_element element = SplitLayout::load(&M, i);
+
+          // Reload an element that fails its parity check before using it,
+          // so the row never needs recomputing
+          if (ecc_compute_overall_parity(element))
+          {
+            element.column = golden->cols[i];
+            element.value  = golden->values[i];
+            SplitLayout::store(&M, i, element);
+            corrected++;
+
+            error_log.record(ERROR_CORRECTED, ERROR_ELEMENT, i);
+          }
+
+          // Mask out ECC from high order column bits
+          uint32_t col = element.column & SED::column_mask;
+
+          tmp += element.value * x[col];
+        }
+
+        result->data[row] = tmp;
+        ret += tmp * x[row];
+      }
+      if (guarded)
+        y_sums.written(first, last);
+    }
+  }
+  num_corrected += corrected;
+  return ret;
+}
+
+double CPUContext_SEDRecovery::checked_spmv_dot(const cg_matrix *mat,
+                                                const cg_vector *vec,
+                                                cg_vector *result)
+{
+  return spmv_guarded() ? checked_kernel<true>(mat, vec, result)
+                        : checked_kernel<false>(mat, vec, result);
+}
+
+void CPUContext_SEDRecovery::set_scrub_interval(int interval_ms)
+{
+  // The scrubber could only detect errors, not recover them
+  CGContext::set_scrub_interval(interval_ms);
+}
+
+// Used by the contexts in the other source files
+template class PolicyContext<SplitLayout, SED>;
+template class PolicyContext<SplitLayout, SEC7>;
+template class PolicyContext<SplitLayout, SEC8>;
+template class PolicyContext<SplitLayout, SECDED>;
+
 namespace
 {
-  static CGContext::Register<CPUContext> A("cpu", "none");
-  static CGContext::Register<CPUContext_Constraints> B("cpu", "constraints");
-  static CGContext::Register<CPUContext_SED> C("cpu", "sed");
-  static CGContext::Register<CPUContext_SEC7> D("cpu", "sec7");
-  static CGContext::Register<CPUContext_SEC8> E("cpu", "sec8");
-  static CGContext::Register<CPUContext_SECDED> F("cpu", "secded");
+  // Register PolicyContext<Layout, P> under target for each P in Policies
+  template<class Layout, class... Policies>
+  struct RegisterPolicies
+  {
+    RegisterPolicies(const char *target)
+    {
+      int registered[] =
+      {
+        (CGContext::Register< PolicyContext<Layout,Policies> >(
+           target, Policies::name()), 0)...
+      };
+      (void)registered;
+    }
+  };
+
+  static RegisterPolicies<SplitLayout,
+                          None, Constraints, SED, SEC7, SEC8, SECDED,
+                          Combined<Constraints, SED>,
+                          Combined<Constraints, SEC7>,
+                          Combined<Constraints, SEC8>,
+                          Combined<Constraints, SECDED> > A("cpu");
+  static CGContext::Register<CPUContext_Checksum> B("cpu", "checksum");
+  static CGContext::Register<CPUContext_SEDRecovery> D("cpu", "sed+recovery");
+
+  static RegisterPolicies<PackedLayout,
+                          None, SED, SEC7, SEC8, SECDED> C("aos");
 }
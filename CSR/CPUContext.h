@@ -1,11 +1,29 @@
 #include "CGContext.h"
 
 #include "ecc.h"
+#include "MatrixCache.h"
+#include "MatrixChecksums.h"
+#include "Policies.h"
+#include "Scrubber.h"
+#include "VectorChecksums.h"
 
 struct cg_vector
 {
   int N;
   double *data;
+
+  // Block checksums, or NULL if the vector is not protected
+  vector_checksum *checksums;
+};
+
+// Read-only copy of an encoded matrix, mapped from a file
+struct golden_copy
+{
+  void           *map;
+  size_t          size;
+  const uint32_t *rows;
+  const uint32_t *cols;
+  const double   *values;
 };
 
 struct cg_matrix
@@ -15,16 +33,297 @@ struct cg_matrix
   uint32_t *cols;
   uint32_t *rows;
   double   *values;
+
+  // Packed elements, used instead of cols/values by PackedLayout
+  csr_element *elements;
+
+  // Column checksums, used by the checksum mode
+  matrix_checksums *checksums;
+
+  // Background scrubber, or NULL if the matrix is not scrubbed
+  Scrubber *scrubber;
+
+  // Copy to recover corrupted elements from, used by the recovery mode
+  golden_copy *golden;
+
+  // Whether the arrays are in a mapping of a matrix cache, rather than in
+  // the context's arena
+  bool mapped;
+
+  // Number of copies of these rows along the diagonal of the matrix that
+  // the spmv multiplies by, which all share the arrays
+  unsigned num_blocks;
+
+  // Lowest and highest index of the vector that each block of
+  // CHECKSUM_BLOCK rows gathers from in an spmv (see bound_gathers)
+  uint32_t *gather_bounds;
 };
 
+// Storage of the matrix elements, for PolicyContext. A layout provides:
+//   allocate()   - allocate storage for the elements of a matrix in an arena
+//   release()    - free it
+//   save()       - write the elements to a matrix cache
+//   map()        - point the elements at the ones save() wrote, in a mapping
+//   cache_size() - bytes that save() writes for nnz elements
+//   load()       - read element i
+//   store()      - write element i
+//   flip_bit()   - flip a bit of element i, numbered as in a csr_element
+
+// Separate column index and value arrays
+struct SplitLayout
+{
+  static inline void allocate(cg_matrix *mat, Arena& arena)
+  {
+    mat->cols     = arena.allocate<uint32_t>(mat->nnz);
+    mat->values   = arena.allocate<double>(mat->nnz);
+    mat->elements = NULL;
+  }
+
+  static inline void release(cg_matrix *mat, Arena& arena)
+  {
+    arena.release(mat->cols);
+    arena.release(mat->values);
+  }
+
+  static inline void save(const cg_matrix *mat, FILE *file)
+  {
+    write_cache_array(file, mat->cols, mat->nnz*sizeof(uint32_t));
+    write_cache_array(file, mat->values, mat->nnz*sizeof(double));
+  }
+
+  static inline void map(cg_matrix *mat, char **cursor)
+  {
+    mat->cols     = (uint32_t*)map_cache_array(cursor,
+                                               mat->nnz*sizeof(uint32_t));
+    mat->values   = (double*)map_cache_array(cursor,
+                                             mat->nnz*sizeof(double));
+    mat->elements = NULL;
+  }
+
+  static inline size_t cache_size(uint32_t nnz)
+  {
+    return cache_array_size(nnz*sizeof(uint32_t)) +
+           cache_array_size(nnz*sizeof(double));
+  }
+
+  static inline csr_element load(const cg_matrix *mat, uint32_t i)
+  {
+    csr_element element;
+    element.value  = mat->values[i];
+    element.column = mat->cols[i];
+    return element;
+  }
+
+  static inline void store(const cg_matrix *mat, uint32_t i,
+                           const csr_element& element)
+  {
+    mat->cols[i]   = element.column;
+    mat->values[i] = element.value;
+  }
+
+  static inline void flip_bit(const cg_matrix *mat, uint32_t i, int bit)
+  {
+    if (bit < 64)
+      ((uint32_t*)(mat->values+i))[bit/32] ^= 0x1U << (bit % 32);
+    else
+      mat->cols[i] ^= 0x1U << (bit % 32);
+  }
+};
+
+// A single array of packed csr_elements, so that checking, correcting and
+// multiplying an element all read from a single stream
+struct PackedLayout
+{
+  static inline void allocate(cg_matrix *mat, Arena& arena)
+  {
+    mat->cols     = NULL;
+    mat->values   = NULL;
+    mat->elements = arena.allocate<csr_element>(mat->nnz);
+  }
+
+  static inline void release(cg_matrix *mat, Arena& arena)
+  {
+    arena.release(mat->elements);
+  }
+
+  static inline void save(const cg_matrix *mat, FILE *file)
+  {
+    write_cache_array(file, mat->elements, mat->nnz*sizeof(csr_element));
+  }
+
+  static inline void map(cg_matrix *mat, char **cursor)
+  {
+    mat->cols     = NULL;
+    mat->values   = NULL;
+    mat->elements = (csr_element*)map_cache_array(cursor,
+                                                  mat->nnz*
+                                                  sizeof(csr_element));
+  }
+
+  static inline size_t cache_size(uint32_t nnz)
+  {
+    return cache_array_size(nnz*sizeof(csr_element));
+  }
+
+  static inline csr_element load(const cg_matrix *mat, uint32_t i)
+  {
+    return mat->elements[i];
+  }
+
+  static inline void store(const cg_matrix *mat, uint32_t i,
+                           const csr_element& element)
+  {
+    mat->elements[i] = element;
+  }
+
+  static inline void flip_bit(const cg_matrix *mat, uint32_t i, int bit)
+  {
+    ecc_flip_bit(mat->elements+i, bit);
+  }
+};
+
+// Record the lowest and highest index of the vector that each block of
+// CHECKSUM_BLOCK rows of a new matrix gathers from in an spmv, including the
+// rows themselves (for the dot product), so that the kernels can verify the
+// blocks of a protected vector that a chunk gathers from without searching
+// its rows. The row pointers and columns carry ECC bits outside row_mask and
+// column_mask. An index corrupted later is either corrected back within the
+// bounds, or skipped, before it is gathered from, unless the matrix is not
+// checked at all.
+template<class Layout>
+static void bound_gathers(cg_matrix *M, uint32_t row_mask,
+                          uint32_t column_mask)
+{
+#pragma omp parallel for
+  for (int b = 0; b < checksum_blocks(M->N); b++)
+  {
+    uint32_t first = b*CHECKSUM_BLOCK;
+    uint32_t last  = std::min(first + CHECKSUM_BLOCK, M->N);
+    uint32_t lo    = first, hi = last - 1;
+    for (uint32_t i = M->rows[first] & row_mask;
+         i < (M->rows[last] & row_mask); i++)
+    {
+      uint32_t col = Layout::load(M, i).column & column_mask;
+      lo = std::min(lo, col);
+      hi = std::max(hi, col);
+    }
+    M->gather_bounds[2*b]   = lo;
+    M->gather_bounds[2*b+1] = hi;
+  }
+}
+
+// Verify the blocks of the vector that rows [first, last) of a matrix gather
+// from in an spmv
+static inline void gather_rows(checksum_gather& x_sums, const cg_matrix *M,
+                               unsigned first, unsigned last)
+{
+  if (x_sums.checksums == NULL || first >= last)
+    return;
+
+  uint32_t lo = UINT32_MAX, hi = 0;
+  for (unsigned b = first / CHECKSUM_BLOCK;
+       b <= (last - 1) / CHECKSUM_BLOCK; b++)
+  {
+    lo = std::min(lo, M->gather_bounds[2*b]);
+    hi = std::max(hi, M->gather_bounds[2*b+1]);
+  }
+  x_sums.check(lo);
+  x_sums.check(hi);
+}
+
 class CPUContext : public CGContext
 {
-  virtual void generate_ecc_bits(csr_element& element);
-  virtual cg_matrix* create_matrix(const uint32_t *columns,
-                                   const uint32_t *rows,
-                                   const double *values,
-                                   int N, int nnz);
-  virtual void destroy_matrix(cg_matrix *mat);
+public:
+  CPUContext();
+  virtual ~CPUContext();
+
+protected:
+  // Number of matrix errors corrected so far
+  unsigned num_corrected;
+
+  // Pause between sweeps of the scrubber of new matrices, or -1 for none
+  int scrub_interval;
+
+  // Storage of the matrix and vector arrays
+  Arena arena;
+
+  // Model the bytes that each node's threads stream in an spmv over mat,
+  // whose row pointers carry ECC bits outside row_mask, for the bandwidth
+  // estimate
+  void model_traffic(const cg_matrix *mat, uint32_t row_mask);
+
+  // The copy of vec that the calling thread should gather from in an spmv
+  const double* gather_vector(const cg_vector *vec) const;
+
+  // The calling thread's guards of its gathers from the vector and writes
+  // to the result in an spmv, which verify and checksum the blocks of the
+  // whole vectors as the kernel reaches them (see VectorChecksums.h)
+  checksum_gather gather_checksums();
+  checksum_rows   result_checksums();
+
+  // Whether the vectors of the current spmv are protected, so that its
+  // kernel must verify and checksum their blocks. The kernels are
+  // instantiated both ways, so that an unprotected spmv has no guards.
+  bool spmv_guarded() const;
+
+  // The chunks of an spmv over N rows that the kernels multiply at a time
+  // (see CHECKSUM_CHUNK), which start on chunk boundaries of the whole
+  // vectors, so that each chunk writes whole blocks of the result
+  unsigned num_chunks(unsigned N) const;
+  void     chunk_rows(unsigned c, unsigned N,
+                      unsigned *first, unsigned *last) const;
+
+  // Mark rows [first, last) of the result as written again after the
+  // kernel, so that their blocks are checksummed again
+  void rewrote_rows(unsigned first, unsigned last);
+
+  virtual double checked_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                  cg_vector *result) = 0;
+  virtual double unchecked_spmv_dot(const cg_matrix *mat,
+                                    const cg_vector *vec,
+                                    cg_vector *result) = 0;
+
+private:
+  // Whether new vectors are protected with checksums
+  bool vector_checksums;
+
+  // Periodic checking state
+  int         check_interval;
+  int         spmv_count;
+  CheckResult check_result;
+
+  // Index of the NUMA node of each OpenMP thread, and the number of each
+  // node indexed
+  std::vector<int> thread_nodes;
+  std::vector<int> node_ids;
+
+  // Copy of the gathered vector on each node, if replicating, and the
+  // offset of the block of it that the current spmv gathers from
+  bool                 numa_replication;
+  std::vector<double*> replicas;
+  int                  replica_N;
+  size_t               gather_offset;
+
+  // The whole vector and result of the current spmv, and which of their
+  // blocks the kernel has verified and checksummed
+  const cg_vector                          *spmv_vec;
+  cg_vector                                *spmv_result;
+  std::vector< std::atomic<unsigned char> > gather_states;
+  std::vector<unsigned char>                row_done;
+
+  // Modelled bytes that each node's threads stream in one spmv and in all
+  // of them so far, and the time spent in the spmvs (seconds)
+  std::vector<double> node_bytes;
+  std::vector<double> node_traffic;
+  double              spmv_time;
+
+  void map_threads();
+  void replicate_vector(const cg_vector *vec);
+
+  virtual cg_matrix* create_block_matrix(const uint32_t *columns,
+                                         const uint32_t *rows,
+                                         const double *values,
+                                         int N, int nnz, int num_blocks);
 
   virtual cg_vector* create_vector(int N);
   virtual void destroy_vector(cg_vector *vec);
@@ -36,44 +335,148 @@ class CPUContext : public CGContext
   virtual double calc_xr(cg_vector *x, cg_vector *r,
                          const cg_vector *p, const cg_vector *w,
                          double alpha);
+  virtual double calc_xr_wr(cg_vector *x, cg_vector *r,
+                            const cg_vector *p, const cg_vector *w,
+                            double alpha, double *wr);
   virtual void calc_p(cg_vector *p, const cg_vector *r, double beta);
 
   virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
                     cg_vector *result);
+  virtual double spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                          cg_vector *result);
 
-  virtual void inject_bitflip(cg_matrix *mat, BitFlipKind kind, int num_flips);
-};
-
-class CPUContext_Constraints : public CPUContext
-{
-  virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
-                    cg_vector *result);
+  virtual void set_check_interval(int k);
+  virtual CheckResult last_check();
+  virtual void set_vector_checksums(bool enable);
+  virtual void inject_vector_bitflip(cg_vector *vec, int num_flips);
+  virtual void set_numa_replication(bool enable);
+  virtual void spmv_bandwidth(std::vector<int>& nodes,
+                              std::vector<double>& bandwidth);
+  virtual void set_huge_pages(HugePages kind);
+  virtual void huge_page_usage(size_t *mapped, size_t *huge);
 };
 
-class CPUContext_SED : public CPUContext
+// CSR context whose spmv kernels are specialised for a Layout and a
+// checking Policy (see Policies.h). The members are defined and explicitly
+// instantiated in CPUContext.cpp, so that contexts built with other
+// instruction sets never supply the generic kernels.
+template<class Layout, class Policy>
+class PolicyContext : public CPUContext
 {
+protected:
   virtual void generate_ecc_bits(csr_element& element);
-  virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
-                    cg_vector *result);
+  virtual cg_matrix* create_matrix(const uint32_t *columns,
+                                   const uint32_t *rows,
+                                   const double *values,
+                                   int N, int nnz);
+  virtual void destroy_matrix(cg_matrix *mat);
+  virtual bool save_matrix(const cg_matrix *mat, FILE *file);
+  virtual cg_matrix* map_matrix(void *data, int N, int nnz);
+  virtual const char* matrix_format();
+  virtual size_t matrix_cache_size(int N, int nnz);
+
+  virtual double checked_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                  cg_vector *result);
+  virtual double unchecked_spmv_dot(const cg_matrix *mat,
+                                    const cg_vector *vec,
+                                    cg_vector *result);
+
+  virtual void inject_bitflip(cg_matrix *mat, BitFlipKind kind, int num_flips);
+
+  virtual void set_scrub_interval(int interval_ms);
+
+private:
+  void start_scrubber(cg_matrix *M);
+
+  // The kernels, instantiated with and without the guards of protected
+  // vectors (see spmv_guarded)
+  template<bool guarded>
+  double checked_kernel(const cg_matrix *mat, const cg_vector *vec,
+                        cg_vector *result);
+  template<bool guarded>
+  double unchecked_kernel(const cg_matrix *mat, const cg_vector *vec,
+                          cg_vector *result);
 };
 
-class CPUContext_SEC7 : public CPUContext
+typedef PolicyContext<SplitLayout, SED>    CPUContext_SED;
+typedef PolicyContext<SplitLayout, SEC7>   CPUContext_SEC7;
+typedef PolicyContext<SplitLayout, SEC8>   CPUContext_SEC8;
+typedef PolicyContext<SplitLayout, SECDED> CPUContext_SECDED;
+
+// Huang-Abraham column checksums instead of ECC
+class CPUContext_Checksum : public PolicyContext<SplitLayout, None>
 {
-  virtual void generate_ecc_bits(csr_element& element);
-  virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
-                    cg_vector *result);
+  virtual cg_matrix* create_matrix(const uint32_t *columns,
+                                   const uint32_t *rows,
+                                   const double *values,
+                                   int N, int nnz);
+  virtual void destroy_matrix(cg_matrix *mat);
+  virtual bool save_matrix(const cg_matrix *mat, FILE *file);
+  virtual cg_matrix* map_matrix(void *data, int N, int nnz);
+  virtual double checked_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                  cg_vector *result);
+
+  template<bool guarded>
+  double checked_kernel(const cg_matrix *mat, const cg_vector *vec,
+                        cg_vector *result);
 };
 
-class CPUContext_SEC8 : public CPUContext
+// SED checks whose failures are recovered from a golden copy of the matrix
+class CPUContext_SEDRecovery : public PolicyContext<SplitLayout, SED>
 {
-  virtual void generate_ecc_bits(csr_element& element);
-  virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
-                    cg_vector *result);
+  virtual cg_matrix* create_matrix(const uint32_t *columns,
+                                   const uint32_t *rows,
+                                   const double *values,
+                                   int N, int nnz);
+  virtual void destroy_matrix(cg_matrix *mat);
+  virtual cg_matrix* map_matrix(void *data, int N, int nnz);
+  virtual double checked_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                  cg_vector *result);
+  virtual void set_scrub_interval(int interval_ms);
+
+  template<bool guarded>
+  double checked_kernel(const cg_matrix *mat, const cg_vector *vec,
+                        cg_vector *result);
 };
 
-class CPUContext_SECDED : public CPUContext
+// Load row pointer i of a matrix whose row pointers carry ECC bits, checking
+// and correcting it. Each pointer is owned by the row that it starts (and the
+// last one by the last row). Only the owner writes a correction back and
+// records it, so that threads never race on a pointer. A pointer that cannot
+// be corrected is reloaded from golden if given, or else clamped to the
+// number of non-zeros.
+static inline uint32_t load_row_pointer(const cg_matrix *mat, uint32_t i,
+                                        bool owner, unsigned& corrected,
+                                        ErrorLog& log,
+                                        const uint32_t *golden = NULL)
 {
-  virtual void generate_ecc_bits(csr_element& element);
-  virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
-                    cg_vector *result);
-};
+  uint32_t ptr = mat->rows[i];
+  int bit = ecc_correct_row(ptr);
+  if (bit == ECC_ROW_UNCORRECTABLE && golden)
+  {
+    ptr = golden[i];
+    if (owner)
+    {
+      mat->rows[i] = ptr;
+      corrected++;
+
+      log.record(ERROR_CORRECTED, ERROR_ROW_POINTER, i);
+    }
+    return ptr & ECC_ROW_MASK;
+  }
+  if (bit == ECC_ROW_UNCORRECTABLE)
+  {
+    if (owner)
+      log.record(ERROR_UNCORRECTABLE, ERROR_ROW_POINTER, i);
+    ptr &= ECC_ROW_MASK;
+    return ptr < mat->nnz ? ptr : mat->nnz;
+  }
+  if (bit >= 0 && owner)
+  {
+    mat->rows[i] = ptr;
+    corrected++;
+
+    log.record(ERROR_CORRECTED, ERROR_ROW_POINTER, i, bit);
+  }
+  return ptr & ECC_ROW_MASK;
+}
@@ -1,13 +1,456 @@
 #include "OCLContext.h"
 
-OCLContext::OCLContext()
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Work-items per work-group (or the device's limit, if lower), and number of
+// work-groups, over which the kernels stride through their rows or elements
+#define OCL_GROUP_SIZE 64
+#define OCL_NUM_GROUPS 256
+
+#define STRINGIFY(x) #x
+#define STR(x) STRINGIFY(x)
+
+// The masks of ecc.h, so that the kernels encode elements and row pointers
+// exactly as the cpu contexts do
+static const char *ecc_source =
+  "#define ECC7_P1_0 " STR(ECC7_P1_0) "\n"
+  "#define ECC7_P1_1 " STR(ECC7_P1_1) "\n"
+  "#define ECC7_P1_2 " STR(ECC7_P1_2) "\n"
+  "#define ECC7_P2_0 " STR(ECC7_P2_0) "\n"
+  "#define ECC7_P2_1 " STR(ECC7_P2_1) "\n"
+  "#define ECC7_P2_2 " STR(ECC7_P2_2) "\n"
+  "#define ECC7_P3_0 " STR(ECC7_P3_0) "\n"
+  "#define ECC7_P3_1 " STR(ECC7_P3_1) "\n"
+  "#define ECC7_P3_2 " STR(ECC7_P3_2) "\n"
+  "#define ECC7_P4_0 " STR(ECC7_P4_0) "\n"
+  "#define ECC7_P4_1 " STR(ECC7_P4_1) "\n"
+  "#define ECC7_P4_2 " STR(ECC7_P4_2) "\n"
+  "#define ECC7_P5_0 " STR(ECC7_P5_0) "\n"
+  "#define ECC7_P5_1 " STR(ECC7_P5_1) "\n"
+  "#define ECC7_P5_2 " STR(ECC7_P5_2) "\n"
+  "#define ECC7_P6_0 " STR(ECC7_P6_0) "\n"
+  "#define ECC7_P6_1 " STR(ECC7_P6_1) "\n"
+  "#define ECC7_P6_2 " STR(ECC7_P6_2) "\n"
+  "#define ECC7_P7_0 " STR(ECC7_P7_0) "\n"
+  "#define ECC7_P7_1 " STR(ECC7_P7_1) "\n"
+  "#define ECC7_P7_2 " STR(ECC7_P7_2) "\n"
+  "#define ECC_ROW_MASK " STR(ECC_ROW_MASK) "\n"
+  "#define ECC_ROW_P1 " STR(ECC_ROW_P1) "\n"
+  "#define ECC_ROW_P2 " STR(ECC_ROW_P2) "\n"
+  "#define ECC_ROW_P3 " STR(ECC_ROW_P3) "\n"
+  "#define ECC_ROW_P4 " STR(ECC_ROW_P4) "\n"
+  "#define ECC_ROW_P5 " STR(ECC_ROW_P5) "\n";
+
+// The kernels, built for one mode with MODE, COLUMN_MASK, GROUP_SIZE, the
+// ErrorKind and ErrorSource values and ERROR_CAPACITY defined. Each work-item
+// strides through the rows or elements, and the reductions leave one partial
+// sum per work-group for the host to add up.
+static const char *kernel_source = R"(
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+// Add up value over the work-group, in scratch
+double reduce(double value, __local double *scratch)
+{
+  uint lid = get_local_id(0);
+  scratch[lid] = value;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (uint offset = GROUP_SIZE/2; offset > 0; offset /= 2)
+  {
+    if (lid < offset)
+      scratch[lid] += scratch[lid + offset];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  return scratch[0];
+}
+
+__kernel void dot(__global const double *a, __global const double *b,
+                  uint N, __global double *partial)
+{
+  __local double scratch[GROUP_SIZE];
+
+  double ret = 0.0;
+  for (uint i = get_global_id(0); i < N; i += get_global_size(0))
+    ret += a[i] * b[i];
+
+  ret = reduce(ret, scratch);
+  if (get_local_id(0) == 0)
+    partial[get_group_id(0)] = ret;
+}
+
+// Also leaves the partial sums of wT * r (before the update) after those of
+// rT * r
+__kernel void calc_xr(__global double *x, __global double *r,
+                      __global const double *p, __global const double *w,
+                      double alpha, uint N, __global double *partial)
+{
+  __local double scratch_rr[GROUP_SIZE];
+  __local double scratch_wr[GROUP_SIZE];
+
+  double rr = 0.0, wr = 0.0;
+  for (uint i = get_global_id(0); i < N; i += get_global_size(0))
+  {
+    wr += w[i] * r[i];
+    x[i] += alpha * p[i];
+    r[i] -= alpha * w[i];
+
+    rr += r[i] * r[i];
+  }
+
+  rr = reduce(rr, scratch_rr);
+  wr = reduce(wr, scratch_wr);
+  if (get_local_id(0) == 0)
+  {
+    partial[get_group_id(0)] = rr;
+    partial[get_group_id(0) + get_num_groups(0)] = wr;
+  }
+}
+
+__kernel void calc_p(__global double *p, __global const double *r,
+                     double beta, uint N)
+{
+  for (uint i = get_global_id(0); i < N; i += get_global_size(0))
+    p[i] = r[i] + beta * p[i];
+}
+
+// The error buffer holds the number of events recorded, the number of
+// corrections, and then up to ERROR_CAPACITY events of four words: kind,
+// source, index and bit
+void record_error(__global uint *errors, uint kind, uint source, uint index,
+                  int bit)
+{
+  uint e = atomic_inc(errors);
+  if (e < ERROR_CAPACITY)
+  {
+    errors[2 + 4*e + 0] = kind;
+    errors[2 + 4*e + 1] = source;
+    errors[2 + 4*e + 2] = index;
+    errors[2 + 4*e + 3] = bit;
+  }
+  if (kind == ERROR_CORRECTED)
+    atomic_inc(errors + 1);
+}
+
+uint parity(uint x)
+{
+  return popcount(x) & 1;
+}
+
+// As in ecc.h
+uint ecc_compute_col8(uint d0, uint d1, uint d2)
+{
+  return parity((d0 & ECC7_P1_0) ^ (d1 & ECC7_P1_1) ^ (d2 & ECC7_P1_2)) << 31 |
+         parity((d0 & ECC7_P2_0) ^ (d1 & ECC7_P2_1) ^ (d2 & ECC7_P2_2)) << 30 |
+         parity((d0 & ECC7_P3_0) ^ (d1 & ECC7_P3_1) ^ (d2 & ECC7_P3_2)) << 29 |
+         parity((d0 & ECC7_P4_0) ^ (d1 & ECC7_P4_1) ^ (d2 & ECC7_P4_2)) << 28 |
+         parity((d0 & ECC7_P5_0) ^ (d1 & ECC7_P5_1) ^ (d2 & ECC7_P5_2)) << 27 |
+         parity((d0 & ECC7_P6_0) ^ (d1 & ECC7_P6_1) ^ (d2 & ECC7_P6_2)) << 26 |
+         parity((d0 & ECC7_P7_0) ^ (d1 & ECC7_P7_1) ^ (d2 & ECC7_P7_2)) << 25;
+}
+
+uint ecc_get_flipped_bit_col8(uint syndrome)
+{
+  uint hamm_bit = 0;
+  for (int p = 1; p <= 7; p++)
+  {
+    if ((syndrome >> (32-p)) & 0x1)
+      hamm_bit += 0x1U<<(p-1);
+  }
+
+  if ((hamm_bit & (hamm_bit - 1)) == 0)
+    return clz(hamm_bit) + 64;
+  return hamm_bit - (32-clz(hamm_bit)) - 1;
+}
+
+// Check (and correct in place) element i, given its words
+void check_element(__global uint *cols, __global double *values, uint i,
+                   uint *d0, uint *d1, uint *d2, __global uint *errors)
+{
+  uint overall_parity = parity(*d0 ^ *d1 ^ *d2);
+  if (MODE == ECC_SED)
+  {
+    if (overall_parity)
+      record_error(errors, ERROR_DETECTED, ERROR_ELEMENT, i, -1);
+    return;
+  }
+
+  // SEC8 only needs the syndrome when the overall parity is wrong
+  if (MODE == ECC_SEC8 && !overall_parity)
+    return;
+
+  uint syndrome = ecc_compute_col8(*d0, *d1, *d2);
+  uint bit;
+  if (MODE == ECC_SEC7)
+  {
+    if (!syndrome)
+      return;
+    bit = ecc_get_flipped_bit_col8(syndrome);
+  }
+  else if (overall_parity)
+  {
+    // The overall parity bit itself, if the syndrome is clean
+    bit = syndrome ? ecc_get_flipped_bit_col8(syndrome) : 88;
+  }
+  else
+  {
+    // Overall parity fine but error in syndrome: a double-bit error
+    if (MODE == ECC_SECDED && syndrome)
+      record_error(errors, ERROR_UNCORRECTABLE, ERROR_ELEMENT, i, -1);
+    return;
+  }
+
+  if (bit < 32)
+    *d0 ^= 0x1U << bit;
+  else if (bit < 64)
+    *d1 ^= 0x1U << (bit - 32);
+  else if (bit < 96)
+    *d2 ^= 0x1U << (bit - 64);
+  values[i] = as_double(upsample(*d1, *d0));
+  cols[i]   = *d2;
+
+  record_error(errors, ERROR_CORRECTED, ERROR_ELEMENT, i, bit);
+}
+
+// Load row pointer i, checking and correcting it. As in the cpu contexts,
+// only the row that a pointer starts (or the last row, for the last one)
+// writes a correction back and records it.
+uint load_row_pointer(__global uint *rows, uint i, bool owner, uint nnz,
+                      __global uint *errors)
+{
+  uint ptr = rows[i];
+  uint syndrome = parity(ptr & ECC_ROW_P1) << 0 |
+                  parity(ptr & ECC_ROW_P2) << 1 |
+                  parity(ptr & ECC_ROW_P3) << 2 |
+                  parity(ptr & ECC_ROW_P4) << 3 |
+                  parity(ptr & ECC_ROW_P5) << 4;
+  if (!parity(ptr))
+  {
+    if (syndrome)
+    {
+      if (owner)
+        record_error(errors, ERROR_UNCORRECTABLE, ERROR_ROW_POINTER, i, -1);
+      ptr &= ECC_ROW_MASK;
+      return ptr < nnz ? ptr : nnz;
+    }
+    return ptr & ECC_ROW_MASK;
+  }
+
+  int bit = 26;
+  if ((syndrome & (syndrome - 1)) == 0 && syndrome)
+    bit = 27 + (31 - clz(syndrome));
+  else if (syndrome)
+    bit = syndrome - (32-clz(syndrome)) - 1;
+
+  ptr ^= 0x1U << bit;
+  if (owner)
+  {
+    rows[i] = ptr;
+    record_error(errors, ERROR_CORRECTED, ERROR_ROW_POINTER, i, bit);
+  }
+  return ptr & ECC_ROW_MASK;
+}
+
+// result = mat*vec, leaving the partial sums of vecT * result. The checks
+// are skipped unless check is set, but the ECC bits are still masked out.
+__kernel void spmv(__global uint *rows, __global uint *cols,
+                   __global double *values, uint N, uint nnz, uint check,
+                   __global const double *vec, __global double *result,
+                   __global double *partial, __global uint *errors)
+{
+  __local double scratch[GROUP_SIZE];
+
+  double ret = 0.0;
+  for (uint row = get_global_id(0); row < N; row += get_global_size(0))
+  {
+    uint start, end;
+    if (MODE != ECC_NONE && check)
+    {
+      start = load_row_pointer(rows, row, true, nnz, errors);
+      end   = load_row_pointer(rows, row+1, row+1 == N, nnz, errors);
+    }
+    else if (MODE != ECC_NONE)
+    {
+      start = rows[row]   & ECC_ROW_MASK;
+      end   = rows[row+1] & ECC_ROW_MASK;
+    }
+    else
+    {
+      start = rows[row];
+      end   = rows[row+1];
+    }
+
+    // Keep a row that the checks could not correct in range
+    if (MODE != ECC_NONE && end > nnz)
+      end = nnz;
+
+    double tmp = 0.0;
+    for (uint i = start; i < end; i++)
+    {
+      double value  = values[i];
+      uint   column = cols[i];
+      if (MODE != ECC_NONE && check)
+      {
+        ulong bits = as_ulong(value);
+        uint d0 = (uint)bits, d1 = (uint)(bits >> 32), d2 = column;
+        check_element(cols, values, i, &d0, &d1, &d2, errors);
+        value  = as_double(upsample(d1, d0));
+        column = d2;
+      }
+
+      // Mask out ECC from high order column bits, and skip an index that
+      // the checks could not correct
+      uint col = column & COLUMN_MASK;
+      if (MODE != ECC_NONE && col >= N)
+        continue;
+
+      tmp += value * vec[col];
+    }
+
+    result[row] = tmp;
+    ret += tmp * vec[row];
+  }
+
+  ret = reduce(ret, scratch);
+  if (get_local_id(0) == 0)
+    partial[get_group_id(0)] = ret;
+}
+
+// Flip bit (numbered as in a csr_element) of element i
+__kernel void flip_bit(__global uint *cols, __global uint *values, uint i,
+                       uint bit)
 {
-  // TODO: initialize OpenCL context
+  if (bit < 64)
+    values[2*i + bit/32] ^= 0x1U << (bit % 32);
+  else
+    cols[i] ^= 0x1U << (bit % 32);
+}
+)";
+
+static void check_error(cl_int err, const char *op)
+{
+  if (err != CL_SUCCESS)
+  {
+    printf("OpenCL error %d during %s\n", err, op);
+    exit(1);
+  }
+}
+
+OCLContext::OCLContext(ECCMode mode)
+{
+  this->mode = mode;
+
+  // Use the first device of the first platform that has one
+  cl_int err;
+  cl_uint num_platforms = 0;
+  clGetPlatformIDs(0, NULL, &num_platforms);
+  cl_platform_id *platforms = new cl_platform_id[num_platforms];
+  clGetPlatformIDs(num_platforms, platforms, NULL);
+
+  bool found = false;
+  for (cl_uint i = 0; i < num_platforms && !found; i++)
+  {
+    found = clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 1, &device,
+                           NULL) == CL_SUCCESS;
+  }
+  delete[] platforms;
+  if (!found)
+  {
+    printf("No OpenCL devices found\n");
+    exit(1);
+  }
+
+  context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+  check_error(err, "creating context");
+  queue = clCreateCommandQueue(context, device, 0, &err);
+  check_error(err, "creating command queue");
+
+  // The reductions need a power of two
+  size_t max_group_size;
+  err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                        sizeof(max_group_size), &max_group_size, NULL);
+  check_error(err, "querying device");
+  group_size = OCL_GROUP_SIZE;
+  while (group_size > max_group_size)
+    group_size /= 2;
+  num_groups = OCL_NUM_GROUPS;
+
+  const char *sources[] = {ecc_source, kernel_source};
+  program = clCreateProgramWithSource(context, 2, sources, NULL, &err);
+  check_error(err, "creating program");
+
+  uint32_t column_mask = mode == ECC_NONE ? 0xFFFFFFFF : 0x00FFFFFF;
+  std::string options =
+    " -DMODE="                + std::to_string(mode) +
+    " -DECC_NONE="            + std::to_string(ECC_NONE) +
+    " -DECC_SED="             + std::to_string(ECC_SED) +
+    " -DECC_SEC7="            + std::to_string(ECC_SEC7) +
+    " -DECC_SEC8="            + std::to_string(ECC_SEC8) +
+    " -DECC_SECDED="          + std::to_string(ECC_SECDED) +
+    " -DCOLUMN_MASK="         + std::to_string(column_mask) + "U" +
+    " -DGROUP_SIZE="          + std::to_string(group_size) +
+    " -DERROR_CORRECTED="     + std::to_string(ERROR_CORRECTED) +
+    " -DERROR_DETECTED="      + std::to_string(ERROR_DETECTED) +
+    " -DERROR_UNCORRECTABLE=" + std::to_string(ERROR_UNCORRECTABLE) +
+    " -DERROR_ELEMENT="       + std::to_string(ERROR_ELEMENT) +
+    " -DERROR_ROW_POINTER="   + std::to_string(ERROR_ROW_POINTER) +
+    " -DERROR_CAPACITY="      + std::to_string(ERROR_LOG_CAPACITY);
+  err = clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL);
+  if (err == CL_BUILD_PROGRAM_FAILURE)
+  {
+    size_t length;
+    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL,
+                          &length);
+    std::string log(length, '\0');
+    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, length,
+                          &log[0], NULL);
+    printf("Failed to build OpenCL kernels:\n%s\n", log.c_str());
+    exit(1);
+  }
+  check_error(err, "building program");
+
+  k_dot = clCreateKernel(program, "dot", &err);
+  check_error(err, "creating dot kernel");
+  k_calc_xr = clCreateKernel(program, "calc_xr", &err);
+  check_error(err, "creating calc_xr kernel");
+  k_calc_p = clCreateKernel(program, "calc_p", &err);
+  check_error(err, "creating calc_p kernel");
+  k_spmv = clCreateKernel(program, "spmv", &err);
+  check_error(err, "creating spmv kernel");
+  k_flip_bit = clCreateKernel(program, "flip_bit", &err);
+  check_error(err, "creating flip_bit kernel");
+
+  h_partial = new double[2*num_groups];
+  d_partial = clCreateBuffer(context, CL_MEM_READ_WRITE,
+                             2*num_groups*sizeof(double), NULL, &err);
+  check_error(err, "creating partial sums buffer");
+
+  std::vector<cl_uint> errors(2 + 4*ERROR_LOG_CAPACITY, 0);
+  d_errors = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                            errors.size()*sizeof(cl_uint), errors.data(),
+                            &err);
+  check_error(err, "creating error buffer");
+
+  check_interval = 1;
+  spmv_count     = 0;
+  check_result   = NOT_CHECKED;
 }
 
 OCLContext::~OCLContext()
 {
-  // TODO: release OpenCL resources
+  clReleaseMemObject(d_partial);
+  clReleaseMemObject(d_errors);
+  delete[] h_partial;
+
+  clReleaseKernel(k_dot);
+  clReleaseKernel(k_calc_xr);
+  clReleaseKernel(k_calc_p);
+  clReleaseKernel(k_spmv);
+  clReleaseKernel(k_flip_bit);
+  clReleaseProgram(program);
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
 }
 
 cg_matrix* OCLContext::create_matrix(const uint32_t *columns,
@@ -15,73 +458,293 @@ cg_matrix* OCLContext::create_matrix(const uint32_t *columns,
                                      const double *values,
                                      int N, int nnz)
 {
-  // TODO: implement
-  return NULL;
+  if (mode != ECC_NONE && (uint32_t)nnz > ECC_ROW_MASK)
+  {
+    printf("Too many non-zeros to protect the row pointers\n");
+    exit(1);
+  }
+
+  // Encode the matrix on the host, then copy it to the device
+  std::vector<uint32_t> h_cols(nnz), h_rows(N+1);
+  std::vector<double>   h_values(nnz);
+  uint32_t next_row = 0;
+  for (int i = 0; i < nnz; i++)
+  {
+    csr_element element;
+    element.column = columns[i];
+    element.value  = values[i];
+
+    switch (mode)
+    {
+      case ECC_SED:    ecc_generate<ECC_SED>(element);    break;
+      case ECC_SEC7:   ecc_generate<ECC_SEC7>(element);   break;
+      case ECC_SEC8:   ecc_generate<ECC_SEC8>(element);   break;
+      case ECC_SECDED: ecc_generate<ECC_SECDED>(element); break;
+      default:         break;
+    }
+
+    h_cols[i]   = element.column;
+    h_values[i] = element.value;
+
+    while (next_row <= rows[i])
+    {
+      h_rows[next_row++] = mode != ECC_NONE ? ecc_encode_row(i) : i;
+    }
+  }
+  h_rows[N] = mode != ECC_NONE ? ecc_encode_row(nnz) : nnz;
+
+  cl_int err;
+  cg_matrix *M = new cg_matrix;
+  M->N      = N;
+  M->nnz    = nnz;
+  M->cols   = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                             nnz*sizeof(uint32_t), h_cols.data(), &err);
+  check_error(err, "creating matrix columns");
+  M->rows   = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                             (N+1)*sizeof(uint32_t), h_rows.data(), &err);
+  check_error(err, "creating matrix rows");
+  M->values = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                             nnz*sizeof(double), h_values.data(), &err);
+  check_error(err, "creating matrix values");
+  return M;
 }
 
 void OCLContext::destroy_matrix(cg_matrix *mat)
 {
-  // TODO: implement
+  clReleaseMemObject(mat->cols);
+  clReleaseMemObject(mat->rows);
+  clReleaseMemObject(mat->values);
+  delete mat;
 }
 
 cg_vector* OCLContext::create_vector(int N)
 {
-  // TODO: implement
-  return NULL;
+  cl_int err;
+  cg_vector *result = new cg_vector;
+  result->N    = N;
+  result->data = clCreateBuffer(context, CL_MEM_READ_WRITE, N*sizeof(double),
+                                NULL, &err);
+  check_error(err, "creating vector");
+  return result;
 }
 
 void OCLContext::destroy_vector(cg_vector *vec)
 {
-  // TODO: implement
+  clReleaseMemObject(vec->data);
+  delete vec;
 }
 
 double* OCLContext::map_vector(cg_vector *v)
 {
-  // TODO: implement
-  return NULL;
+  cl_int err;
+  double *h = (double*)clEnqueueMapBuffer(queue, v->data, CL_TRUE,
+                                          CL_MAP_READ | CL_MAP_WRITE,
+                                          0, v->N*sizeof(double),
+                                          0, NULL, NULL, &err);
+  check_error(err, "mapping vector");
+  return h;
 }
 
 void OCLContext::unmap_vector(cg_vector *v, double *h)
 {
-  // TODO: implement
+  cl_int err = clEnqueueUnmapMemObject(queue, v->data, h, 0, NULL, NULL);
+  check_error(err, "unmapping vector");
 }
 
 void OCLContext::copy_vector(cg_vector *dst, const cg_vector *src)
 {
-  // TODO: implement
+  cl_int err = clEnqueueCopyBuffer(queue, src->data, dst->data, 0, 0,
+                                   dst->N*sizeof(double), 0, NULL, NULL);
+  check_error(err, "copying vector");
+}
+
+// Run kernel over every work-group, with its arguments already set
+void OCLContext::run(cl_kernel kernel)
+{
+  size_t global = group_size*num_groups;
+  cl_int err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global,
+                                      &group_size, 0, NULL, NULL);
+  check_error(err, "running kernel");
+}
+
+// Add up the partial sums left by the last kernel, and the second set after
+// them if second is given
+double OCLContext::sum_partial(unsigned num_sums, double *second)
+{
+  cl_int err = clEnqueueReadBuffer(queue, d_partial, CL_TRUE, 0,
+                                   num_sums*num_groups*sizeof(double),
+                                   h_partial, 0, NULL, NULL);
+  check_error(err, "reading partial sums");
+
+  double ret = 0.0;
+  for (unsigned g = 0; g < num_groups; g++)
+    ret += h_partial[g];
+  if (second)
+  {
+    *second = 0.0;
+    for (unsigned g = 0; g < num_groups; g++)
+      *second += h_partial[num_groups + g];
+  }
+  return ret;
 }
 
 double OCLContext::dot(const cg_vector *a, const cg_vector *b)
 {
-  // TODO: implement
-  return 0.0;
+  cl_uint N = a->N;
+  clSetKernelArg(k_dot, 0, sizeof(cl_mem), &a->data);
+  clSetKernelArg(k_dot, 1, sizeof(cl_mem), &b->data);
+  clSetKernelArg(k_dot, 2, sizeof(cl_uint), &N);
+  clSetKernelArg(k_dot, 3, sizeof(cl_mem), &d_partial);
+  run(k_dot);
+  return sum_partial(1);
 }
 
 double OCLContext::calc_xr(cg_vector *x, cg_vector *r,
                            const cg_vector *p, const cg_vector *w,
                            double alpha)
 {
-  // TODO: implement
-  return 0.0;
+  double wr;
+  return calc_xr_wr(x, r, p, w, alpha, &wr);
+}
+
+double OCLContext::calc_xr_wr(cg_vector *x, cg_vector *r,
+                              const cg_vector *p, const cg_vector *w,
+                              double alpha, double *wr)
+{
+  cl_uint N = x->N;
+  clSetKernelArg(k_calc_xr, 0, sizeof(cl_mem), &x->data);
+  clSetKernelArg(k_calc_xr, 1, sizeof(cl_mem), &r->data);
+  clSetKernelArg(k_calc_xr, 2, sizeof(cl_mem), &p->data);
+  clSetKernelArg(k_calc_xr, 3, sizeof(cl_mem), &w->data);
+  clSetKernelArg(k_calc_xr, 4, sizeof(double), &alpha);
+  clSetKernelArg(k_calc_xr, 5, sizeof(cl_uint), &N);
+  clSetKernelArg(k_calc_xr, 6, sizeof(cl_mem), &d_partial);
+  run(k_calc_xr);
+  return sum_partial(2, wr);
 }
 
 void OCLContext::calc_p(cg_vector *p, const cg_vector *r, double beta)
 {
-  // TODO: implement
+  cl_uint N = p->N;
+  clSetKernelArg(k_calc_p, 0, sizeof(cl_mem), &p->data);
+  clSetKernelArg(k_calc_p, 1, sizeof(cl_mem), &r->data);
+  clSetKernelArg(k_calc_p, 2, sizeof(double), &beta);
+  clSetKernelArg(k_calc_p, 3, sizeof(cl_uint), &N);
+  run(k_calc_p);
 }
 
 void OCLContext::spmv(const cg_matrix *mat, const cg_vector *vec,
                       cg_vector *result)
 {
-  // TODO: implement
+  spmv_dot(mat, vec, result);
+}
+
+double OCLContext::spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                            cg_vector *result)
+{
+  // Skip the checks on all but every check_interval'th call
+  cl_uint check = ++spmv_count >= check_interval;
+  if (check)
+    spmv_count = 0;
+
+  cl_uint N = mat->N, nnz = mat->nnz;
+  clSetKernelArg(k_spmv, 0, sizeof(cl_mem), &mat->rows);
+  clSetKernelArg(k_spmv, 1, sizeof(cl_mem), &mat->cols);
+  clSetKernelArg(k_spmv, 2, sizeof(cl_mem), &mat->values);
+  clSetKernelArg(k_spmv, 3, sizeof(cl_uint), &N);
+  clSetKernelArg(k_spmv, 4, sizeof(cl_uint), &nnz);
+  clSetKernelArg(k_spmv, 5, sizeof(cl_uint), &check);
+  clSetKernelArg(k_spmv, 6, sizeof(cl_mem), &vec->data);
+  clSetKernelArg(k_spmv, 7, sizeof(cl_mem), &result->data);
+  clSetKernelArg(k_spmv, 8, sizeof(cl_mem), &d_partial);
+  clSetKernelArg(k_spmv, 9, sizeof(cl_mem), &d_errors);
+  run(k_spmv);
+  double ret = sum_partial(1);
+
+  check_result = NOT_CHECKED;
+  if (check)
+  {
+    check_result = CHECK_PASSED;
+    take_device_errors();
+  }
+  return ret;
+}
+
+// Copy the errors that the spmv kernel recorded into the error log, and
+// clear them, noting whether any were corrected
+void OCLContext::take_device_errors()
+{
+  cl_uint header[2];
+  cl_int err = clEnqueueReadBuffer(queue, d_errors, CL_TRUE, 0,
+                                   sizeof(header), header, 0, NULL, NULL);
+  check_error(err, "reading errors");
+  if (!header[0])
+    return;
+
+  cl_uint num_events = header[0] < ERROR_LOG_CAPACITY ? header[0]
+                                                      : ERROR_LOG_CAPACITY;
+  std::vector<cl_uint> events(4*num_events);
+  err = clEnqueueReadBuffer(queue, d_errors, CL_TRUE, sizeof(header),
+                            events.size()*sizeof(cl_uint), events.data(),
+                            0, NULL, NULL);
+  check_error(err, "reading errors");
+  for (cl_uint e = 0; e < num_events; e++)
+  {
+    error_log.record((ErrorKind)events[4*e], (ErrorSource)events[4*e+1],
+                     events[4*e+2], (int)events[4*e+3]);
+  }
+  if (header[1])
+    check_result = CHECK_CORRECTED;
+
+  header[0] = header[1] = 0;
+  err = clEnqueueWriteBuffer(queue, d_errors, CL_TRUE, 0, sizeof(header),
+                             header, 0, NULL, NULL);
+  check_error(err, "clearing errors");
 }
 
 void OCLContext::inject_bitflip(cg_matrix *mat, BitFlipKind kind, int num_flips)
 {
-  // TODO: implement
+  cl_uint index = rand() % mat->nnz;
+
+  int start = 0;
+  int end   = 96;
+  if (kind == VALUE)
+    end = 64;
+  else if (kind == INDEX)
+    start = 64;
+
+  clSetKernelArg(k_flip_bit, 0, sizeof(cl_mem), &mat->cols);
+  clSetKernelArg(k_flip_bit, 1, sizeof(cl_mem), &mat->values);
+  clSetKernelArg(k_flip_bit, 2, sizeof(cl_uint), &index);
+  for (int i = 0; i < num_flips; i++)
+  {
+    cl_uint bit = (rand() % (end-start)) + start;
+    printf("*** flipping bit %u at index %u ***\n", bit, index);
+
+    clSetKernelArg(k_flip_bit, 3, sizeof(cl_uint), &bit);
+    size_t one = 1;
+    cl_int err = clEnqueueNDRangeKernel(queue, k_flip_bit, 1, NULL, &one,
+                                        NULL, 0, NULL, NULL);
+    check_error(err, "flipping bit");
+  }
+  clFinish(queue);
+}
+
+void OCLContext::set_check_interval(int k)
+{
+  check_interval = k;
+}
+
+CGContext::CheckResult OCLContext::last_check()
+{
+  return check_result;
 }
 
 namespace
 {
-  static CGContext::Register<OCLContext> A("ocl", "none");
+  static CGContext::Register< OCLModeContext<ECC_NONE> >   A("ocl", "none");
+  static CGContext::Register< OCLModeContext<ECC_SED> >    B("ocl", "sed");
+  static CGContext::Register< OCLModeContext<ECC_SEC7> >   C("ocl", "sec7");
+  static CGContext::Register< OCLModeContext<ECC_SEC8> >   D("ocl", "sec8");
+  static CGContext::Register< OCLModeContext<ECC_SECDED> > E("ocl", "secded");
 }
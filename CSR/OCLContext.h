@@ -1,5 +1,8 @@
 #include "CGContext.h"
 
+#include "ecc.h"
+
+#define CL_TARGET_OPENCL_VERSION 120
 #ifdef __APPLE__
   #include <OpenCL/cl.h>
 #else
@@ -21,10 +24,14 @@ struct cg_matrix
   cl_mem values;
 };
 
+// CSR context that runs the solver's kernels on an OpenCL device, with the
+// matrix encoded as in the cpu contexts' SplitLayout. The checks in the spmv
+// kernel record the errors they find in a buffer on the device, which the
+// host copies into the error log after each spmv.
 class OCLContext : public CGContext
 {
 public:
-  OCLContext();
+  OCLContext(ECCMode mode);
   virtual ~OCLContext();
 
   virtual cg_matrix* create_matrix(const uint32_t *columns,
@@ -43,10 +50,60 @@ public:
   virtual double calc_xr(cg_vector *x, cg_vector *r,
                          const cg_vector *p, const cg_vector *w,
                          double alpha);
+  virtual double calc_xr_wr(cg_vector *x, cg_vector *r,
+                            const cg_vector *p, const cg_vector *w,
+                            double alpha, double *wr);
   virtual void calc_p(cg_vector *p, const cg_vector *r, double beta);
 
   virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
                     cg_vector *result);
+  virtual double spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                          cg_vector *result);
 
   virtual void inject_bitflip(cg_matrix *mat, BitFlipKind kind, int num_flips);
+
+  virtual void set_check_interval(int k);
+  virtual CheckResult last_check();
+
+private:
+  ECCMode mode;
+
+  cl_device_id     device;
+  cl_context       context;
+  cl_command_queue queue;
+  cl_program       program;
+
+  cl_kernel k_dot;
+  cl_kernel k_calc_xr;
+  cl_kernel k_calc_p;
+  cl_kernel k_spmv;
+  cl_kernel k_flip_bit;
+
+  // Work-group size and number of work-groups that every kernel runs with
+  size_t group_size;
+  size_t num_groups;
+
+  // One partial sum (or two, for calc_xr) per work-group
+  cl_mem  d_partial;
+  double *h_partial;
+
+  // Errors found by the spmv kernel (see the kernel source)
+  cl_mem  d_errors;
+
+  // Periodic checking state
+  int         check_interval;
+  int         spmv_count;
+  CheckResult check_result;
+
+  void   run(cl_kernel kernel);
+  double sum_partial(unsigned num_sums, double *second = NULL);
+  void   take_device_errors();
+};
+
+// OCLContext for an ECC mode, registered as "ocl-<mode>"
+template<ECCMode M>
+class OCLModeContext : public OCLContext
+{
+public:
+  OCLModeContext() : OCLContext(M) {}
 };
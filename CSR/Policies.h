@@ -0,0 +1,155 @@
+#ifndef POLICIES_H
+#define POLICIES_H
+
+#include "ecc.h"
+
+#include <string>
+
+// Matrix checking policies for PolicyContext. A policy provides:
+//   name()         - the mode it is registered as
+//   checks         - whether it checks anything
+//   row_ecc        - whether the row pointers carry ECC bits
+//   column_mask    - the bits of a column index that hold the index itself
+//   generate()     - add the check bits to a new element
+//   check()        - check (and correct in place) element i, returning 1 if
+//                    it was corrected
+//   check_row()    - check the (corrected) row pointers of a row
+//   check_column() - check the (corrected) column index of element i, given
+//                    the column of the element before it in the row, if any
+// The checks record the errors they find in an ErrorLog and carry on, so the
+// kernel must keep whatever they could not correct in range. A policy that
+// checks nothing leaves the indices unguarded, as without checking.
+
+template<ECCMode mode>
+struct ElementECC
+{
+  static const char *name()
+  {
+    switch (mode)
+    {
+      case ECC_NONE: return "none";
+      case ECC_SED:  return "sed";
+      case ECC_SEC7: return "sec7";
+      case ECC_SEC8: return "sec8";
+      default:       return "secded";
+    }
+  }
+
+  static const bool     checks      = mode != ECC_NONE;
+  static const bool     row_ecc     = mode != ECC_NONE;
+  static const uint32_t column_mask = mode == ECC_NONE ? 0xFFFFFFFF
+                                                       : 0x00FFFFFF;
+
+  static inline void generate(csr_element& element)
+  {
+    ecc_generate<mode>(element);
+  }
+
+  static inline unsigned check(csr_element& element, uint32_t i,
+                               ErrorLog& log)
+  {
+    return ecc_check<mode>(element, i, log);
+  }
+
+  static inline void check_row(uint32_t row, uint32_t start, uint32_t end,
+                               uint32_t nnz, ErrorLog& log)
+  {
+  }
+
+  static inline void check_column(uint32_t i, uint32_t col, uint32_t prev,
+                                  bool first, uint32_t N, ErrorLog& log)
+  {
+  }
+};
+
+typedef ElementECC<ECC_NONE>   None;
+typedef ElementECC<ECC_SED>    SED;
+typedef ElementECC<ECC_SEC7>   SEC7;
+typedef ElementECC<ECC_SEC8>   SEC8;
+typedef ElementECC<ECC_SECDED> SECDED;
+
+// Check that the indices describe a valid, sorted matrix
+struct Constraints
+{
+  static const char *name()
+  {
+    return "constraints";
+  }
+
+  static const bool     checks      = true;
+  static const bool     row_ecc     = false;
+  static const uint32_t column_mask = 0xFFFFFFFF;
+
+  static inline void generate(csr_element& element)
+  {
+  }
+
+  static inline unsigned check(csr_element& element, uint32_t i,
+                               ErrorLog& log)
+  {
+    return 0;
+  }
+
+  // Rows that end past the last element or before they start
+  static inline void check_row(uint32_t row, uint32_t start, uint32_t end,
+                               uint32_t nnz, ErrorLog& log)
+  {
+    if (end > nnz || end < start)
+      log.record(ERROR_DETECTED, ERROR_ROW_CONSTRAINT, row);
+  }
+
+  // Columns outside the matrix, or out of order (reported at the
+  // element before, which may be the corrupted one, unless it has already
+  // been reported as outside the matrix)
+  static inline void check_column(uint32_t i, uint32_t col, uint32_t prev,
+                                  bool first, uint32_t N, ErrorLog& log)
+  {
+    if (col >= N)
+      log.record(ERROR_DETECTED, ERROR_COLUMN_CONSTRAINT, i);
+    else if (!first && col <= prev && prev < N)
+      log.record(ERROR_DETECTED, ERROR_COLUMN_CONSTRAINT, i-1);
+  }
+};
+
+// Apply both P and Q, registered as "P+Q"
+template<class P, class Q>
+struct Combined
+{
+  static const char *name()
+  {
+    static const std::string name = std::string(P::name()) + "+" + Q::name();
+    return name.c_str();
+  }
+
+  static const bool     checks      = P::checks || Q::checks;
+  static const bool     row_ecc     = P::row_ecc || Q::row_ecc;
+  static const uint32_t column_mask = P::column_mask & Q::column_mask;
+
+  static inline void generate(csr_element& element)
+  {
+    P::generate(element);
+    Q::generate(element);
+  }
+
+  static inline unsigned check(csr_element& element, uint32_t i,
+                               ErrorLog& log)
+  {
+    return P::check(element, i, log) + Q::check(element, i, log);
+  }
+
+  static inline void check_row(uint32_t row, uint32_t start, uint32_t end,
+                               uint32_t nnz, ErrorLog& log)
+  {
+    P::check_row(row, start, end, nnz, log);
+    Q::check_row(row, start, end, nnz, log);
+  }
+
+  static inline void check_column(uint32_t i, uint32_t col, uint32_t prev,
+                                  bool first, uint32_t N, ErrorLog& log)
+  {
+    P::check_column(i, col, prev, first, N, log);
+    Q::check_column(i, col, prev, first, N, log);
+  }
+};
+
+#endif // POLICIES_H
@@ -0,0 +1,159 @@
+#include "CPUContext.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+// Number of rows whose elements are checked together before the multiply
+#define SIMD_ROW_BLOCK 64
+
+// Hamming masks for the 64 value bits (high word in the upper half) and for
+// the 32 column bits of a csr_element, in the order of the parity bits
+static const uint64_t ECC7_VALUE_MASKS[7] =
+{
+  ((uint64_t)ECC7_P1_1 << 32) | ECC7_P1_0,
+  ((uint64_t)ECC7_P2_1 << 32) | ECC7_P2_0,
+  ((uint64_t)ECC7_P3_1 << 32) | ECC7_P3_0,
+  ((uint64_t)ECC7_P4_1 << 32) | ECC7_P4_0,
+  ((uint64_t)ECC7_P5_1 << 32) | ECC7_P5_0,
+  ((uint64_t)ECC7_P6_1 << 32) | ECC7_P6_0,
+  ((uint64_t)ECC7_P7_1 << 32) | ECC7_P7_0,
+};
+static const uint64_t ECC7_COLUMN_MASKS[7] =
+{
+  ECC7_P1_2, ECC7_P2_2, ECC7_P3_2, ECC7_P4_2, ECC7_P5_2, ECC7_P6_2, ECC7_P7_2,
+};
+
+// Scalar check (and correction) of a single matrix element, used for the
+// elements that a vector check has flagged. Returns 1 if it was corrected.
+template<ECCMode mode>
+static unsigned check_element(const cg_matrix *mat, uint32_t i, ErrorLog& log)
+{
+  csr_element element;
+  element.value  = mat->values[i];
+  element.column = mat->cols[i];
+
+  if (!ecc_check<mode>(element, i, log))
+    return 0;
+
+  mat->cols[i] = element.column;
+  mat->values[i] = element.value;
+  return 1;
+}
+
+// CSR context that checks the elements of a block of rows with a vector
+// Checker before multiplying them, falling back to the scalar check only for
+// the elements that the Checker flags.
+//
+// A Checker provides:
+//   mode        - the ECCMode it checks for
+//   width       - number of consecutive elements checked per call
+//   supported() - whether the host CPU can run it
+//   check()     - a bitmask of the elements that need a closer look
+template<class Base, class Checker>
+class SIMDContext : public Base
+{
+public:
+  SIMDContext()
+  {
+    if (!Checker::supported())
+    {
+      printf("Instruction set not supported by this CPU\n");
+      exit(1);
+    }
+  }
+
+  virtual double checked_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                  cg_vector *result)
+  {
+    return this->spmv_guarded() ? checked_kernel<true>(mat, vec, result)
+                                : checked_kernel<false>(mat, vec, result);
+  }
+
+  // The kernel, instantiated with and without the guards of protected
+  // vectors (see CPUContext::spmv_guarded)
+  template<bool guarded>
+  double checked_kernel(const cg_matrix *mat, const cg_vector *vec,
+                        cg_vector *result)
+  {
+    double ret = 0.0;
+    unsigned corrected = 0;
+#pragma omp parallel reduction(+:ret,corrected)
+    {
+      // Private copies of the matrix and vector descriptors, which
+      // recording an error cannot change, so that the compiler does not
+      // reload them for every element
+      const cg_matrix M = *mat;
+      const double   *x = this->gather_vector(vec);
+      checksum_gather x_sums = this->gather_checksums();
+      checksum_rows   y_sums = this->result_checksums();
+      const unsigned  chunks = this->num_chunks(M.N);
+
+#pragma omp for
+      for (unsigned c = 0; c < chunks; c++)
+      {
+        unsigned first, last;
+        this->chunk_rows(c, M.N, &first, &last);
+        if (guarded)
+          gather_rows(x_sums, &M, first, last);
+
+        for (unsigned block = first; block < last; block += SIMD_ROW_BLOCK)
+        {
+          unsigned block_last = block + SIMD_ROW_BLOCK;
+          if (block_last > last)
+            block_last = last;
+
+          // Check every element in this block of rows (the row loop below
+          // owns the row pointers)
+          uint32_t i   = load_row_pointer(&M, block, false, corrected,
+                                          this->error_log);
+          uint32_t end = load_row_pointer(&M, block_last, false, corrected,
+                                          this->error_log);
+          for (; i + Checker::width <= end; i += Checker::width)
+          {
+            uint32_t dirty = Checker::check(M.values+i, M.cols+i);
+            while (dirty)
+            {
+              uint32_t lane = __builtin_ctz(dirty);
+              corrected += check_element<Checker::mode>(&M, i + lane,
+                                                        this->error_log);
+              dirty &= dirty - 1;
+            }
+          }
+          for (; i < end; i++)
+          {
+            corrected += check_element<Checker::mode>(&M, i,
+                                                      this->error_log);
+          }
+
+          // Multiply the (now clean) rows
+          for (unsigned row = block; row < block_last; row++)
+          {
+            double tmp = 0.0;
+
+            uint32_t start = load_row_pointer(&M, row, true, corrected,
+                                              this->error_log);
+            uint32_t end   = load_row_pointer(&M, row+1, row+1 == M.N,
+                                              corrected, this->error_log);
+            for (uint32_t i = start; i < end; i++)
+            {
+              // Mask out ECC from high order column bits, and skip an
+              // index that the checks could not correct
+              uint32_t col = M.cols[i] & 0x00FFFFFF;
+              if (col >= M.N)
+                continue;
+
+              tmp += M.values[i] * x[col];
+            }
+
+            result->data[row] = tmp;
+            ret += tmp * x[row];
+          }
+        }
+        if (guarded)
+          y_sums.written(first, last);
+      }
+    }
+    this->num_corrected += corrected;
+    return ret;
+  }
+};
@@ -0,0 +1,205 @@
+#include "CPUContext.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+uint8_t ECC_SYNDROME_TABLE[sizeof(csr_element)][256];
+uint8_t ECC_DECODE_TABLE[128];
+
+static void init_tables()
+{
+  static bool initialized = false;
+  if (initialized)
+    return;
+
+  static const uint32_t masks[7][3] =
+  {
+    {ECC7_P1_0, ECC7_P1_1, ECC7_P1_2},
+    {ECC7_P2_0, ECC7_P2_1, ECC7_P2_2},
+    {ECC7_P3_0, ECC7_P3_1, ECC7_P3_2},
+    {ECC7_P4_0, ECC7_P4_1, ECC7_P4_2},
+    {ECC7_P5_0, ECC7_P5_1, ECC7_P5_2},
+    {ECC7_P6_0, ECC7_P6_1, ECC7_P6_2},
+    {ECC7_P7_0, ECC7_P7_1, ECC7_P7_2},
+  };
+
+  for (unsigned b = 0; b < sizeof(csr_element); b++)
+  {
+    for (uint32_t v = 0; v < 256; v++)
+    {
+      uint8_t entry = __builtin_parity(v) << 7;
+      for (int p = 0; p < 7; p++)
+      {
+        uint32_t mask = (masks[p][b/4] >> (8*(b%4))) & 0xFF;
+        entry |= __builtin_parity(v & mask) << (6-p);
+      }
+      ECC_SYNDROME_TABLE[b][v] = entry;
+    }
+  }
+
+  for (uint32_t s = 1; s < 128; s++)
+  {
+    ECC_DECODE_TABLE[s] = ecc_get_flipped_bit_col8(s << 25);
+  }
+
+  initialized = true;
+}
+
+// Hamming syndrome (in the ecc_compute_col8 format) and overall parity from
+// an ecc_compute_table result
+#define TABLE_SYNDROME(t) (((t) & 0x7F) << 25)
+#define TABLE_PARITY(t)   ((t) >> 7)
+
+// CSR context that encodes, checks and corrects matrix elements with lookup
+// tables instead of masked parity computations
+template<class Base, ECCMode mode>
+class TableContext : public Base
+{
+public:
+  TableContext()
+  {
+    init_tables();
+  }
+
+  virtual void generate_ecc_bits(csr_element& element)
+  {
+    uint32_t t = ecc_compute_table(element);
+    if (mode == ECC_SED)
+    {
+      element.column |= TABLE_PARITY(t) << 31;
+      return;
+    }
+
+    element.column |= TABLE_SYNDROME(t);
+    if (mode != ECC_SEC7)
+      element.column |= TABLE_PARITY(ecc_compute_table(element)) << 24;
+  }
+
+  virtual double checked_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                  cg_vector *result)
+  {
+    return this->spmv_guarded() ? checked_kernel<true>(mat, vec, result)
+                                : checked_kernel<false>(mat, vec, result);
+  }
+
+  // The kernel, instantiated with and without the guards of protected
+  // vectors (see CPUContext::spmv_guarded)
+  template<bool guarded>
+  double checked_kernel(const cg_matrix *mat, const cg_vector *vec,
+                        cg_vector *result)
+  {
+    // Which bits of the table lookup this mode acts on
+    const uint32_t check_mask = mode == ECC_SEC7   ? 0x7F :
+                                mode == ECC_SECDED ? 0xFF : 0x80;
+
+    double ret = 0.0;
+    unsigned corrected = 0;
+#pragma omp parallel reduction(+:ret,corrected)
+    {
+      const double   *x = this->gather_vector(vec);
+      checksum_gather x_sums = this->gather_checksums();
+      checksum_rows   y_sums = this->result_checksums();
+      const unsigned  chunks = this->num_chunks(mat->N);
+
+#pragma omp for
+      for (unsigned c = 0; c < chunks; c++)
+      {
+        unsigned first, last;
+        this->chunk_rows(c, mat->N, &first, &last);
+        if (guarded)
+          gather_rows(x_sums, mat, first, last);
+
+        for (unsigned row = first; row < last; row++)
+        {
+          double tmp = 0.0;
+
+          uint32_t start = load_row_pointer(mat, row, true, corrected,
+                                            this->error_log);
+          uint32_t end   = load_row_pointer(mat, row+1, row+1 == mat->N,
+                                            corrected, this->error_log);
+          for (uint32_t i = start; i < end; i++)
+          {
+            csr_element element;
+            element.value  = mat->values[i];
+            element.column = mat->cols[i];
+
+            uint32_t t = ecc_compute_table(element);
+            if (t & check_mask)
+              corrected += correct_element(mat, i, element, t,
+                                           this->error_log);
+
+            // Mask out ECC from high order column bits, and skip an index
+            // that could not be corrected
+            element.column &= 0x00FFFFFF;
+            if (element.column >= mat->N)
+              continue;
+
+            tmp += element.value * x[element.column];
+          }
+
+          result->data[row] = tmp;
+          ret += tmp * x[row];
+        }
+        if (guarded)
+          y_sums.written(first, last);
+      }
+    }
+    this->num_corrected += corrected;
+    return ret;
+  }
+
+private:
+  // Handles an element whose check failed, returning 1 if it was corrected
+  static unsigned correct_element(const cg_matrix *mat, uint32_t i,
+                                  csr_element& element, uint32_t t,
+                                  ErrorLog& log)
+  {
+    if (mode == ECC_SED)
+    {
+      log.record(ERROR_DETECTED, ERROR_ELEMENT, i);
+      return 0;
+    }
+
+    uint32_t syndrome = TABLE_SYNDROME(t);
+    if (mode == ECC_SECDED && !TABLE_PARITY(t))
+    {
+      // Overall parity fine but error in syndrome
+      // Must be double-bit error - cannot correct this
+      log.record(ERROR_UNCORRECTABLE, ERROR_ELEMENT, i);
+      return 0;
+    }
+
+    if (syndrome)
+    {
+      // Unflip bit
+      uint32_t bit = ecc_get_flipped_bit_table(syndrome);
+      ecc_flip_bit(&element, bit);
+
+      log.record(ERROR_CORRECTED, ERROR_ELEMENT, i, bit);
+    }
+    else
+    {
+      // Correct overall parity bit
+      element.column ^= 0x1U << 24;
+
+      log.record(ERROR_CORRECTED, ERROR_ELEMENT, i,
+                 8*offsetof(csr_element, column) + 24);
+    }
+    mat->cols[i] = element.column;
+    mat->values[i] = element.value;
+
+    return 1;
+  }
+};
+
+namespace
+{
+  static CGContext::Register< TableContext<CPUContext_SED, ECC_SED> >
+    A("table", "sed");
+  static CGContext::Register< TableContext<CPUContext_SEC7, ECC_SEC7> >
+    B("table", "sec7");
+  static CGContext::Register< TableContext<CPUContext_SEC8, ECC_SEC8> >
+    C("table", "sec8");
+  static CGContext::Register< TableContext<CPUContext_SECDED, ECC_SECDED> >
+    D("table", "secded");
+}
@@ -2,7 +2,12 @@
 #define ECC_H
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+#include "ErrorLog.h"
 
 typedef struct
 {
@@ -10,6 +15,8 @@ typedef struct
   uint32_t column;
 } __attribute__((packed)) csr_element;
 
+enum ECCMode {ECC_NONE, ECC_SED, ECC_SEC7, ECC_SEC8, ECC_SECDED};
+
 #define ECC7_P1_0 0x56AAAD5B
 #define ECC7_P1_1 0xAB555555
 #define ECC7_P1_2 0x80AAAAAA
@@ -50,7 +57,8 @@ typedef struct
 // an error occured.
 static inline uint32_t ecc_compute_col8(csr_element colval)
 {
-  uint32_t *data = (uint32_t*)&colval;
+  uint32_t data[3];
+  memcpy(data, &colval, sizeof(data));
 
   uint32_t result = 0;
 
@@ -88,10 +96,21 @@ static inline int is_power_of_2(uint32_t x)
 // Compute the overall parity of a 96-bit matrix element
 static inline uint32_t ecc_compute_overall_parity(csr_element colval)
 {
-  uint32_t *data = (uint32_t*)&colval;
+  uint32_t data[3];
+  memcpy(data, &colval, sizeof(data));
   return __builtin_parity(data[0] ^ data[1] ^ data[2]);
 }
 
+// Flip a single bit of a matrix element (going through memcpy so that the
+// compiler cannot assume the value field is unchanged)
+static inline void ecc_flip_bit(csr_element *element, uint32_t bit)
+{
+  uint32_t data[sizeof(csr_element)/4];
+  memcpy(data, element, sizeof(data));
+  data[bit/32] ^= 0x1U << (bit % 32);
+  memcpy(element, data, sizeof(data));
+}
+
 // This function will use the error 'syndrome' generated from a 7-bit parity
 // check to determine the index of the bit that has been flipped
 static inline uint32_t ecc_get_flipped_bit_col8(uint32_t syndrome)
@@ -112,4 +131,180 @@ static inline uint32_t ecc_get_flipped_bit_col8(uint32_t syndrome)
   return data_bit;
 }
 
+// Row pointers are protected by a SECDED code of their own. The pointer
+// value takes the low 26 bits, the overall parity bit 26 and the 5 Hamming
+// bits the high order bits 27 to 31.
+#define ECC_ROW_MASK 0x03FFFFFF
+
+#define ECC_ROW_P1 0x0AAAAD5B
+#define ECC_ROW_P2 0x1333366D
+#define ECC_ROW_P3 0x23C3C78E
+#define ECC_ROW_P4 0x43FC07F0
+#define ECC_ROW_P5 0x83FFF800
+
+// Compute the Hamming syndrome of a row pointer (P1 in bit 0)
+static inline uint32_t ecc_compute_row_syndrome(uint32_t ptr)
+{
+  return __builtin_parity(ptr & ECC_ROW_P1) << 0 |
+         __builtin_parity(ptr & ECC_ROW_P2) << 1 |
+         __builtin_parity(ptr & ECC_ROW_P3) << 2 |
+         __builtin_parity(ptr & ECC_ROW_P4) << 3 |
+         __builtin_parity(ptr & ECC_ROW_P5) << 4;
+}
+
+// Per-byte contributions to the row pointer check (see CPUContext.cpp), with
+// the Hamming syndrome in bits 0-4 and the overall parity in bit 5, so that
+// clean pointers can be recognised with a few lookups
+extern uint8_t ECC_ROW_TABLE[4][256];
+
+// Add the ECC bits to a row pointer
+static inline uint32_t ecc_encode_row(uint32_t ptr)
+{
+  ptr |= ecc_compute_row_syndrome(ptr) << 27;
+  ptr |= __builtin_parity(ptr) << 26;
+  return ptr;
+}
+
+// Returned by ecc_correct_row for a double-bit error
+#define ECC_ROW_UNCORRECTABLE -2
+
+// Check a row pointer, correcting it in place. Returns the index of the
+// corrected bit, -1 if it was clean, or ECC_ROW_UNCORRECTABLE.
+static inline int ecc_correct_row(uint32_t& ptr)
+{
+  uint32_t check = ECC_ROW_TABLE[0][ptr       & 0xFF] ^
+                   ECC_ROW_TABLE[1][ptr >>  8 & 0xFF] ^
+                   ECC_ROW_TABLE[2][ptr >> 16 & 0xFF] ^
+                   ECC_ROW_TABLE[3][ptr >> 24];
+  if (!check)
+    return -1;
+
+  uint32_t syndrome = check & 0x1F;
+  uint32_t overall_parity = check >> 5;
+  if (!overall_parity)
+  {
+    return syndrome ? ECC_ROW_UNCORRECTABLE : -1;
+  }
+
+  int bit = 26;
+  if (is_power_of_2(syndrome))
+    bit = 27 + __builtin_ctz(syndrome);
+  else if (syndrome)
+    bit = syndrome - (32-__builtin_clz(syndrome)) - 1;
+
+  ptr ^= 0x1U << bit;
+  return bit;
+}
+
+// Generate the ECC bits of a matrix element for the given mode
+template<ECCMode mode>
+static inline void ecc_generate(csr_element& element)
+{
+  if (mode == ECC_SED)
+  {
+    element.column |= ecc_compute_overall_parity(element) << 31;
+  }
+  else if (mode != ECC_NONE)
+  {
+    element.column |= ecc_compute_col8(element);
+    if (mode != ECC_SEC7)
+      element.column |= ecc_compute_overall_parity(element) << 24;
+  }
+}
+
+// Check (and correct in place) a single matrix element for the given mode,
+// recording what it finds in log. Returns 1 if the element was corrected.
+// An element that cannot be corrected is left as it is, so callers must
+// keep its column index in range.
+template<ECCMode mode>
+static inline unsigned ecc_check(csr_element& element, uint32_t i,
+                                 ErrorLog& log)
+{
+  if (mode == ECC_NONE)
+    return 0;
+
+  uint32_t overall_parity = ecc_compute_overall_parity(element);
+  if (mode == ECC_SED)
+  {
+    if (overall_parity)
+      log.record(ERROR_DETECTED, ERROR_ELEMENT, i);
+    return 0;
+  }
+
+  // SEC8 only needs the syndrome when the overall parity is wrong
+  if (mode == ECC_SEC8 && !overall_parity)
+    return 0;
+
+  uint32_t syndrome = ecc_compute_col8(element);
+  if (mode == ECC_SEC7)
+  {
+    if (syndrome)
+    {
+      // Unflip bit
+      uint32_t bit = ecc_get_flipped_bit_col8(syndrome);
+      ecc_flip_bit(&element, bit);
+
+      log.record(ERROR_CORRECTED, ERROR_ELEMENT, i, bit);
+      return 1;
+    }
+    return 0;
+  }
+
+  if (overall_parity)
+  {
+    if (syndrome)
+    {
+      // Unflip bit
+      uint32_t bit = ecc_get_flipped_bit_col8(syndrome);
+      ecc_flip_bit(&element, bit);
+
+      log.record(ERROR_CORRECTED, ERROR_ELEMENT, i, bit);
+    }
+    else
+    {
+      // Correct overall parity bit
+      element.column ^= 0x1U << 24;
+
+      log.record(ERROR_CORRECTED, ERROR_ELEMENT, i,
+                 8*offsetof(csr_element, column) + 24);
+    }
+    return 1;
+  }
+  else if (mode == ECC_SECDED && syndrome)
+  {
+    // Overall parity fine but error in syndrome
+    // Must be double-bit error - cannot correct this
+    log.record(ERROR_UNCORRECTABLE, ERROR_ELEMENT, i);
+  }
+  return 0;
+}
+
+// Lookup tables for the table-driven backend (see TableContext.cpp).
+// ECC_SYNDROME_TABLE[b][v] is the contribution of byte b of an element when it
+// holds the value v, with the 7 Hamming bits in bits 6-0 (P1 in bit 6) and the
+// overall parity in bit 7. ECC_DECODE_TABLE maps a 7-bit Hamming syndrome
+// directly to the index of the flipped bit.
+extern uint8_t ECC_SYNDROME_TABLE[sizeof(csr_element)][256];
+extern uint8_t ECC_DECODE_TABLE[128];
+
+// Table-driven version of ecc_compute_col8 and ecc_compute_overall_parity in
+// a single pass, returning the overall parity in bit 7 and the Hamming
+// syndrome in bits 6-0
+static inline uint32_t ecc_compute_table(csr_element element)
+{
+  uint8_t bytes[sizeof(csr_element)];
+  memcpy(bytes, &element, sizeof(bytes));
+
+  uint32_t result = 0;
+  for (unsigned b = 0; b < sizeof(csr_element); b++)
+    result ^= ECC_SYNDROME_TABLE[b][bytes[b]];
+  return result;
+}
+
+// Table-driven version of ecc_get_flipped_bit_col8
+static inline uint32_t ecc_get_flipped_bit_table(uint32_t syndrome)
+{
+  return ECC_DECODE_TABLE[syndrome >> 25];
+}
+
 #endif // ECC_H
@@ -0,0 +1,143 @@
+#include "ErrorLog.h"
+
+#include <cstdio>
+#include <utility>
+
+// Whether the calling thread records in the background buffer
+static thread_local bool background_thread = false;
+
+// The calling thread's buffer in each log that it has recorded in, by id.
+// Errors are rare, so a linear search is enough.
+static thread_local std::vector< std::pair<unsigned, void*> > thread_logs;
+
+// Source of the ids of the logs
+static std::atomic<unsigned> next_id(1);
+
+ErrorLog::ErrorLog() : background()
+{
+  id        = next_id++;
+  iteration = 0;
+}
+
+ErrorLog::~ErrorLog()
+{
+  for (unsigned t = 0; t < threads.size(); t++)
+    delete threads[t];
+}
+
+ErrorLog::ThreadLog& ErrorLog::thread_log()
+{
+  for (unsigned i = 0; i < thread_logs.size(); i++)
+  {
+    if (thread_logs[i].first == id)
+      return *(ThreadLog*)thread_logs[i].second;
+  }
+
+  ThreadLog *log = new ThreadLog();
+  {
+    std::lock_guard<std::mutex> guard(threads_lock);
+    threads.push_back(log);
+  }
+  thread_logs.push_back(std::make_pair(id, (void*)log));
+  return *log;
+}
+
+void ErrorLog::add(ThreadLog& log, const ErrorEvent& event)
+{
+  log.counts[event.kind]++;
+  if (log.num_events < ERROR_LOG_CAPACITY)
+    log.events[log.num_events++] = event;
+}
+
+void ErrorLog::record(ErrorKind kind, ErrorSource source, uint32_t index,
+                      int bit)
+{
+  ErrorEvent event = {kind, source, iteration, index, bit};
+  if (background_thread)
+  {
+    std::lock_guard<std::mutex> guard(background_lock);
+    add(background, event);
+    return;
+  }
+
+  // Only this thread touches its log while the loop runs
+  add(thread_log(), event);
+}
+
+void ErrorLog::set_background_thread()
+{
+  background_thread = true;
+}
+
+void ErrorLog::set_iteration(int itr)
+{
+  iteration = itr;
+}
+
+unsigned ErrorLog::count(ErrorKind kind) const
+{
+  std::lock_guard<std::mutex> guard(background_lock);
+  std::lock_guard<std::mutex> threads_guard(threads_lock);
+  unsigned total = background.counts[kind];
+  for (unsigned t = 0; t < threads.size(); t++)
+    total += threads[t]->counts[kind];
+  return total;
+}
+
+void ErrorLog::take(std::vector<ErrorEvent>& events)
+{
+  std::lock_guard<std::mutex> guard(background_lock);
+  std::lock_guard<std::mutex> threads_guard(threads_lock);
+  for (unsigned t = 0; t <= threads.size(); t++)
+  {
+    ThreadLog& log = t < threads.size() ? *threads[t] : background;
+    events.insert(events.end(), log.events, log.events + log.num_events);
+    log.num_events = 0;
+  }
+}
+
+void print_error_event(const ErrorEvent& e)
+{
+  switch (e.source)
+  {
+  case ERROR_ELEMENT:
+    if (e.kind == ERROR_CORRECTED && e.bit < 0)
+      printf("[ECC] error detected at index %u, reloaded\n", e.index);
+    else if (e.kind == ERROR_CORRECTED)
+      printf("[ECC] corrected bit %d at index %u\n", e.bit, e.index);
+    else if (e.kind == ERROR_DETECTED)
+      printf("[ECC] error detected at index %u\n", e.index);
+    else
+      printf("[ECC] double-bit error detected at index %u\n", e.index);
+    break;
+  case ERROR_ROW_POINTER:
+    if (e.kind == ERROR_CORRECTED && e.bit < 0)
+      printf("[ECC] double-bit error detected in row pointer %u, reloaded\n",
+             e.index);
+    else if (e.kind == ERROR_CORRECTED)
+      printf("[ECC] corrected bit %d of row pointer %u\n", e.bit, e.index);
+    else
+      printf("[ECC] double-bit error detected in row pointer %u\n", e.index);
+    break;
+  case ERROR_ROW_CONSTRAINT:
+    printf("row constraint violated at %u\n", e.index);
+    break;
+  case ERROR_COLUMN_CONSTRAINT:
+    printf("column constraint violated at index %u\n", e.index);
+    break;
+  case ERROR_MATRIX_CHECKSUM:
+    if (e.kind == ERROR_CORRECTED)
+      printf("[ABFT] recomputed rows from %u\n", e.index);
+    else if (e.index == ERROR_INDEX_NONE)
+      printf("[ABFT] error detected in spmv\n");
+    else
+      printf("[ABFT] error detected in rows from %u\n", e.index);
+    break;
+  case ERROR_VECTOR_CHECKSUM:
+    if (e.kind == ERROR_CORRECTED)
+      printf("[ABFT] corrected vector element %u\n", e.index);
+    else
+      printf("[ABFT] uncorrectable vector error in block %u\n", e.index);
+    break;
+  }
+}
@@ -0,0 +1,112 @@
+//
+// Record of the errors found by a context's checks
+//
+// The checks run inside parallel loops, so rather than printing and exiting
+// there they record an event in a buffer owned by the calling thread, and
+// carry on with the error contained. A thread's buffer is created the first
+// time it records (under a lock), whatever team it is in, so recording only
+// takes a lock once per thread and no two threads ever share a buffer. The
+// driver takes the events once the loop has finished and decides how to
+// recover. Threads that run alongside the loops, such as a scrubber, share
+// one more buffer that is guarded by a lock instead.
+//
+
+#ifndef ERRORLOG_H
+#define ERRORLOG_H
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+// Number of events each thread buffers between calls to take(), beyond which
+// they are only counted
+#define ERROR_LOG_CAPACITY 256
+
+enum ErrorKind
+{
+  ERROR_CORRECTED,     // fixed in place
+  ERROR_DETECTED,      // found by a mode that cannot correct it
+  ERROR_UNCORRECTABLE, // found by a correcting mode, but too many bits flipped
+  NUM_ERROR_KINDS
+};
+
+enum ErrorSource
+{
+  ERROR_ELEMENT,           // a matrix element (or tile), by index
+  ERROR_ROW_POINTER,       // a CSR row pointer, by index
+  ERROR_ROW_CONSTRAINT,    // an invalid row (CSR) or row index (COO)
+  ERROR_COLUMN_CONSTRAINT, // an invalid column index, by element index
+  ERROR_MATRIX_CHECKSUM,   // an spmv result, by first row of a failed block
+  ERROR_VECTOR_CHECKSUM,   // a vector, by element (or block if uncorrectable)
+};
+
+struct ErrorEvent
+{
+  ErrorKind   kind;
+  ErrorSource source;
+  int         iteration;
+  uint32_t    index;
+  int         bit;       // the corrected bit, or -1 (if reloaded)
+};
+
+// Index recorded by a matrix checksum failure that could not be localised
+#define ERROR_INDEX_NONE 0xFFFFFFFF
+
+class ErrorLog
+{
+public:
+  ErrorLog();
+  ~ErrorLog();
+
+  // Record an error found by the calling thread
+  void record(ErrorKind kind, ErrorSource source, uint32_t index,
+              int bit = -1);
+
+  // Iteration to record in the events from now on
+  void set_iteration(int itr);
+
+  // Number of errors of a kind recorded so far
+  unsigned count(ErrorKind kind) const;
+
+  // Append the events recorded since the last call to events, and clear
+  // them. Must not be called while a parallel loop is recording.
+  void take(std::vector<ErrorEvent>& events);
+
+  // Record the calling thread's events in the buffer for background threads
+  static void set_background_thread();
+
+private:
+  struct ThreadLog
+  {
+    ErrorEvent events[ERROR_LOG_CAPACITY];
+    unsigned   num_events;
+    unsigned   counts[NUM_ERROR_KINDS];
+
+    // Keep the counters of neighbouring threads on separate cache lines
+    char padding[64];
+  };
+
+  // Buffer of each thread that has recorded, guarded by threads_lock
+  std::vector<ThreadLog*> threads;
+  mutable std::mutex      threads_lock;
+
+  // Identifies this log to the threads' cached buffers, which may outlive it
+  unsigned id;
+
+  ThreadLog          background;
+  mutable std::mutex background_lock;
+
+  std::atomic<int> iteration;
+
+  ThreadLog& thread_log();
+  static void add(ThreadLog& log, const ErrorEvent& event);
+
+  ErrorLog(const ErrorLog&);
+  ErrorLog& operator=(const ErrorLog&);
+};
+
+// Print an event in the form of the messages that the checks used to print
+void print_error_event(const ErrorEvent& event);
+
+#endif // ERRORLOG_H
@@ -0,0 +1,208 @@
+#include "CGContext.h"
+#include "MatrixCache.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char MAGIC[8] = {'C', 'G', 'M', 'A', 'T', 'R', 'I', 'X'};
+
+static void pad_cache(FILE *file);
+
+// Fletcher-style checksum of the 64-bit words of the arrays (which the
+// alignment pads to a whole number of words)
+static uint64_t checksum(const void *data, size_t size)
+{
+  const uint64_t *words = (const uint64_t*)data;
+  uint64_t a = 0, b = 0;
+  for (size_t i = 0; i < size/sizeof(uint64_t); i++)
+  {
+    a += words[i];
+    b += a;
+  }
+  return a ^ (b << 1 | b >> 63);
+}
+
+// Fill in the fields of a header that describe what the matrix was built
+// from, or return false if the source cannot be found
+static bool describe_source(matrix_cache_header *header, const char *source,
+                            const char *target, const char *mode,
+                            int num_blocks, CGContext *context)
+{
+  struct stat st;
+  if (stat(source, &st))
+    return false;
+
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, MAGIC, sizeof(MAGIC));
+  header->version = MATRIX_CACHE_VERSION;
+  strncpy(header->target, target, sizeof(header->target)-1);
+  strncpy(header->mode, mode, sizeof(header->mode)-1);
+  strncpy(header->format, context->matrix_format(), sizeof(header->format)-1);
+  header->num_blocks   = num_blocks;
+  header->source_size  = st.st_size;
+  header->source_mtime = st.st_mtim.tv_sec*(int64_t)1000000000 +
+                         st.st_mtim.tv_nsec;
+  return true;
+}
+
+matrix_cache* open_matrix_cache(const char *path, const char *source,
+                                const char *target, const char *mode,
+                                int num_blocks, CGContext *context)
+{
+  matrix_cache_header expected;
+  if (!describe_source(&expected, source, target, mode, num_blocks, context))
+    return NULL;
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return NULL;
+
+  matrix_cache_header header;
+  bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+               !memcmp(header.magic, expected.magic, sizeof(MAGIC)) &&
+               header.version == expected.version &&
+               !strncmp(header.target, expected.target,
+                        sizeof(header.target)) &&
+               !strncmp(header.mode, expected.mode, sizeof(header.mode)) &&
+               !strncmp(header.format, expected.format,
+                        sizeof(header.format)) &&
+               header.num_blocks == expected.num_blocks &&
+               header.source_size == expected.source_size &&
+               header.source_mtime == expected.source_mtime &&
+               header.data_size ==
+                 context->matrix_cache_size(header.N, header.nnz);
+
+  struct stat st;
+  valid = valid && !fstat(fileno(file), &st) &&
+          (uint64_t)st.st_size == MATRIX_CACHE_DATA_OFFSET + header.data_size;
+  if (!valid)
+  {
+    printf("Matrix cache '%s' is out of date, rebuilding it\n", path);
+    fclose(file);
+    return NULL;
+  }
+
+  // Private, so that writes to the matrix never reach the file
+  matrix_cache *cache = new matrix_cache;
+  cache->size = st.st_size;
+  cache->map  = mmap(NULL, cache->size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                     fileno(file), 0);
+  fclose(file);
+  if (cache->map == MAP_FAILED)
+  {
+    printf("Failed to map matrix cache '%s'\n", path);
+    exit(1);
+  }
+  cache->data = (char*)cache->map + MATRIX_CACHE_DATA_OFFSET;
+  cache->N    = header.N;
+  cache->nnz  = header.nnz;
+
+  if (checksum(cache->data, header.data_size) != header.checksum)
+  {
+    printf("Matrix cache '%s' is corrupted, rebuilding it\n", path);
+    close_matrix_cache(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+void close_matrix_cache(matrix_cache *cache)
+{
+  munmap(cache->map, cache->size);
+  delete cache;
+}
+
+void write_matrix_cache(const char *path, const char *source,
+                        const char *target, const char *mode,
+                        int num_blocks, CGContext *context,
+                        const cg_matrix *mat, int N, int nnz)
+{
+  matrix_cache_header header;
+  if (!describe_source(&header, source, target, mode, num_blocks, context))
+    return;
+  header.N   = N;
+  header.nnz = nnz;
+
+  // Write to a temporary file and rename it over the cache, so that a run
+  // never sees a partly written one
+  std::string tmp = std::string(path) + ".tmp";
+  FILE *file = fopen(tmp.c_str(), "w+");
+  if (file == NULL)
+  {
+    printf("Failed to create matrix cache '%s'\n", path);
+    exit(1);
+  }
+
+  fseek(file, MATRIX_CACHE_DATA_OFFSET, SEEK_SET);
+  if (!context->save_matrix(mat, file))
+  {
+    printf("Matrix cache not supported by this implementation\n");
+    fclose(file);
+    remove(tmp.c_str());
+    exit(1);
+  }
+  pad_cache(file);
+  header.data_size = ftell(file) - MATRIX_CACHE_DATA_OFFSET;
+  fflush(file);
+
+  void *map = mmap(NULL, MATRIX_CACHE_DATA_OFFSET + header.data_size,
+                   PROT_READ, MAP_SHARED, fileno(file), 0);
+  if (map == MAP_FAILED)
+  {
+    printf("Failed to write matrix cache '%s'\n", path);
+    exit(1);
+  }
+  header.checksum = checksum((char*)map + MATRIX_CACHE_DATA_OFFSET,
+                             header.data_size);
+  munmap(map, MATRIX_CACHE_DATA_OFFSET + header.data_size);
+
+  fseek(file, 0, SEEK_SET);
+  if (fwrite(&header, sizeof(header), 1, file) != 1 || fclose(file) ||
+      rename(tmp.c_str(), path))
+  {
+    printf("Failed to write matrix cache '%s'\n", path);
+    exit(1);
+  }
+}
+
+// Pad file with zeros to the alignment of the arrays
+static void pad_cache(FILE *file)
+{
+  static const char zeros[MATRIX_CACHE_ALIGNMENT] = {0};
+  long offset = ftell(file);
+  long padding = (MATRIX_CACHE_ALIGNMENT - offset % MATRIX_CACHE_ALIGNMENT) %
+                 MATRIX_CACHE_ALIGNMENT;
+  if (fwrite(zeros, 1, padding, file) != (size_t)padding)
+  {
+    printf("Failed to write matrix cache\n");
+    exit(1);
+  }
+}
+
+void write_cache_array(FILE *file, const void *data, size_t size)
+{
+  pad_cache(file);
+  if (fwrite(data, 1, size, file) != size)
+  {
+    printf("Failed to write matrix cache\n");
+    exit(1);
+  }
+}
+
+size_t cache_array_size(size_t size)
+{
+  return (size + MATRIX_CACHE_ALIGNMENT - 1) &
+         ~(size_t)(MATRIX_CACHE_ALIGNMENT - 1);
+}
+
+void* map_cache_array(char **cursor, size_t size)
+{
+  uintptr_t aligned = ((uintptr_t)*cursor + MATRIX_CACHE_ALIGNMENT - 1) &
+                      ~(uintptr_t)(MATRIX_CACHE_ALIGNMENT - 1);
+  *cursor = (char*)aligned + size;
+  return (void*)aligned;
+}
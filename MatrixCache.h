@@ -0,0 +1,80 @@
+//
+// Cache of a matrix as a context stores it, already encoded for its mode
+//
+// For many inputs, parsing, mirroring and sorting the MatrixMarket file
+// and encoding the result takes longer than the solve. A cache file holds
+// the arrays that a context built, after a header recording what they were
+// built from, so that later runs with the same target, mode, blocking and
+// storage format map it instead. The mapping is private, so the pages are
+// shared with the page cache until a correction or an injected bit-flip
+// writes to them. A cache is rebuilt when the source file's size or
+// modification time, or any of the rest of the header, no longer matches,
+// or when its arrays are not the size the context expects.
+//
+
+#ifndef MATRIXCACHE_H
+#define MATRIXCACHE_H
+
+#include <cstdint>
+#include <cstdio>
+
+class CGContext;
+struct cg_matrix;
+
+// Bump whenever the arrays that a context saves, or their encoding, change
+#define MATRIX_CACHE_VERSION 2
+
+// Alignment of each array in the file, and so in the mapping
+#define MATRIX_CACHE_ALIGNMENT 64
+
+// Offset of the arrays, so that they start on a page
+#define MATRIX_CACHE_DATA_OFFSET 4096
+
+struct matrix_cache_header
+{
+  char     magic[8];      // "CGMATRIX"
+  uint32_t version;
+  char     target[32];
+  char     mode[32];
+  char     format[16];    // of the arrays, as the context names it
+  int32_t  num_blocks;
+  uint32_t N;
+  uint32_t nnz;
+  uint64_t source_size;   // of the .mtx file
+  int64_t  source_mtime;  // nanoseconds
+  uint64_t data_size;     // bytes of arrays after MATRIX_CACHE_DATA_OFFSET
+  uint64_t checksum;      // of the arrays
+};
+
+struct matrix_cache
+{
+  void  *map;
+  size_t size;
+  void  *data;  // the arrays
+  int    N;
+  int    nnz;
+};
+
+// Map the cache at path if it holds the matrix that target and mode build
+// from source blocked num_blocks times, stored as context stores it, or
+// return NULL (printing why if the file exists)
+matrix_cache* open_matrix_cache(const char *path, const char *source,
+                                const char *target, const char *mode,
+                                int num_blocks, CGContext *context);
+void          close_matrix_cache(matrix_cache *cache);
+
+// Save mat, built from source, to a cache at path, exiting if the context
+// cannot
+void          write_matrix_cache(const char *path, const char *source,
+                                 const char *target, const char *mode,
+                                 int num_blocks, CGContext *context,
+                                 const cg_matrix *mat, int N, int nnz);
+
+// For the contexts' save_matrix, map_matrix and matrix_cache_size: write an
+// array at the next aligned offset of file, take the next one from a
+// mapping, and the bytes that an array takes in the file
+void   write_cache_array(FILE *file, const void *data, size_t size);
+void*  map_cache_array(char **cursor, size_t size);
+size_t cache_array_size(size_t size);
+
+#endif // MATRIXCACHE_H
@@ -0,0 +1,231 @@
+//
+// Huang-Abraham checksums for sparse matrix-vector products
+//
+// For w = Ap, the column checksum c = 1'A gives sum(w) = c'p, and the
+// weighted column checksum d = v'A gives v'w = d'p. The row weights repeat
+// every 63 rows, and no power of 2 is a multiple of 63, so an element moved
+// to another row by a single bit-flip in its row index (or by one row, from
+// a corrupted row pointer) changes v'w noticeably. Partial checksums over
+// each block of MATRIX_CHECKSUM_BLOCK rows localise a failed check.
+//
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "ErrorLog.h"
+
+#define MATRIX_CHECKSUM_BLOCK 64
+
+// Weight of row i in the weighted checksum
+#define MATRIX_CHECKSUM_WEIGHT(i) (((i) % 63 + 1) / 64.0)
+
+struct matrix_checksums
+{
+  unsigned N;
+  double  *sums;       // c = 1'A
+  double  *weighted;   // d = v'A
+  double  *abs;        // 1'|A|, which bounds the rounding error
+
+  // Allowed difference between the two sides, relative to abs'|p|
+  double tolerance;
+
+  // Partial checksums of each block of rows, stored as sparse rows
+  unsigned  num_blocks;
+  uint32_t *block_start;
+  uint32_t *block_cols;
+  double   *block_sums;
+  double   *block_weighted;
+  double   *block_abs;
+  double    block_tolerance;
+};
+
+// Build the checksums of a matrix whose element e contributes
+// values[e]*p[in[e]] to w[out[e]]
+static inline matrix_checksums* create_matrix_checksums(const uint32_t *out,
+                                                        const uint32_t *in,
+                                                        const double *values,
+                                                        unsigned N,
+                                                        unsigned nnz)
+{
+  matrix_checksums *cs = new matrix_checksums;
+
+  cs->N        = N;
+  cs->sums     = new double[N]();
+  cs->weighted = new double[N]();
+  cs->abs      = new double[N]();
+
+  std::vector<unsigned> row_length(N, 0);
+  for (unsigned e = 0; e < nnz; e++)
+  {
+    cs->sums[in[e]]     += values[e];
+    cs->weighted[in[e]] += MATRIX_CHECKSUM_WEIGHT(out[e]) * values[e];
+    cs->abs[in[e]]      += fabs(values[e]);
+    row_length[out[e]]++;
+  }
+
+  // Each side is a sum over at most N rows (or a block of them) of row
+  // products, each accumulated over at most max_row elements
+  unsigned max_row = *std::max_element(row_length.begin(), row_length.end());
+  cs->tolerance       = 2.0 * (N + max_row) * DBL_EPSILON;
+  cs->block_tolerance = 2.0 * (MATRIX_CHECKSUM_BLOCK + max_row) * DBL_EPSILON;
+
+  // Sort the elements by block of rows and then by column, and merge the
+  // elements of each block that share a column
+  std::vector< std::pair<uint64_t,unsigned> > order(nnz);
+  for (unsigned e = 0; e < nnz; e++)
+  {
+    uint64_t block = out[e] / MATRIX_CHECKSUM_BLOCK;
+    order[e] = std::make_pair(block << 32 | in[e], e);
+  }
+  std::sort(order.begin(), order.end());
+
+  cs->num_blocks  = (N + MATRIX_CHECKSUM_BLOCK - 1) / MATRIX_CHECKSUM_BLOCK;
+  cs->block_start = new uint32_t[cs->num_blocks+1];
+
+  std::vector<uint32_t> cols;
+  std::vector<double>   sums, weighted, abs;
+  unsigned b = 0;
+  cs->block_start[0] = 0;
+  for (unsigned k = 0; k < nnz; k++)
+  {
+    unsigned e = order[k].second;
+    while (b < order[k].first >> 32)
+      cs->block_start[++b] = cols.size();
+
+    if (k == 0 || order[k].first != order[k-1].first)
+    {
+      cols.push_back(in[e]);
+      sums.push_back(0.0);
+      weighted.push_back(0.0);
+      abs.push_back(0.0);
+    }
+    sums.back()     += values[e];
+    weighted.back() += MATRIX_CHECKSUM_WEIGHT(out[e]) * values[e];
+    abs.back()      += fabs(values[e]);
+  }
+  while (b < cs->num_blocks)
+    cs->block_start[++b] = cols.size();
+
+  cs->block_cols     = new uint32_t[cols.size()];
+  cs->block_sums     = new double[cols.size()];
+  cs->block_weighted = new double[cols.size()];
+  cs->block_abs      = new double[cols.size()];
+  std::copy(cols.begin(), cols.end(), cs->block_cols);
+  std::copy(sums.begin(), sums.end(), cs->block_sums);
+  std::copy(weighted.begin(), weighted.end(), cs->block_weighted);
+  std::copy(abs.begin(), abs.end(), cs->block_abs);
+
+  return cs;
+}
+
+static inline void destroy_matrix_checksums(matrix_checksums *cs)
+{
+  delete[] cs->sums;
+  delete[] cs->weighted;
+  delete[] cs->abs;
+  delete[] cs->block_start;
+  delete[] cs->block_cols;
+  delete[] cs->block_sums;
+  delete[] cs->block_weighted;
+  delete[] cs->block_abs;
+  delete cs;
+}
+
+// Compare both sides of the checksum relations
+static inline bool matrix_checksums_match(double tolerance,
+                                          double sum, double expected_sum,
+                                          double weighted,
+                                          double expected_weighted,
+                                          double abs)
+{
+  // (written so that a NaN counts as a mismatch)
+  return fabs(sum - expected_sum) <= tolerance * abs &&
+         fabs(weighted - expected_weighted) <= tolerance * abs;
+}
+
+// Check w = Ap against the checksums in a separate pass over the vectors
+static inline bool verify_matrix_checksums(const matrix_checksums *cs,
+                                           const double *p, const double *w)
+{
+  double sum = 0.0, weighted = 0.0;
+  double expected_sum = 0.0, expected_weighted = 0.0, abs = 0.0;
+#pragma omp parallel for simd \
+  reduction(+:sum,weighted,expected_sum,expected_weighted,abs)
+  for (unsigned i = 0; i < cs->N; i++)
+  {
+    sum               += w[i];
+    weighted          += MATRIX_CHECKSUM_WEIGHT(i) * w[i];
+    expected_sum      += cs->sums[i] * p[i];
+    expected_weighted += cs->weighted[i] * p[i];
+    abs               += cs->abs[i] * fabs(p[i]);
+  }
+  return matrix_checksums_match(cs->tolerance, sum, expected_sum,
+                                weighted, expected_weighted, abs);
+}
+
+// Check rows b*MATRIX_CHECKSUM_BLOCK onwards of w = Ap against the partial
+// checksums of block b
+static inline bool verify_matrix_checksum_block(const matrix_checksums *cs,
+                                                unsigned b, const double *p,
+                                                const double *w)
+{
+  unsigned first = b*MATRIX_CHECKSUM_BLOCK;
+  unsigned last  = std::min(first + MATRIX_CHECKSUM_BLOCK, cs->N);
+
+  double sum = 0.0, weighted = 0.0;
+  for (unsigned i = first; i < last; i++)
+  {
+    sum      += w[i];
+    weighted += MATRIX_CHECKSUM_WEIGHT(i) * w[i];
+  }
+
+  double expected_sum = 0.0, expected_weighted = 0.0, abs = 0.0;
+  for (uint32_t k = cs->block_start[b]; k < cs->block_start[b+1]; k++)
+  {
+    double x = p[cs->block_cols[k]];
+    expected_sum      += cs->block_sums[k] * x;
+    expected_weighted += cs->block_weighted[k] * x;
+    abs               += cs->block_abs[k] * fabs(x);
+  }
+  return matrix_checksums_match(cs->block_tolerance, sum, expected_sum,
+                                weighted, expected_weighted, abs);
+}
+
+// Handle a failed check of w = Ap: localise the blocks of rows that are
+// wrong and recompute them with recompute(first, last), recording an error
+// in log for those that are still wrong (so the matrix itself is corrupt).
+// Returns the number of blocks recomputed successfully.
+template<class Recompute>
+static inline unsigned recover_matrix_checksums(const matrix_checksums *cs,
+                                                const double *p, double *w,
+                                                ErrorLog& log,
+                                                Recompute recompute)
+{
+  unsigned recomputed = 0, failed = 0;
+  for (unsigned b = 0; b < cs->num_blocks; b++)
+  {
+    if (verify_matrix_checksum_block(cs, b, p, w))
+      continue;
+
+    unsigned first = b*MATRIX_CHECKSUM_BLOCK;
+    unsigned last  = std::min(first + MATRIX_CHECKSUM_BLOCK, cs->N);
+    recompute(first, last);
+    if (!verify_matrix_checksum_block(cs, b, p, w))
+    {
+      log.record(ERROR_DETECTED, ERROR_MATRIX_CHECKSUM, first);
+      failed++;
+      continue;
+    }
+
+    log.record(ERROR_CORRECTED, ERROR_MATRIX_CHECKSUM, first);
+    recomputed++;
+  }
+
+  if (!recomputed && !failed)
+    log.record(ERROR_DETECTED, ERROR_MATRIX_CHECKSUM, ERROR_INDEX_NONE);
+  return recomputed;
+}
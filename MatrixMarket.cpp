@@ -0,0 +1,394 @@
+#include "MatrixMarket.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+extern "C"
+{
+  #include "mmio.h"
+}
+
+#ifdef _OPENMP
+  #include <omp.h>
+#else
+  static inline int omp_get_thread_num() { return 0; }
+  static inline int omp_get_num_threads() { return 1; }
+  static inline int omp_get_max_threads() { return 1; }
+#endif
+
+// Powers of ten that a double holds exactly
+static const double exact_powers_of_ten[] =
+{
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+#define MAX_EXACT_POWER_OF_TEN 22
+
+// Most buckets of rows that the entries are partitioned into before they are
+// sorted by row
+#define MAX_BUCKETS 1024
+
+static inline bool is_digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+static inline const char* skip_blanks(const char *p, const char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  return p;
+}
+
+// Parse the decimal integer at p into value, returning the end of it, or
+// NULL if there are no digits at p
+static inline const char* parse_index(const char *p, const char *end,
+                                      uint64_t *value)
+{
+  if (p == end || !is_digit(*p))
+    return NULL;
+
+  // Saturate rather than overflow, as any index this large is out of range
+  uint64_t v = 0;
+  for (; p < end && is_digit(*p); p++)
+  {
+    if (v < UINT32_MAX)
+      v = v*10 + (*p - '0');
+  }
+  *value = v;
+  return p;
+}
+
+// Parse the floating-point number at p into value, returning the end of it,
+// or NULL if there are no digits at p. A significand that fits in 53 bits
+// with a power of ten that a double holds exactly takes one multiplication
+// or division, which rounds exactly as strtod would; anything else falls
+// back to strtod.
+static inline const char* parse_value(const char *p, const char *end,
+                                      double *value)
+{
+  const char *start = p;
+
+  bool negative = false;
+  if (p < end && (*p == '+' || *p == '-'))
+  {
+    negative = *p == '-';
+    p++;
+  }
+
+  uint64_t significand = 0;
+  int      digits      = 0;    // significant digits in significand
+  int      exponent    = 0;
+  bool     exact       = true; // whether significand holds every digit
+  bool     any         = false;
+  for (; p < end && is_digit(*p); p++)
+  {
+    any = true;
+    if (digits < 19)
+    {
+      significand = significand*10 + (*p - '0');
+      digits += significand != 0;
+    }
+    else
+    {
+      exponent++;
+      exact = false;
+    }
+  }
+  if (p < end && *p == '.')
+  {
+    for (p++; p < end && is_digit(*p); p++)
+    {
+      any = true;
+      if (digits < 19)
+      {
+        significand = significand*10 + (*p - '0');
+        digits += significand != 0;
+        exponent--;
+      }
+      else
+      {
+        exact = false;
+      }
+    }
+  }
+  if (!any)
+    return NULL;
+
+  if (p < end && (*p == 'e' || *p == 'E'))
+  {
+    const char *q = p + 1;
+    bool negative_exponent = false;
+    if (q < end && (*q == '+' || *q == '-'))
+    {
+      negative_exponent = *q == '-';
+      q++;
+    }
+    if (q < end && is_digit(*q))
+    {
+      int e = 0;
+      for (; q < end && is_digit(*q); q++)
+      {
+        if (e < 100000)
+          e = e*10 + (*q - '0');
+      }
+      exponent += negative_exponent ? -e : e;
+      p = q;
+    }
+  }
+
+  if (exact && significand <= (1ULL << 53) &&
+      exponent >= -MAX_EXACT_POWER_OF_TEN &&
+      exponent <= MAX_EXACT_POWER_OF_TEN)
+  {
+    double v = (double)significand;
+    if (exponent < 0)
+      v /= exact_powers_of_ten[-exponent];
+    else
+      v *= exact_powers_of_ten[exponent];
+    *value = negative ? -v : v;
+    return p;
+  }
+
+  // The mapping need not have a terminator after the last number
+  char number[64];
+  size_t length = p - start;
+  if (length >= sizeof(number))
+  {
+    *value = strtod(std::string(start, p).c_str(), NULL);
+    return p;
+  }
+  memcpy(number, start, length);
+  number[length] = '\0';
+  *value = strtod(number, NULL);
+  return p;
+}
+
+// Start of the range of lines that thread t of num_threads parses: the first
+// line that starts at or after an even split of the data
+static const char* range_start(const char *data, size_t size,
+                               int t, int num_threads)
+{
+  if (t == 0)
+    return data;
+  if (t >= num_threads)
+    return data + size;
+
+  const char *p = data + size*t/num_threads;
+
+  // p starts a line if the character before it ends one
+  const char *newline =
+    (const char*)memchr(p - 1, '\n', data + size - (p - 1));
+  return newline ? newline + 1 : data + size;
+}
+
+matrix_entry* read_matrix_market(const char *filename, int *N, int *nnz)
+{
+  FILE *file = fopen(filename, "r");
+  if (file == NULL)
+  {
+    printf("Failed to open '%s'\n", filename);
+    exit(1);
+  }
+
+  MM_typecode type;
+  if (mm_read_banner(file, &type) != 0)
+  {
+    printf("Failed to read MatrixMarket banner of '%s'\n", filename);
+    exit(1);
+  }
+  if (!mm_is_coordinate(type) ||
+      !(mm_is_real(type) || mm_is_integer(type)) ||
+      !(mm_is_symmetric(type) || mm_is_general(type)))
+  {
+    printf("Only real, general or symmetric coordinate matrices "
+           "are supported\n");
+    exit(1);
+  }
+  bool symmetric = mm_is_symmetric(type);
+
+  int width, height, input_nnz;
+  if (mm_read_mtx_crd_size(file, &width, &height, &input_nnz) != 0)
+  {
+    printf("Failed to read matrix size\n");
+    exit(1);
+  }
+  if (width != height)
+  {
+    printf("Matrix is not square\n");
+    exit(1);
+  }
+
+  // The entries follow the size line
+  long offset = ftell(file);
+  struct stat st;
+  if (offset < 0 || fstat(fileno(file), &st) != 0)
+  {
+    printf("Failed to read matrix data\n");
+    exit(1);
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+  if (map == MAP_FAILED)
+  {
+    printf("Failed to map '%s'\n", filename);
+    exit(1);
+  }
+  const char *data = (const char*)map + offset;
+  size_t      size = st.st_size - offset;
+
+  std::vector< std::vector<matrix_entry> > thread_entries(
+    omp_get_max_threads());
+  // Rows are sorted in buckets of 2^bucket_shift, few enough that the
+  // writes to each bucket stream
+  uint32_t bucket_shift = 0;
+  while (((uint32_t)std::max(width - 1, 0) >> bucket_shift) >= MAX_BUCKETS)
+    bucket_shift++;
+  uint32_t num_buckets = (std::max(width - 1, 0) >> bucket_shift) + 1;
+
+  std::vector<uint32_t> bucket_offsets(omp_get_max_threads()*num_buckets);
+  std::vector<uint32_t> bucket_starts(num_buckets + 1);
+  uint32_t *row_starts = new uint32_t[width];
+  uint32_t *row_ends   = new uint32_t[width];
+  matrix_entry *partitioned = NULL;
+  matrix_entry *entries     = NULL;
+  long num_lines = 0;
+  bool failed    = false;
+
+#pragma omp parallel reduction(+:num_lines)
+  {
+    int t           = omp_get_thread_num();
+    int num_threads = omp_get_num_threads();
+
+    // Parse this thread's lines, mirroring as it goes
+    const char *begin = range_start(data, size, t, num_threads);
+    const char *end   = range_start(data, size, t + 1, num_threads);
+    std::vector<matrix_entry>& mine = thread_entries[t];
+    if (size > 0)
+      mine.reserve((symmetric ? 2 : 1)*input_nnz*((end - begin)/(double)size));
+
+    for (const char *line = begin; line < end;)
+    {
+      const char *line_end = (const char*)memchr(line, '\n', end - line);
+      if (line_end == NULL)
+        line_end = end;
+
+      // Skip blank lines and comments
+      const char *p = skip_blanks(line, line_end);
+      line = line_end + 1;
+      if (p == line_end || *p == '%' || *p == '\r')
+        continue;
+
+      uint64_t row = 0, col = 0;
+      double value;
+      p = parse_index(p, line_end, &row);
+      if (p)
+        p = parse_index(skip_blanks(p, line_end), line_end, &col);
+      if (p)
+        p = parse_value(skip_blanks(p, line_end), line_end, &value);
+      if (p == NULL || row < 1 || row > (uint64_t)height ||
+          col < 1 || col > (uint64_t)width)
+      {
+#pragma omp atomic write
+        failed = true;
+        break;
+      }
+      num_lines++;
+
+      // adjust from 1-based to 0-based
+      matrix_entry entry = {(uint32_t)col - 1, (uint32_t)row - 1, value};
+      mine.push_back(entry);
+      if (symmetric && row != col)
+      {
+        std::swap(entry.row, entry.col);
+        mine.push_back(entry);
+      }
+    }
+
+    // Partition the entries into buckets of rows, in file order, with each
+    // thread writing its entries from its own offset in each bucket
+    uint32_t *offsets = &bucket_offsets[t*num_buckets];
+    for (size_t i = 0; i < mine.size(); i++)
+      offsets[mine[i].row >> bucket_shift]++;
+#pragma omp barrier
+#pragma omp single
+    {
+      uint32_t offset = 0;
+      for (uint32_t b = 0; b < num_buckets; b++)
+      {
+        bucket_starts[b] = offset;
+        for (int u = 0; u < num_threads; u++)
+        {
+          uint32_t count = bucket_offsets[u*num_buckets + b];
+          bucket_offsets[u*num_buckets + b] = offset;
+          offset += count;
+        }
+      }
+      bucket_starts[num_buckets] = offset;
+      partitioned = new matrix_entry[offset];
+      entries     = new matrix_entry[offset];
+    }
+    for (size_t i = 0; i < mine.size(); i++)
+      partitioned[offsets[mine[i].row >> bucket_shift]++] = mine[i];
+    std::vector<matrix_entry>().swap(mine);
+#pragma omp barrier
+
+    // Counting sort each bucket by row, which stays in cache, then order
+    // each row by column (and any duplicates by value)
+#pragma omp for schedule(dynamic)
+    for (uint32_t b = 0; b < num_buckets; b++)
+    {
+      uint32_t first = b << bucket_shift;
+      uint32_t last  = std::min((b + 1) << bucket_shift, (uint32_t)width);
+      uint32_t begin = bucket_starts[b];
+      uint32_t end   = bucket_starts[b + 1];
+
+      for (uint32_t r = first; r < last; r++)
+        row_ends[r] = 0;
+      for (uint32_t i = begin; i < end; i++)
+        row_ends[partitioned[i].row]++;
+      for (uint32_t r = first, offset = begin; r < last; r++)
+      {
+        row_starts[r] = offset;
+        offset       += row_ends[r];
+        row_ends[r]   = row_starts[r];
+      }
+      for (uint32_t i = begin; i < end; i++)
+        entries[row_ends[partitioned[i].row]++] = partitioned[i];
+
+      for (uint32_t r = first; r < last; r++)
+      {
+        std::sort(entries + row_starts[r], entries + row_ends[r],
+                  [](const matrix_entry& a, const matrix_entry& b)
+                  {
+                    return a.col < b.col ||
+                           (a.col == b.col && a.value < b.value);
+                  });
+      }
+    }
+  }
+
+  if (failed || num_lines != input_nnz)
+  {
+    printf("Failed to read matrix data\n");
+    exit(1);
+  }
+
+  *N   = width;
+  *nnz = bucket_starts[num_buckets];
+
+  delete[] partitioned;
+  delete[] row_starts;
+  delete[] row_ends;
+  munmap(map, st.st_size);
+  fclose(file);
+
+  return entries;
+}
@@ -0,0 +1,31 @@
+//
+// Parallel reader of MatrixMarket coordinate files
+//
+// mmio still parses the banner and the size line, but the entries are not
+// read with fscanf: the file is mapped and split at line boundaries into a
+// range per thread, which parses its lines with a hand-written integer and
+// floating-point parser. The entries are then sorted by a parallel counting
+// sort on the row, followed by a sort of each row by column, rather than
+// by one serial qsort.
+//
+
+#ifndef MATRIXMARKET_H
+#define MATRIXMARKET_H
+
+#include <stdint.h>
+
+struct matrix_entry
+{
+  uint32_t col;
+  uint32_t row;
+  double value;
+};
+
+// Read the square matrix in filename, 0-based and with the upper triangle
+// of a symmetric matrix mirrored from its lower triangle, sorted by row and
+// then column. Sets N to the number of rows and nnz to the number of entries
+// returned, which the caller frees with delete[]. Exits if the file cannot
+// be read.
+matrix_entry* read_matrix_market(const char *filename, int *N, int *nnz);
+
+#endif // MATRIXMARKET_H
@@ -0,0 +1,29 @@
+#include "Numa.h"
+
+#include <cstdio>
+#include <dirent.h>
+#include <sched.h>
+
+int numa_current_node()
+{
+  int cpu = sched_getcpu();
+  if (cpu < 0)
+    return 0;
+
+  // sysfs links each CPU to its node as cpu<N>/node<M>
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR *dir = opendir(path);
+  if (dir == NULL)
+    return 0;
+
+  int node = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (sscanf(entry->d_name, "node%d", &node) == 1)
+      break;
+  }
+  closedir(dir);
+  return node;
+}
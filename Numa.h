@@ -0,0 +1,19 @@
+//
+// NUMA placement of the calling thread
+//
+// The contexts place their arrays by first touch: each page lands on the
+// node of the thread that first writes it, so arrays initialised by the
+// same static partition that the kernels use stay local to the threads
+// that stream them. This only holds while the OpenMP threads stay on their
+// CPUs, so bind them (e.g. OMP_PROC_BIND=true) when running on more than
+// one node.
+//
+
+#ifndef NUMA_H
+#define NUMA_H
+
+// NUMA node of the CPU that the calling thread is running on, as numbered
+// by the kernel, or 0 if the topology is not available
+int numa_current_node();
+
+#endif // NUMA_H
@@ -0,0 +1,331 @@
+#include "CPUContext.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+CPUContext::CPUContext()
+{
+  num_corrected  = 0;
+  check_interval = 1;
+  spmv_count     = 0;
+  check_result   = NOT_CHECKED;
+}
+
+void CPUContext::generate_ecc_bits(csr_element& element)
+{
+}
+
+cg_matrix* CPUContext::create_matrix(const uint32_t *columns,
+                                     const uint32_t *rows,
+                                     const double *values,
+                                     int N, int nnz)
+{
+  // Find the start of each row (elements are sorted by row)
+  uint32_t *row_start = new uint32_t[N+1];
+  uint32_t next_row = 0;
+  for (int i = 0; i < nnz; i++)
+  {
+    while (next_row <= rows[i])
+    {
+      row_start[next_row++] = i;
+    }
+  }
+  while (next_row <= (uint32_t)N)
+  {
+    row_start[next_row++] = nnz;
+  }
+
+  cg_matrix *M = new cg_matrix;
+
+  M->N          = N;
+  M->num_slices = (N + SELL_C - 1) / SELL_C;
+  M->slices     = new uint32_t[M->num_slices+1];
+  M->perm       = new uint32_t[N];
+
+  // Sort rows by decreasing length within each sigma window
+  for (int r = 0; r < N; r++)
+  {
+    M->perm[r] = r;
+  }
+  for (int w = 0; w < N; w += SELL_SIGMA)
+  {
+    int end = std::min(w + SELL_SIGMA, N);
+    std::stable_sort(M->perm + w, M->perm + end,
+      [row_start](uint32_t a, uint32_t b)
+      {
+        return row_start[a+1]-row_start[a] > row_start[b+1]-row_start[b];
+      });
+  }
+
+  // Each slice is as wide as its longest row
+  M->slices[0] = 0;
+  for (unsigned s = 0; s < M->num_slices; s++)
+  {
+    uint32_t width = 0;
+    for (unsigned k = s*SELL_C; k < (s+1)*SELL_C && k < (unsigned)N; k++)
+    {
+      uint32_t row = M->perm[k];
+      width = std::max(width, row_start[row+1] - row_start[row]);
+    }
+    M->slices[s+1] = M->slices[s] + width*SELL_C;
+  }
+
+  M->nnz    = M->slices[M->num_slices];
+  M->cols   = new uint32_t[M->nnz];
+  M->values = new double[M->nnz];
+
+  for (unsigned s = 0; s < M->num_slices; s++)
+  {
+    uint32_t width = (M->slices[s+1] - M->slices[s]) / SELL_C;
+    for (unsigned lane = 0; lane < SELL_C; lane++)
+    {
+      unsigned k = s*SELL_C + lane;
+      uint32_t row = k < (unsigned)N ? M->perm[k] : 0;
+      uint32_t len = k < (unsigned)N ? row_start[row+1] - row_start[row] : 0;
+
+      for (uint32_t j = 0; j < width; j++)
+      {
+        // Padding is a zero on the diagonal, with valid ECC bits so that it
+        // is protected like any other element
+        csr_element element;
+        element.column = row;
+        element.value  = 0.0;
+        if (j < len)
+        {
+          element.column = columns[row_start[row] + j];
+          element.value  = values[row_start[row] + j];
+        }
+
+        generate_ecc_bits(element);
+
+        uint32_t i = M->slices[s] + j*SELL_C + lane;
+        M->cols[i]   = element.column;
+        M->values[i] = element.value;
+      }
+    }
+  }
+
+  delete[] row_start;
+
+  return M;
+}
+
+void CPUContext::destroy_matrix(cg_matrix *mat)
+{
+  delete[] mat->slices;
+  delete[] mat->perm;
+  delete[] mat->cols;
+  delete[] mat->values;
+  delete mat;
+}
+
+cg_vector* CPUContext::create_vector(int N)
+{
+  cg_vector *result = new cg_vector;
+  result->N    = N;
+  result->data = new double[N];
+  return result;
+}
+
+void CPUContext::destroy_vector(cg_vector *vec)
+{
+  delete[] vec->data;
+  delete vec;
+}
+
+double* CPUContext::map_vector(cg_vector *v)
+{
+  return v->data;
+}
+
+void CPUContext::unmap_vector(cg_vector *v, double *h)
+{
+}
+
+void CPUContext::copy_vector(cg_vector *dst, const cg_vector *src)
+{
+#pragma omp parallel for simd
+  for (int i = 0; i < dst->N; i++)
+  {
+    dst->data[i] = src->data[i];
+  }
+}
+
+double CPUContext::dot(const cg_vector *a, const cg_vector *b)
+{
+  double ret = 0.0;
+#pragma omp parallel for simd reduction(+:ret)
+  for (int i = 0; i < a->N; i++)
+  {
+    ret += a->data[i] * b->data[i];
+  }
+  return ret;
+}
+
+double CPUContext::calc_xr(cg_vector *x, cg_vector *r,
+                           const cg_vector *p, const cg_vector *w,
+                           double alpha)
+{
+  double ret = 0.0;
+#pragma omp parallel for simd reduction(+:ret)
+  for (int i = 0; i < x->N; i++)
+  {
+    x->data[i] += alpha * p->data[i];
+    r->data[i] -= alpha * w->data[i];
+
+    ret += r->data[i] * r->data[i];
+  }
+  return ret;
+}
+
+void CPUContext::calc_p(cg_vector *p, const cg_vector *r, double beta)
+{
+#pragma omp parallel for simd
+  for (int i = 0; i < p->N; i++)
+  {
+    p->data[i] = r->data[i] + beta*p->data[i];
+  }
+}
+
+void CPUContext::spmv(const cg_matrix *mat, const cg_vector *vec,
+                      cg_vector *result)
+{
+  spmv_dot(mat, vec, result);
+}
+
+double CPUContext::spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                            cg_vector *result)
+{
+  // Skip the checks on all but every check_interval'th call
+  if (++spmv_count < check_interval)
+  {
+    check_result = NOT_CHECKED;
+    return unchecked_spmv_dot(mat, vec, result);
+  }
+  spmv_count = 0;
+
+  unsigned corrected = num_corrected;
+  double ret = checked_spmv_dot(mat, vec, result);
+  check_result = num_corrected > corrected ? CHECK_CORRECTED : CHECK_PASSED;
+  return ret;
+}
+
+template<class Policy, bool check>
+double CPUContext::sell_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                 cg_vector *result)
+{
+  double ret = 0.0;
+  unsigned corrected = 0;
+#pragma omp parallel for reduction(+:ret,corrected)
+  for (unsigned s = 0; s < mat->num_slices; s++)
+  {
+    double tmp[SELL_C] = {0.0};
+
+    uint32_t start = mat->slices[s];
+    uint32_t end   = mat->slices[s+1];
+    for (uint32_t i = start; i < end; i += SELL_C)
+    {
+      // Check this column of the slice before multiplying it
+      for (uint32_t lane = 0; check && lane < SELL_C; lane++)
+      {
+        csr_element element;
+        element.value  = mat->values[i+lane];
+        element.column = mat->cols[i+lane];
+
+        if (Policy::check(element, i+lane, error_log))
+        {
+          mat->cols[i+lane]   = element.column;
+          mat->values[i+lane] = element.value;
+          corrected++;
+        }
+      }
+
+      // Not forced with omp simd: without a gather instruction the
+      // vectorised column loads are slower than scalar ones
+      for (uint32_t lane = 0; lane < SELL_C; lane++)
+      {
+        // Mask out ECC from high order column bits, and keep an index
+        // corrupted since the last check (or that the check could not
+        // correct) in range, unless the matrix is not checked at all
+        uint32_t col = mat->cols[i+lane] & Policy::column_mask;
+        if (Policy::checks)
+          col = col < mat->N ? col : 0;
+
+        tmp[lane] += mat->values[i+lane] * vec->data[col];
+      }
+    }
+
+    for (uint32_t lane = 0; lane < SELL_C && s*SELL_C + lane < mat->N; lane++)
+    {
+      uint32_t row = mat->perm[s*SELL_C + lane];
+      result->data[row] = tmp[lane];
+      ret += tmp[lane] * vec->data[row];
+    }
+  }
+  num_corrected += corrected;
+  return ret;
+}
+
+double CPUContext::checked_spmv_dot(const cg_matrix *mat,
+                                    const cg_vector *vec,
+                                    cg_vector *result)
+{
+  return sell_spmv_dot<None, false>(mat, vec, result);
+}
+
+double CPUContext::unchecked_spmv_dot(const cg_matrix *mat,
+                                      const cg_vector *vec,
+                                      cg_vector *result)
+{
+  return sell_spmv_dot<None, false>(mat, vec, result);
+}
+
+void CPUContext::inject_bitflip(cg_matrix *mat, BitFlipKind kind, int num_flips)
+{
+  int index = rand() % mat->nnz;
+
+  int start = 0;
+  int end   = 96;
+  if (kind == VALUE)
+    end = 64;
+  else if (kind == INDEX)
+    start = 64;
+
+  for (int i = 0; i < num_flips; i++)
+  {
+    int bit = (rand() % (end-start)) + start;
+    printf("*** flipping bit %d at index %d ***\n", bit, index);
+    if (bit < 64)
+    {
+      uint64_t value;
+      memcpy(&value, mat->values+index, sizeof(value));
+      value ^= 0x1ULL << bit;
+      memcpy(mat->values+index, &value, sizeof(value));
+    }
+    else
+    {
+      mat->cols[index] ^= 0x1U << (bit % 32);
+    }
+  }
+}
+
+void CPUContext::set_check_interval(int k)
+{
+  check_interval = k;
+}
+
+CGContext::CheckResult CPUContext::last_check()
+{
+  return check_result;
+}
+
+namespace
+{
+  static CGContext::Register<CPUContext> A("cpu", "none");
+  static CGContext::Register< CPUContext_ECC<ECC_SED> >    B("cpu", "sed");
+  static CGContext::Register< CPUContext_ECC<ECC_SEC7> >   C("cpu", "sec7");
+  static CGContext::Register< CPUContext_ECC<ECC_SEC8> >   D("cpu", "sec8");
+  static CGContext::Register< CPUContext_ECC<ECC_SECDED> > E("cpu", "secded");
+}
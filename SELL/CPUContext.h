@@ -0,0 +1,107 @@
+#include "CGContext.h"
+
+#include "CSR/ecc.h"
+#include "CSR/Policies.h"
+
+// Number of rows in a slice (the SIMD width the kernel is written for)
+#define SELL_C 8
+
+// Number of consecutive rows that are sorted by length before slicing
+#define SELL_SIGMA 64
+
+struct cg_vector
+{
+  int N;
+  double *data;
+};
+
+// SELL-C-sigma matrix. Rows are sorted by length within windows of
+// SELL_SIGMA rows and packed into slices of SELL_C rows, padded to the
+// longest row of the slice and stored column-major, so that consecutive
+// elements belong to consecutive rows of the slice.
+struct cg_matrix
+{
+  unsigned N;
+  unsigned nnz;        // number of stored elements, including padding
+  unsigned num_slices;
+  uint32_t *slices;    // index of the first element of each slice
+  uint32_t *perm;      // original row of each sorted row
+  uint32_t *cols;
+  double   *values;
+};
+
+class CPUContext : public CGContext
+{
+public:
+  CPUContext();
+
+protected:
+  // Number of matrix errors corrected so far
+  unsigned num_corrected;
+
+  // Multiply by a matrix whose elements carry the check bits of Policy
+  // (see CSR/Policies.h), checking them first if check is set
+  template<class Policy, bool check>
+  double sell_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                       cg_vector *result);
+
+private:
+  // Periodic checking state
+  int         check_interval;
+  int         spmv_count;
+  CheckResult check_result;
+
+  virtual void generate_ecc_bits(csr_element& element);
+  virtual cg_matrix* create_matrix(const uint32_t *columns,
+                                   const uint32_t *rows,
+                                   const double *values,
+                                   int N, int nnz);
+  virtual void destroy_matrix(cg_matrix *mat);
+
+  virtual cg_vector* create_vector(int N);
+  virtual void destroy_vector(cg_vector *vec);
+  virtual double* map_vector(cg_vector *v);
+  virtual void unmap_vector(cg_vector *v, double *h);
+  virtual void copy_vector(cg_vector *dst, const cg_vector *src);
+
+  virtual double dot(const cg_vector *a, const cg_vector *b);
+  virtual double calc_xr(cg_vector *x, cg_vector *r,
+                         const cg_vector *p, const cg_vector *w,
+                         double alpha);
+  virtual void calc_p(cg_vector *p, const cg_vector *r, double beta);
+
+  virtual void spmv(const cg_matrix *mat, const cg_vector *vec,
+                    cg_vector *result);
+  virtual double spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                          cg_vector *result);
+  virtual double checked_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                  cg_vector *result);
+  virtual double unchecked_spmv_dot(const cg_matrix *mat,
+                                    const cg_vector *vec,
+                                    cg_vector *result);
+
+  virtual void inject_bitflip(cg_matrix *mat, BitFlipKind kind, int num_flips);
+
+  virtual void set_check_interval(int k);
+  virtual CheckResult last_check();
+};
+
+template<ECCMode mode>
+class CPUContext_ECC : public CPUContext
+{
+  virtual void generate_ecc_bits(csr_element& element)
+  {
+    ecc_generate<mode>(element);
+  }
+  virtual double checked_spmv_dot(const cg_matrix *mat, const cg_vector *vec,
+                                  cg_vector *result)
+  {
+    return sell_spmv_dot<ElementECC<mode>, true>(mat, vec, result);
+  }
+  virtual double unchecked_spmv_dot(const cg_matrix *mat,
+                                    const cg_vector *vec,
+                                    cg_vector *result)
+  {
+    return sell_spmv_dot<ElementECC<mode>, false>(mat, vec, result);
+  }
+};
@@ -0,0 +1,66 @@
+#include "Scrubber.h"
+
+#include <chrono>
+#include <vector>
+
+Scrubber::Scrubber(unsigned size, int interval_ms, Sweep sweep, ErrorLog& log)
+  : size(size), interval_ms(interval_ms), sweep(sweep), log(log)
+{
+  corrections = 0;
+  stopping    = false;
+  thread      = std::thread(&Scrubber::run, this);
+}
+
+Scrubber::~Scrubber()
+{
+  {
+    std::lock_guard<std::mutex> guard(stop_lock);
+    stopping = true;
+  }
+  stop_signal.notify_one();
+  thread.join();
+}
+
+unsigned Scrubber::take_corrections()
+{
+  return corrections.exchange(0);
+}
+
+void Scrubber::run()
+{
+  // This thread records alongside the spmv kernels
+  ErrorLog::set_background_thread();
+
+  ErrorLog found;
+  std::unique_lock<std::mutex> guard(stop_lock);
+  while (!stopping)
+  {
+    for (unsigned first = 0; first < size && !stopping; first += SCRUB_BLOCK)
+    {
+      unsigned last = first + SCRUB_BLOCK < size ? first + SCRUB_BLOCK : size;
+
+      guard.unlock();
+      unsigned corrected = sweep(first, last, found);
+      forward_errors(found);
+      corrections += corrected;
+      guard.lock();
+    }
+
+    if (interval_ms > 0)
+      stop_signal.wait_for(guard, std::chrono::milliseconds(interval_ms));
+  }
+}
+
+void Scrubber::forward_errors(ErrorLog& found)
+{
+  std::vector<ErrorEvent> events;
+  found.take(events);
+  for (unsigned e = 0; e < events.size(); e++)
+  {
+    const ErrorEvent& event = events[e];
+    if (event.kind != ERROR_CORRECTED &&
+        !reported.insert(std::make_pair(event.source, event.index)).second)
+      continue;
+    log.record(event.kind, event.source, event.index, event.bit);
+  }
+}
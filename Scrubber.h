@@ -0,0 +1,71 @@
+//
+// Background scrubbing of an ECC-protected matrix
+//
+// A scrubber thread sweeps the matrix over and over, correcting single-bit
+// errors in place before a second flip in the same element makes them
+// uncorrectable, as a memory controller does for ECC DRAM. It shares the
+// matrix with the spmv kernels without any locks: a correction rewrites an
+// element with only the flipped bit changed, so a kernel reading it at the
+// same time sees either the corrupted or the corrected word, and counts on
+// the solver to roll back past any spmv that a correction came too late
+// for, as it does for errors found by a periodic check.
+//
+
+#ifndef SCRUBBER_H
+#define SCRUBBER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+
+#include "ErrorLog.h"
+
+// Number of rows or elements checked at a time, between which the scrubber
+// looks for a request to stop
+#define SCRUB_BLOCK 4096
+
+class Scrubber
+{
+public:
+  // Checks and corrects rows or elements [first, last) of the matrix,
+  // recording what it finds in log, and returns the number corrected
+  typedef std::function<unsigned(unsigned first, unsigned last,
+                                 ErrorLog& log)> Sweep;
+
+  // Start sweeping [0, size) with sweep, pausing interval_ms between sweeps
+  // (or not at all if 0), and recording the errors found in log
+  Scrubber(unsigned size, int interval_ms, Sweep sweep, ErrorLog& log);
+  // Stop the thread
+  ~Scrubber();
+
+  // Number of corrections made since the last call
+  unsigned take_corrections();
+
+private:
+  unsigned  size;
+  int       interval_ms;
+  Sweep     sweep;
+  ErrorLog& log;
+
+  std::atomic<unsigned>   corrections;
+  bool                    stopping;
+  std::mutex              stop_lock;
+  std::condition_variable stop_signal;
+  std::thread             thread;
+
+  // Errors that the scrubber cannot correct, which it only records the
+  // first time it finds them
+  std::set< std::pair<ErrorSource,uint32_t> > reported;
+
+  void run();
+  void forward_errors(ErrorLog& found);
+
+  Scrubber(const Scrubber&);
+  Scrubber& operator=(const Scrubber&);
+};
+
+#endif // SCRUBBER_H
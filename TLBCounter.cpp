@@ -0,0 +1,100 @@
+#include "TLBCounter.h"
+
+#include <cstring>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+  #include <linux/perf_event.h>
+  #include <sys/syscall.h>
+#endif
+
+#ifdef _OPENMP
+  #include <omp.h>
+#else
+  static inline int omp_get_thread_num() { return 0; }
+  static inline int omp_get_max_threads() { return 1; }
+#endif
+
+// Open a disabled counter of the calling thread's data TLB load misses in
+// user space, or return -1
+static int open_counter()
+{
+#ifndef __linux__
+  return -1;
+#else
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = PERF_TYPE_HW_CACHE;
+  attr.config         = PERF_COUNT_HW_CACHE_DTLB |
+                        PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                        PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+  attr.disabled       = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv     = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+TLBCounter::TLBCounter()
+{
+  fds.assign(omp_get_max_threads(), -1);
+#pragma omp parallel
+  fds[omp_get_thread_num()] = open_counter();
+
+  // Count either all threads or none
+  if (!available())
+  {
+    for (unsigned t = 0; t < fds.size(); t++)
+    {
+      if (fds[t] >= 0)
+        close(fds[t]);
+    }
+    fds.clear();
+  }
+}
+
+TLBCounter::~TLBCounter()
+{
+  for (unsigned t = 0; t < fds.size(); t++)
+    close(fds[t]);
+}
+
+bool TLBCounter::available() const
+{
+  for (unsigned t = 0; t < fds.size(); t++)
+  {
+    if (fds[t] < 0)
+      return false;
+  }
+  return !fds.empty();
+}
+
+void TLBCounter::start()
+{
+#ifdef __linux__
+  for (unsigned t = 0; t < fds.size(); t++)
+    ioctl(fds[t], PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+void TLBCounter::stop()
+{
+#ifdef __linux__
+  for (unsigned t = 0; t < fds.size(); t++)
+    ioctl(fds[t], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+uint64_t TLBCounter::misses() const
+{
+  uint64_t total = 0;
+  for (unsigned t = 0; t < fds.size(); t++)
+  {
+    uint64_t count;
+    if (read(fds[t], &count, sizeof(count)) == sizeof(count))
+      total += count;
+  }
+  return total;
+}
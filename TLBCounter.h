@@ -0,0 +1,38 @@
+//
+// Count of the data TLB misses taken by the OpenMP threads
+//
+// Opens a hardware counter for each thread of the OpenMP team, which stays
+// attached to the thread as libgomp reuses it for later parallel regions.
+// Virtual machines often expose no such counter, in which case available()
+// is false and the count stays zero.
+//
+
+#ifndef TLBCOUNTER_H
+#define TLBCOUNTER_H
+
+#include <cstdint>
+#include <vector>
+
+class TLBCounter
+{
+public:
+  TLBCounter();
+  ~TLBCounter();
+
+  bool available() const;
+
+  // Count the misses taken between start() and stop()
+  void start();
+  void stop();
+
+  // Data TLB load misses counted so far, over all threads
+  uint64_t misses() const;
+
+private:
+  std::vector<int> fds;
+
+  TLBCounter(const TLBCounter&);
+  TLBCounter& operator=(const TLBCounter&);
+};
+
+#endif // TLBCOUNTER_H
@@ -0,0 +1,299 @@
+//
+// Checksum-based ABFT for dense vectors
+//
+// A protected vector is split into blocks of CHECKSUM_BLOCK elements, each
+// with a plain sum, an index-weighted sum (with weights no larger than 1, so
+// that it cannot overflow when the plain sum does not) and a sum of
+// magnitudes. A block whose sum no longer matches has a single corrupted
+// element, located from the ratio of the weighted and plain differences and
+// restored from the sum of the others.
+//
+
+#include <atomic>
+#include <cmath>
+#include <stdint.h>
+#include <thread>
+
+#include "ErrorLog.h"
+
+#define CHECKSUM_BLOCK 64
+
+// Weight of element i of a block in the weighted sum
+#define CHECKSUM_WEIGHT(i) (((i)+1) / (double)CHECKSUM_BLOCK)
+
+// Sums may differ from their checksum by this much (relative to the sum of
+// magnitudes) from rounding alone
+#define CHECKSUM_TOLERANCE 1e-10
+
+struct vector_checksum
+{
+  double sum;
+  double weighted;
+  double abs;
+};
+
+static inline int checksum_blocks(int N)
+{
+  return (N + CHECKSUM_BLOCK - 1) / CHECKSUM_BLOCK;
+}
+
+// Recompute the checksum of block b
+static inline void checksum_block(const double *data, int N,
+                                  vector_checksum *checksums, int b)
+{
+  int start = b*CHECKSUM_BLOCK;
+  int end   = start + CHECKSUM_BLOCK < N ? start + CHECKSUM_BLOCK : N;
+
+  double sum = 0.0, weighted = 0.0, abs = 0.0;
+#pragma omp simd reduction(+:sum,weighted,abs)
+  for (int i = start; i < end; i++)
+  {
+    sum      += data[i];
+    weighted += CHECKSUM_WEIGHT(i-start) * data[i];
+    abs      += fabs(data[i]);
+  }
+
+  checksums[b].sum      = sum;
+  checksums[b].weighted = weighted;
+  checksums[b].abs      = abs;
+}
+
+// Check block b against its checksum, correcting a single corrupted element
+// and recording what it finds in log. Returns 1 if it was corrected.
+static inline unsigned verify_block(double *data, int N,
+                                    const vector_checksum *checksums, int b,
+                                    ErrorLog& log)
+{
+  int start = b*CHECKSUM_BLOCK;
+  int end   = start + CHECKSUM_BLOCK < N ? start + CHECKSUM_BLOCK : N;
+
+  double sum = 0.0;
+#pragma omp simd reduction(+:sum)
+  for (int i = start; i < end; i++)
+  {
+    sum += data[i];
+  }
+
+  // (written so that a NaN counts as an error)
+  double diff = sum - checksums[b].sum;
+  if (fabs(diff) <= CHECKSUM_TOLERANCE * checksums[b].abs)
+    return 0;
+
+  // Locate the corrupted element
+  int k = -1;
+  if (std::isfinite(diff))
+  {
+    double weighted = 0.0;
+    for (int i = start; i < end; i++)
+      weighted += CHECKSUM_WEIGHT(i-start) * data[i];
+    double ratio = (weighted - checksums[b].weighted) / diff;
+    k = start + lround(ratio * CHECKSUM_BLOCK) - 1;
+  }
+  else
+  {
+    for (int i = start; i < end && k < 0; i++)
+      k = std::isfinite(data[i]) ? -1 : i;
+  }
+  if (k < start || k >= end)
+  {
+    log.record(ERROR_UNCORRECTABLE, ERROR_VECTOR_CHECKSUM, b);
+    return 0;
+  }
+
+  // Restore it from the other elements
+  double others = 0.0;
+  for (int i = start; i < end; i++)
+    others += i == k ? 0.0 : data[i];
+  data[k] = checksums[b].sum - others;
+
+  log.record(ERROR_CORRECTED, ERROR_VECTOR_CHECKSUM, k);
+  return 1;
+}
+
+static inline void checksum_vector(const double *data, int N,
+                                   vector_checksum *checksums)
+{
+#pragma omp parallel for
+  for (int b = 0; b < checksum_blocks(N); b++)
+  {
+    checksum_block(data, N, checksums, b);
+  }
+}
+
+static inline unsigned verify_vector(double *data, int N,
+                                     const vector_checksum *checksums,
+                                     ErrorLog& log)
+{
+  unsigned corrected = 0;
+#pragma omp parallel for reduction(+:corrected)
+  for (int b = 0; b < checksum_blocks(N); b++)
+  {
+    corrected += verify_block(data, N, checksums, b, log);
+  }
+  return corrected;
+}
+
+// Rows (or COO elements) that an spmv kernel multiplies at a time. Before
+// each chunk it verifies the blocks of the vector that the chunk gathers
+// from, and after it checksums the blocks of the result that the chunk
+// wrote, while they are still in cache, so that the guards below stay out of
+// its inner loops.
+#define CHECKSUM_CHUNK (8*CHECKSUM_BLOCK)
+
+// Verifies the blocks of a protected vector as an spmv kernel first gathers
+// from them, in place of a pass over the whole vector before the kernel.
+// Each thread keeps its own guard, holding the range of blocks that it has
+// seen verified, so that a gather inside the range costs one comparison.
+// The threads claim each block through its entry in states (0 unverified,
+// 1 being verified, 2 verified), so that it is verified exactly once, and
+// before any of them reads it. A guard of an unprotected vector (with no
+// checksums) covers every index.
+struct checksum_gather
+{
+  double                     *data;
+  int                         N;
+  const vector_checksum      *checksums;
+  std::atomic<unsigned char> *states;
+  ErrorLog                   *log;
+
+  // Offset of the slice of data that the kernel indexes, and the verified
+  // range of the slice (whose start may be before it, modulo 2^32)
+  uint32_t offset;
+  uint32_t lo;
+  uint32_t span;
+
+  // Called with an index into the slice before reading the element
+  inline void check(uint32_t i)
+  {
+    if (i - lo >= span)
+      widen(i);
+  }
+
+  // Verify the blocks up to the one holding element i, and add them to the
+  // range. An index outside the vector is left for the matrix checks.
+  void widen(uint32_t i)
+  {
+    uint64_t g = (uint64_t)offset + i;
+    if (checksums == NULL || g >= (uint64_t)N)
+      return;
+
+    int b     = g / CHECKSUM_BLOCK;
+    int first = b, last = b;
+    if (span)
+    {
+      first = (offset + lo) / CHECKSUM_BLOCK;
+      last  = (offset + lo + span - 1) / CHECKSUM_BLOCK;
+      for (int v = b; v < first; v++)
+        verify(v);
+      for (int v = last + 1; v <= b; v++)
+        verify(v);
+      first = b < first ? b : first;
+      last  = b > last ? b : last;
+    }
+    else
+    {
+      verify(b);
+    }
+
+    int end = (last+1)*CHECKSUM_BLOCK < N ? (last+1)*CHECKSUM_BLOCK : N;
+    lo   = first*CHECKSUM_BLOCK - offset;
+    span = end - first*CHECKSUM_BLOCK;
+  }
+
+  void verify(int b)
+  {
+    unsigned char unverified = 0;
+    if (states[b].compare_exchange_strong(unverified, 1,
+                                          std::memory_order_acquire))
+    {
+      verify_block(data, N, checksums, b, *log);
+      states[b].store(2, std::memory_order_release);
+      return;
+    }
+    while (states[b].load(std::memory_order_acquire) != 2)
+      std::this_thread::yield();
+  }
+};
+
+static inline checksum_gather begin_gather(double *data, int N,
+                                           const vector_checksum *checksums,
+                                           std::atomic<unsigned char> *states,
+                                           ErrorLog& log, uint32_t offset)
+{
+  checksum_gather gather = {data, N, checksums, states, &log, offset,
+                            0, checksums ? 0 : UINT32_MAX};
+  return gather;
+}
+
+// Checksums the blocks of a protected vector as an spmv kernel writes them,
+// in place of a pass over the whole vector after the kernel. Each thread
+// keeps its own guard, and checksums the blocks that its rows cover whole
+// (marking them in done), while the blocks that the threads (or the slices
+// of the vector) share are left for finish_rows to checksum once the kernel
+// has written all of them.
+struct checksum_rows
+{
+  const double    *data;
+  int              N;
+  vector_checksum *checksums;
+  unsigned char   *done;
+
+  // Offset of the slice of data that the kernel indexes, and the end (in
+  // the slice) of the rows written so far
+  uint32_t offset;
+  uint32_t end;
+
+  // Called as the thread's rows take their final values, with [first, last)
+  // the rows final so far, whose end never moves back. Checksums the blocks
+  // that now lie wholly inside them.
+  void written(uint32_t first, uint32_t last)
+  {
+    if (checksums == NULL || first >= last)
+      return;
+
+    uint64_t start = (uint64_t)offset + first;
+    uint64_t stop  = (uint64_t)offset + last;
+    uint64_t b     = (start + CHECKSUM_BLOCK - 1) / CHECKSUM_BLOCK;
+    if (b < ((uint64_t)offset + end) / CHECKSUM_BLOCK)
+      b = ((uint64_t)offset + end) / CHECKSUM_BLOCK;
+    for (; b*CHECKSUM_BLOCK < (uint64_t)N; b++)
+    {
+      uint64_t block_end = (b+1)*CHECKSUM_BLOCK < (uint64_t)N
+                         ? (b+1)*CHECKSUM_BLOCK : N;
+      if (block_end > stop)
+        break;
+      checksum_block(data, N, checksums, b);
+      done[b] = 1;
+    }
+    end = last;
+  }
+};
+
+static inline checksum_rows begin_rows(const double *data, int N,
+                                       vector_checksum *checksums,
+                                       unsigned char *done, uint32_t offset)
+{
+  checksum_rows rows = {data, N, checksums, done, offset, 0};
+  return rows;
+}
+
+// Checksum the blocks that the threads of a kernel left unmarked in done,
+// clearing done for the next kernel
+static inline void finish_rows(const double *data, int N,
+                               vector_checksum *checksums,
+                               unsigned char *done)
+{
+  for (int b = 0; b < checksum_blocks(N); b++)
+  {
+    if (!done[b])
+      checksum_block(data, N, checksums, b);
+    done[b] = 0;
+  }
+}
+
+// Forget which blocks were verified, for the next kernel
+static inline void finish_gather(std::atomic<unsigned char> *states, int N)
+{
+  for (int b = 0; b < checksum_blocks(N); b++)
+    states[b].store(0, std::memory_order_relaxed);
+}
@@ -8,31 +8,130 @@
 #include <cstring>
 #include <ctime>
 #include <sys/time.h>
+#include <vector>
 
 #include "CGContext.h"
+#include "MatrixCache.h"
+#include "MatrixMarket.h"
+#include "TLBCounter.h"
 
-extern "C"
-{
-  #include "mmio.h"
-}
+// What to do when the checks find an error that they cannot correct
+enum ErrorPolicy {ON_ERROR_ABORT, ON_ERROR_CONTINUE, ON_ERROR_ROLLBACK};
 
 struct
 {
   int    num_blocks;
+  bool   implicit_blocks; // store the block once, rather than num_blocks times
   int    max_itrs;       // max iterations to run
   double conv_threshold; // convergence threshold to stop CG
   const char *matrix_file;
+  const char *matrix_cache; // where to cache the encoded matrix, if set
 
   const char *target;
   const char *mode;
 
   int    num_bit_flips;  // number of bits to flip in a matrix element
   CGContext::BitFlipKind bitflip_kind;
+  bool   bitflip_vector; // flip the bits in an element of p rather than A
+
+  int    check_interval; // number of spmvs per matrix check
+  int    checkpoint_interval; // min iterations between checkpoints
+  int    residual_interval;   // iterations per true residual check
+  int    scrub_interval; // ms between scrubber sweeps, or -1 for none
+  bool   vector_checksums;
+  bool   krylov_checks;  // check the CG invariants every iteration
+  bool   numa_replication;
+  bool   report_huge_pages; // print the huge page and TLB miss report
+  HugePages huge_pages;
+  bool   report_bandwidth; // print the estimated spmv bandwidth per node
+  ErrorPolicy on_error;
+
+  int    log_level;      // 0 = quiet, 1 = rr, 2 = rr, alpha and beta
+  int    log_interval;   // number of iterations per log line
+  const char *history_file; // where to write the residual history, if set
 } params;
 
+// Number of iterations that failed the invariant checks
+static unsigned num_violations = 0;
+
+// The matrix as read from the input file, kept to restore a corrupted copy,
+// or the cache that it was mapped from
+struct matrix_source
+{
+  uint32_t *columns;
+  uint32_t *rows;
+  double   *values;
+
+  matrix_cache *cache;
+};
+
+// Copy of the solver state at the start of an iteration. There are two
+// buffers, so that a fault while taking a checkpoint never loses the last
+// complete one.
+struct cg_checkpoint
+{
+  cg_vector *x[2];
+  cg_vector *r[2];
+  cg_vector *p[2];
+  double     rr[2];
+  int        itr[2];
+  int        current; // buffer holding the last complete checkpoint
+  bool       pending; // whether the other buffer awaits confirmation
+
+  unsigned num_taken, num_restored;
+  double   time_taken, time_restored; // microseconds
+};
+
+// Largest drift between the recurrence and true residuals, relative to the
+// size of b, that the solver accepts before replacing r
+#define RESIDUAL_DRIFT_TOLERANCE 1e-6
+
+// Largest cosine of the angle between consecutive residuals, which CG keeps
+// orthogonal, that the invariant checks accept
+#define ORTHOGONALITY_TOLERANCE 1e-8
+
+// One iteration of the residual history
+struct history_entry
+{
+  int    itr;
+  double rr;
+  double alpha;
+  double beta;
+  double time;  // microseconds since the start of the solve
+};
+
 double            get_timestamp();
+static void       write_history(const char *filename,
+                                const std::vector<history_entry>& history);
+static bool       handle_errors(CGContext *context, bool *matrix_damaged);
+static bool       check_invariants(int itr, double rr, double rr_new,
+                                   double pw, double wr, double alpha,
+                                   double beta);
+static bool       replace_residual(CGContext *context, const cg_matrix *A,
+                                   const cg_vector *b, const cg_vector *x,
+                                   cg_vector *r, cg_vector *p, cg_vector *w,
+                                   double *rr);
+static double     restart(CGContext *context, const cg_matrix *A,
+                          const cg_vector *b, const cg_vector *x,
+                          cg_vector *r, cg_vector *p, cg_vector *w);
+static cg_checkpoint* create_checkpoint(CGContext *context, int N);
+static void       destroy_checkpoint(CGContext *context, cg_checkpoint *cp);
+static void       take_checkpoint(CGContext *context, cg_checkpoint *cp,
+                                  const cg_vector *x, const cg_vector *r,
+                                  const cg_vector *p, double rr, int itr,
+                                  bool confirm);
+static void       confirm_checkpoint(cg_checkpoint *cp);
+static double     rollback(CGContext *context, cg_checkpoint *cp,
+                           cg_vector *x, cg_vector *r, cg_vector *p,
+                           int *itr, std::vector<history_entry> *history);
+static cg_matrix* restore_matrix(CGContext *context, cg_checkpoint *cp,
+                                 cg_matrix *A, matrix_source *source,
+                                 int N, int nnz);
 static cg_matrix* load_sparse_matrix(CGContext *context, const char *filename,
-                                     int num_blocks, int *N, int *nnz);
+                                     int num_blocks, int *N, int *nnz,
+                                     matrix_source *source);
+static cg_matrix* map_cached_matrix(CGContext *context, int *N, int *nnz,
+                                    matrix_source *source);
 void              parse_arguments(int argc, char *argv[]);
 
 int main(int argc, char *argv[])
@@ -41,9 +140,30 @@ int main(int argc, char *argv[])
 
   CGContext *context = CGContext::create(params.target, params.mode);
 
+  context->set_vector_checksums(params.vector_checksums);
+  context->set_numa_replication(params.numa_replication);
+  context->set_huge_pages(params.huge_pages);
+  context->set_scrub_interval(params.scrub_interval);
+
+  // Keep the input to restore the matrix from if rolling back on errors,
+  // unless the matrix is mapped from a cache, which it is restored from
   int N, nnz;
-  cg_matrix *A = load_sparse_matrix(context, params.matrix_file,
-                                    params.num_blocks, &N, &nnz);
+  matrix_source source = {NULL, NULL, NULL, NULL};
+  bool keep_source = params.on_error == ON_ERROR_ROLLBACK;
+  double load_start = get_timestamp();
+  cg_matrix *A = NULL;
+  if (params.matrix_cache)
+    A = map_cached_matrix(context, &N, &nnz, &source);
+  if (A == NULL)
+  {
+    A = load_sparse_matrix(context, params.matrix_file, params.num_blocks,
+                           &N, &nnz, keep_source ? &source : NULL);
+    if (params.matrix_cache)
+      write_matrix_cache(params.matrix_cache, params.matrix_file,
+                         params.target, params.mode, params.num_blocks,
+                         context, A, N, nnz);
+  }
+  double load_time = get_timestamp() - load_start;
 
   printf("\n");
   int block_size = N/params.num_blocks;
@@ -54,6 +174,9 @@ int main(int argc, char *argv[])
          nnz, nnz/((double)N*(double)N)*100);
   printf("maximum iterations    = %u\n", params.max_itrs);
   printf("convergence threshold = %g\n", params.conv_threshold);
+  if (params.matrix_cache)
+    printf("matrix cache          = %s (%.2lf ms)\n",
+           source.cache ? "mapped" : "written", load_time*1e-3);
   printf("\n");
 
   cg_vector *b = context->create_vector(N);
@@ -77,9 +200,25 @@ int main(int argc, char *argv[])
   if (params.num_bit_flips)
   {
     srand(time(NULL));
-    context->inject_bitflip(A, params.bitflip_kind, params.num_bit_flips);
+    if (!params.bitflip_vector)
+      context->inject_bitflip(A, params.bitflip_kind, params.num_bit_flips);
   }
 
+  // Checkpoints of the solver state from iterations whose matrix check
+  // passed, to roll back to when a periodic check corrects errors that the
+  // unchecked spmvs before it may have used, or when a check finds errors
+  // that it cannot correct
+  cg_checkpoint *checkpoint = NULL;
+  bool periodic = params.check_interval > 1;
+  context->set_check_interval(params.check_interval);
+  if (periodic || params.on_error == ON_ERROR_ROLLBACK)
+    checkpoint = create_checkpoint(context, N);
+
+  // (opened before timing, as it starts a parallel region)
+  TLBCounter *tlb = params.report_huge_pages ? new TLBCounter : NULL;
+  if (tlb)
+    tlb->start();
+
   double start = get_timestamp();
 
   // r = b - Ax
@@ -87,43 +226,161 @@ int main(int argc, char *argv[])
   context->copy_vector(r, b); // Ax is all zero, if x is all zero
   context->copy_vector(p, r);
 
+  // A bit-flip in a vector goes into p, for the first spmv to gather
+  if (params.num_bit_flips && params.bitflip_vector)
+    context->inject_vector_bitflip(p, params.num_bit_flips);
+
   // rr = rT * r
   double rr = context->dot(r, r);
 
+  // The history is only written out once the solve has been timed
+  std::vector<history_entry> history;
+  if (params.history_file)
+    history.reserve(params.max_itrs);
+
   int itr = 0;
-  for (; itr < params.max_itrs && rr > params.conv_threshold; itr++)
+  if (checkpoint)
+    take_checkpoint(context, checkpoint, x, r, p, rr, itr, true);
+
+  bool verified;
+  bool matrix_damaged;
+  do
   {
-    // w = A*p
-    context->spmv(A, p, w);
+    for (; itr < params.max_itrs && rr > params.conv_threshold; itr++)
+    {
+      // w = A*p
+      // pw = pT * A*p
+      context->set_iteration(itr);
+      double pw = context->spmv_dot(A, p, w);
+      bool roll_back = handle_errors(context, &matrix_damaged);
 
-    // pw = pT * A*p
-    double pw = context->dot(p, w);
+      if (checkpoint)
+      {
+        CGContext::CheckResult check = context->last_check();
+        if (roll_back || (periodic && check == CGContext::CHECK_CORRECTED))
+        {
+          if (matrix_damaged)
+            A = restore_matrix(context, checkpoint, A, &source, N, nnz);
+          rr = rollback(context, checkpoint, x, r, p, &itr, &history);
+          itr--;
+          continue;
+        }
+        else if (check == CGContext::CHECK_PASSED &&
+                 itr - checkpoint->itr[checkpoint->current] >=
+                   params.checkpoint_interval)
+        {
+          // Nothing has touched the matrix since the previous check passed.
+          // The invariant checks can only tell whether the previous
+          // iteration used a damaged matrix from this one, so the
+          // checkpoint waits for them.
+          take_checkpoint(context, checkpoint, x, r, p, rr, itr,
+                          !params.krylov_checks);
+        }
+      }
 
-    double alpha = rr / pw;
+      double alpha = rr / pw;
 
-    // x = x + alpha * p
-    // r = r - alpha * A*p
-    // rr_new = rT * r
-    double rr_new = context->calc_xr(x, r, p, w, alpha);
+      // x = x + alpha * p
+      // r = r - alpha * A*p
+      // rr_new = rT * r
+      // wr = wT * r (before the update, for the invariant checks)
+      double wr = 0.0;
+      double rr_new = params.krylov_checks ?
+        context->calc_xr_wr(x, r, p, w, alpha, &wr) :
+        context->calc_xr(x, r, p, w, alpha);
 
-    double beta = rr_new / rr;
+      double beta = rr_new / rr;
 
-    // p = r + beta * p
-    context->calc_p(p, r, beta);
+      // p = r + beta * p
+      context->calc_p(p, r, beta);
+
+      // An error that no check caught may still show up as a step that CG
+      // would never take, which also means the matrix may be damaged
+      bool passed = !params.krylov_checks ||
+        check_invariants(itr, rr, rr_new, pw, wr, alpha, beta);
+      bool violated = !passed && params.on_error == ON_ERROR_ROLLBACK;
+      if ((handle_errors(context, &matrix_damaged) || violated) && checkpoint)
+      {
+        matrix_damaged |= violated;
+        if (matrix_damaged)
+          A = restore_matrix(context, checkpoint, A, &source, N, nnz);
+        rr = rollback(context, checkpoint, x, r, p, &itr, &history);
+        if (violated)
+          rr = restart(context, A, b, x, r, p, w);
+        itr--;
+        continue;
+      }
+      if (checkpoint && passed)
+        confirm_checkpoint(checkpoint);
 
-    rr = rr_new;
+      rr = rr_new;
 
-    if (itr % 1 == 0)
-      printf("iteration %5u :  rr = %12.4lf\n", itr, rr);
-  }
+      if (params.history_file)
+      {
+        history_entry entry = {itr, rr, alpha, beta, get_timestamp() - start};
+        history.push_back(entry);
+      }
+
+      if (params.log_level && itr % params.log_interval == 0)
+      {
+        if (params.log_level > 1)
+          printf("iteration %5u :  rr = %12.4lf  alpha = %10.4le"
+                 "  beta = %10.4le\n", itr, rr, alpha, beta);
+        else
+          printf("iteration %5u :  rr = %12.4lf\n", itr, rr);
+      }
+
+      // Catch silent errors in the vectors, which make the recurrence
+      // residual drift away from the true one
+      if (params.residual_interval && (itr+1) % params.residual_interval == 0)
+      {
+        replace_residual(context, A, b, x, r, p, w, &rr);
+
+        bool roll_back = handle_errors(context, &matrix_damaged);
+        if (checkpoint &&
+            (roll_back ||
+             (periodic && context->last_check() == CGContext::CHECK_CORRECTED)))
+        {
+          if (matrix_damaged)
+            A = restore_matrix(context, checkpoint, A, &source, N, nnz);
+          rr = rollback(context, checkpoint, x, r, p, &itr, &history);
+          itr--;
+          continue;
+        }
+      }
+    }
+
+    // Make sure the matrix has not been corrupted since the last check
+    verified = true;
+    if (periodic)
+    {
+      context->set_check_interval(1);
+      context->spmv(A, p, w);
+      context->set_check_interval(params.check_interval);
+      bool roll_back = handle_errors(context, &matrix_damaged);
+      if (roll_back ||
+          context->last_check() == CGContext::CHECK_CORRECTED)
+      {
+        if (matrix_damaged)
+          A = restore_matrix(context, checkpoint, A, &source, N, nnz);
+        rr = rollback(context, checkpoint, x, r, p, &itr, &history);
+        verified = false;
+      }
+    }
+  } while (!verified);
 
   double end = get_timestamp();
+  if (tlb)
+    tlb->stop();
 
   printf("\n");
   printf("ran for %u iterations\n", itr);
 
   printf("\ntime taken = %7.2lf ms\n\n", (end-start)*1e-3);
 
+  if (params.history_file)
+    write_history(params.history_file, history);
+
   // Compute r = Ax
   context->spmv(A, x, r);
 
@@ -140,22 +397,355 @@ int main(int argc, char *argv[])
   }
   context->unmap_vector(b, h_b);
   context->unmap_vector(r, h_r);
+  handle_errors(context, NULL);
   printf("total error = %lf\n", sqrt(err_sq));
   printf("max error   = %lf\n", max_err);
   printf("\n");
 
+  unsigned corrected     = context->num_errors(ERROR_CORRECTED);
+  unsigned detected      = context->num_errors(ERROR_DETECTED);
+  unsigned uncorrectable = context->num_errors(ERROR_UNCORRECTABLE);
+  if (corrected || detected || uncorrectable)
+  {
+    printf("errors corrected     = %u\n", corrected);
+    printf("errors detected      = %u\n", detected);
+    printf("errors uncorrectable = %u\n", uncorrectable);
+    printf("\n");
+  }
+
+  if (params.krylov_checks)
+  {
+    printf("invariant violations = %u\n", num_violations);
+    printf("\n");
+  }
+
+  if (params.report_bandwidth)
+  {
+    std::vector<int> nodes;
+    std::vector<double> bandwidth;
+    context->spmv_bandwidth(nodes, bandwidth);
+    if (nodes.empty())
+      printf("spmv bandwidth not estimated by this implementation\n");
+    for (unsigned n = 0; n < nodes.size(); n++)
+      printf("spmv bandwidth node %d = %.2lf GB/s (estimated)\n",
+             nodes[n], bandwidth[n]);
+    printf("\n");
+  }
+
+  if (tlb)
+  {
+    size_t mapped, huge;
+    context->huge_page_usage(&mapped, &huge);
+    printf("huge pages           = %.1lf of %.1lf MiB mapped\n",
+           huge/1048576.0, mapped/1048576.0);
+    if (tlb->available())
+      printf("dTLB load misses     = %llu\n",
+             (unsigned long long)tlb->misses());
+    else
+      printf("dTLB load misses     = not available\n");
+    printf("\n");
+    delete tlb;
+  }
+
+  if (checkpoint)
+  {
+    printf("checkpoints taken    = %u (%.2lf ms)\n",
+           checkpoint->num_taken, checkpoint->time_taken*1e-3);
+    printf("rollbacks            = %u (%.2lf ms)\n",
+           checkpoint->num_restored, checkpoint->time_restored*1e-3);
+    printf("\n");
+  }
+
   context->destroy_matrix(A);
+  if (source.cache)
+    close_matrix_cache(source.cache);
   context->destroy_vector(b);
   context->destroy_vector(x);
   context->destroy_vector(r);
   context->destroy_vector(p);
   context->destroy_vector(w);
+  if (checkpoint)
+    destroy_checkpoint(context, checkpoint);
+  if (keep_source)
+  {
+    delete[] source.columns;
+    delete[] source.rows;
+    delete[] source.values;
+  }
 
   delete context;
 
   return 0;
 }
 
+cg_checkpoint* create_checkpoint(CGContext *context, int N)
+{
+  cg_checkpoint *cp = new cg_checkpoint;
+  for (int i = 0; i < 2; i++)
+  {
+    cp->x[i]   = context->create_vector(N);
+    cp->r[i]   = context->create_vector(N);
+    cp->p[i]   = context->create_vector(N);
+    cp->rr[i]  = 0.0;
+    cp->itr[i] = 0;
+  }
+  cp->current       = 0;
+  cp->pending       = false;
+  cp->num_taken     = 0;
+  cp->num_restored  = 0;
+  cp->time_taken    = 0.0;
+  cp->time_restored = 0.0;
+  return cp;
+}
+
+void destroy_checkpoint(CGContext *context, cg_checkpoint *cp)
+{
+  for (int i = 0; i < 2; i++)
+  {
+    context->destroy_vector(cp->x[i]);
+    context->destroy_vector(cp->r[i]);
+    context->destroy_vector(cp->p[i]);
+  }
+  delete cp;
+}
+
+// Save the state at the start of iteration itr in the spare buffer, and
+// only then make it the current checkpoint, or leave it pending until
+// confirm_checkpoint if not confirm
+void take_checkpoint(CGContext *context, cg_checkpoint *cp,
+                     const cg_vector *x, const cg_vector *r,
+                     const cg_vector *p, double rr, int itr, bool confirm)
+{
+  double start = get_timestamp();
+
+  int next = 1 - cp->current;
+  context->copy_vector(cp->x[next], x);
+  context->copy_vector(cp->r[next], r);
+  context->copy_vector(cp->p[next], p);
+  cp->rr[next]  = rr;
+  cp->itr[next] = itr;
+  cp->pending   = true;
+  if (confirm)
+    confirm_checkpoint(cp);
+
+  cp->num_taken++;
+  cp->time_taken += get_timestamp() - start;
+}
+
+// Make the pending checkpoint, if any, the current one
+void confirm_checkpoint(cg_checkpoint *cp)
+{
+  if (cp->pending)
+  {
+    cp->current = 1 - cp->current;
+    cp->pending = false;
+  }
+}
+
+// Restore the state from the last checkpoint after a check has found
+// errors that the spmvs before it may have used, setting itr to the
+// iteration to resume from and dropping the history of the iterations
+// that will run again. Returns the restored rr.
+double rollback(CGContext *context, cg_checkpoint *cp,
+                cg_vector *x, cg_vector *r, cg_vector *p, int *itr,
+                std::vector<history_entry> *history)
+{
+  double start = get_timestamp();
+
+  int c = cp->current;
+  printf("rolling back to iteration %d\n", cp->itr[c]);
+  cp->pending = false;
+
+  context->copy_vector(x, cp->x[c]);
+  context->copy_vector(r, cp->r[c]);
+  context->copy_vector(p, cp->p[c]);
+  *itr = cp->itr[c];
+  while (!history->empty() && history->back().itr >= *itr)
+    history->pop_back();
+
+  cp->num_restored++;
+  cp->time_restored += get_timestamp() - start;
+  return cp->rr[c];
+}
+
+// Re-create a matrix that has errors the checks could not correct from the
+// input it was read from, counting the time as part of the rollback
+cg_matrix* restore_matrix(CGContext *context, cg_checkpoint *cp,
+                          cg_matrix *A, matrix_source *source,
+                          int N, int nnz)
+{
+  double start = get_timestamp();
+
+  printf("restoring matrix\n");
+  context->destroy_matrix(A);
+  if (source->cache)
+  {
+    // The private mapping holds the corruption, so map the file afresh
+    close_matrix_cache(source->cache);
+    A = map_cached_matrix(context, &N, &nnz, source);
+    if (A == NULL)
+    {
+      printf("Failed to restore the matrix from its cache\n");
+      exit(1);
+    }
+  }
+  else if (params.implicit_blocks)
+  {
+    A = context->create_block_matrix(source->columns, source->rows,
+                                     source->values, N/params.num_blocks,
+                                     nnz/params.num_blocks,
+                                     params.num_blocks);
+  }
+  else
+  {
+    A = context->create_matrix(source->columns, source->rows, source->values,
+                               N, nnz);
+  }
+
+  cp->time_restored += get_timestamp() - start;
+  return A;
+}
+
+// Compare r with the true residual b - Ax, computed in w, and replace it if
+// they have drifted apart, restarting from p = r. Returns whether it did.
+bool replace_residual(CGContext *context, const cg_matrix *A,
+                      const cg_vector *b, const cg_vector *x,
+                      cg_vector *r, cg_vector *p, cg_vector *w, double *rr)
+{
+  // w = r - (b - Ax)
+  context->spmv(A, x, w);
+  context->calc_p(w, b, -1.0);
+  context->calc_p(w, r, -1.0);
+
+  // Rounding leaves the two apart by a few ulps of b and Ax however small r
+  // gets, so the drift is measured against b (as van der Vorst and Ye do),
+  // not r, which ordinary rounding would soon cross as r shrinks
+  // (written so that a NaN counts as drift)
+  double drift = sqrt(context->dot(w, w) / context->dot(b, b));
+  if (drift <= RESIDUAL_DRIFT_TOLERANCE)
+    return false;
+
+  printf("replacing residual (drift = %g)\n", drift);
+
+  // r = r - w
+  // p = r
+  // (calc_xr is only used for its r update, p is overwritten afterwards)
+  *rr = context->calc_xr(p, r, w, w, 1.0);
+  context->copy_vector(p, r);
+  return true;
+}
+
+// Restart from r = p = b - Ax (using w), returning the new rr. A damaged
+// matrix can take a few iterations to break the invariants, so the r and p
+// rolled back to after a violation may still be inconsistent with the
+// restored one, but any x is a valid place to start CG from.
+double restart(CGContext *context, const cg_matrix *A, const cg_vector *b,
+               const cg_vector *x, cg_vector *r, cg_vector *p, cg_vector *w)
+{
+  printf("restarting from the true residual\n");
+
+  // w = b - Ax
+  context->spmv(A, x, w);
+  context->calc_p(w, b, -1.0);
+
+  context->copy_vector(r, w);
+  context->copy_vector(p, w);
+  return context->dot(r, r);
+}
+
+// Print the errors that the context has found since the last call, and
+// apply the error policy to any that were not corrected. Returns whether
+// the solver should roll back for them, and sets matrix_damaged (if given)
+// to whether it should also restore the matrix.
+bool handle_errors(CGContext *context, bool *matrix_damaged)
+{
+  static std::vector<ErrorEvent> events;
+  events.clear();
+  context->take_errors(events);
+
+  bool uncorrected = false, damaged = false;
+  for (unsigned i = 0; i < events.size(); i++)
+  {
+    print_error_event(events[i]);
+    if (events[i].kind != ERROR_CORRECTED)
+    {
+      uncorrected = true;
+      damaged |= events[i].source != ERROR_VECTOR_CHECKSUM;
+    }
+  }
+
+  if (uncorrected && params.on_error == ON_ERROR_ABORT)
+    exit(1);
+
+  // Otherwise the errors stay contained, unless the policy is to roll back
+  bool roll_back = uncorrected && params.on_error == ON_ERROR_ROLLBACK;
+  if (matrix_damaged)
+    *matrix_damaged = roll_back && damaged;
+  return roll_back;
+}
+
+// Check the invariants that CG keeps in exact arithmetic over one
+// iteration, given its scalars and wr = wT * r from before the update:
+// - pw > 0, as A is positive definite, and so alpha > 0
+// - beta >= 0
+// - the new residual is orthogonal to the old one. This needs no extra
+//   reduction, as r_newT * r = rr - alpha * wr.
+// Prints and counts a violation, and applies the error policy to it.
+// Returns whether the iteration passed.
+bool check_invariants(int itr, double rr, double rr_new, double pw,
+                      double wr, double alpha, double beta)
+{
+  // (written so that a NaN counts as a violation)
+  double cosine = fabs(rr - alpha*wr) / sqrt(rr * rr_new);
+  if (pw > 0 && alpha > 0 && alpha < INFINITY &&
+      beta >= 0 && beta < INFINITY &&
+      (rr_new == 0 || cosine <= ORTHOGONALITY_TOLERANCE))
+    return true;
+
+  printf("[ABFT] CG invariant violated at iteration %d\n", itr);
+  num_violations++;
+
+  if (params.on_error == ON_ERROR_ABORT)
+    exit(1);
+  return false;
+}
+
+// Write the residual history as JSON if filename ends in .json, or as CSV
+void write_history(const char *filename,
+                   const std::vector<history_entry>& history)
+{
+  FILE *file = fopen(filename, "w");
+  if (file == NULL)
+  {
+    printf("Failed to open '%s'\n", filename);
+    exit(1);
+  }
+
+  size_t length = strlen(filename);
+  bool json = length >= 5 && !strcmp(filename + length - 5, ".json");
+  if (json)
+    fprintf(file, "[\n");
+  else
+    fprintf(file, "iteration,rr,alpha,beta,time_us\n");
+
+  for (unsigned i = 0; i < history.size(); i++)
+  {
+    const history_entry& e = history[i];
+    if (json)
+      fprintf(file, "  {\"iteration\": %d, \"rr\": %.17g, \"alpha\": %.17g, "
+              "\"beta\": %.17g, \"time_us\": %.0lf}%s\n",
+              e.itr, e.rr, e.alpha, e.beta, e.time,
+              i+1 < history.size() ? "," : "");
+    else
+      fprintf(file, "%d,%.17g,%.17g,%.17g,%.0lf\n",
+              e.itr, e.rr, e.alpha, e.beta, e.time);
+  }
+
+  if (json)
+    fprintf(file, "]\n");
+  fclose(file);
+}
+
 double get_timestamp()
 {
   struct timeval tv;
@@ -184,9 +774,26 @@ void parse_arguments(int argc, char *argv[])
   params.conv_threshold = 0.001;
   params.num_bit_flips = 0;
   params.bitflip_kind  = CGContext::ANY;
+  params.bitflip_vector = false;
+  params.check_interval = 1;
+  params.checkpoint_interval = 1;
+  params.residual_interval = 0;
+  params.scrub_interval = -1;
+  params.vector_checksums = false;
+  params.krylov_checks = false;
+  params.numa_replication = false;
+  params.report_bandwidth = false;
+  params.report_huge_pages = false;
+  params.huge_pages = HUGE_PAGES_DEFAULT;
+  params.on_error = ON_ERROR_ABORT;
+  params.log_level = 1;
+  params.log_interval = 1;
+  params.history_file = NULL;
 
   params.num_blocks = 25;
+  params.implicit_blocks = false;
   params.matrix_file = "matrices/shallow_water1/shallow_water1.mtx";
+  params.matrix_cache = NULL;
 
   params.target = "cpu";
   params.mode   = "none";
@@ -201,6 +808,63 @@ void parse_arguments(int argc, char *argv[])
         exit(1);
       }
     }
+    else if (!strcmp(argv[i], "--bandwidth") || !strcmp(argv[i], "-B"))
+    {
+      params.report_bandwidth = true;
+    }
+    else if (!strcmp(argv[i], "--checkpoint") || !strcmp(argv[i], "-C"))
+    {
+      if (++i >= argc || (params.checkpoint_interval = parse_int(argv[i])) < 1)
+      {
+        printf("Invalid checkpoint interval\n");
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--on-error") || !strcmp(argv[i], "-e"))
+    {
+      if (++i >= argc)
+      {
+        printf("Error policy required\n");
+        exit(1);
+      }
+
+      if (!strcmp(argv[i], "abort"))
+        params.on_error = ON_ERROR_ABORT;
+      else if (!strcmp(argv[i], "continue"))
+        params.on_error = ON_ERROR_CONTINUE;
+      else if (!strcmp(argv[i], "rollback"))
+        params.on_error = ON_ERROR_ROLLBACK;
+      else
+      {
+        printf("Invalid error policy\n");
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--huge-pages") || !strcmp(argv[i], "-H"))
+    {
+      if (++i >= argc)
+      {
+        printf("Huge page kind required\n");
+        exit(1);
+      }
+
+      if (!strcmp(argv[i], "none"))
+        params.huge_pages = HUGE_PAGES_NONE;
+      else if (!strcmp(argv[i], "transparent"))
+        params.huge_pages = HUGE_PAGES_TRANSPARENT;
+      else if (!strcmp(argv[i], "explicit"))
+        params.huge_pages = HUGE_PAGES_EXPLICIT;
+      else
+      {
+        printf("Invalid huge page kind\n");
+        exit(1);
+      }
+      params.report_huge_pages = true;
+    }
+    else if (!strcmp(argv[i], "--implicit-blocks") || !strcmp(argv[i], "-I"))
+    {
+      params.implicit_blocks = true;
+    }
     else if (!strcmp(argv[i], "--iterations") || !strcmp(argv[i], "-i"))
     {
       if (++i >= argc || (params.max_itrs = parse_int(argv[i])) < 0)
@@ -209,6 +873,27 @@ void parse_arguments(int argc, char *argv[])
         exit(1);
       }
     }
+    else if (!strcmp(argv[i], "--check-interval") || !strcmp(argv[i], "-k"))
+    {
+      if (++i >= argc || (params.check_interval = parse_int(argv[i])) < 1)
+      {
+        printf("Invalid check interval\n");
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--krylov-checks") || !strcmp(argv[i], "-K"))
+    {
+      params.krylov_checks = true;
+    }
+    else if (!strcmp(argv[i], "--log-level") || !strcmp(argv[i], "-L"))
+    {
+      if (++i >= argc || (params.log_level = parse_int(argv[i])) < 0 ||
+          params.log_level > 2)
+      {
+        printf("Invalid log level\n");
+        exit(1);
+      }
+    }
     else if (!strcmp(argv[i], "--list") || !strcmp(argv[i], "-l"))
     {
       CGContext::list_contexts();
@@ -231,6 +916,44 @@ void parse_arguments(int argc, char *argv[])
       }
       params.matrix_file = argv[i];
     }
+    else if (!strcmp(argv[i], "--numa-replicate") || !strcmp(argv[i], "-n"))
+    {
+      params.numa_replication = true;
+    }
+    else if (!strcmp(argv[i], "--log-interval") || !strcmp(argv[i], "-p"))
+    {
+      if (++i >= argc || (params.log_interval = parse_int(argv[i])) < 1)
+      {
+        printf("Invalid log interval\n");
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--residual-check") || !strcmp(argv[i], "-R"))
+    {
+      if (++i >= argc || (params.residual_interval = parse_int(argv[i])) < 0)
+      {
+        printf("Invalid residual check interval\n");
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--residual-history") || !strcmp(argv[i], "-r"))
+    {
+      if (++i >= argc)
+      {
+        printf("Residual history filename required\n");
+        exit(1);
+      }
+      params.history_file = argv[i];
+    }
+    else if (!strcmp(argv[i], "--matrix-cache") || !strcmp(argv[i], "-M"))
+    {
+      if (++i >= argc)
+      {
+        printf("Matrix cache filename required\n");
+        exit(1);
+      }
+      params.matrix_cache = argv[i];
+    }
     else if (!strcmp(argv[i], "--mode") || !strcmp(argv[i], "-m"))
     {
       if (++i >= argc)
@@ -241,6 +964,14 @@ void parse_arguments(int argc, char *argv[])
 
       params.mode = argv[i];
     }
+    else if (!strcmp(argv[i], "--scrub") || !strcmp(argv[i], "-s"))
+    {
+      if (++i >= argc || (params.scrub_interval = parse_int(argv[i])) < 0)
+      {
+        printf("Invalid scrub interval\n");
+        exit(1);
+      }
+    }
     else if (!strcmp(argv[i], "--target") || !strcmp(argv[i], "-t"))
     {
       if (++i >= argc)
@@ -251,6 +982,10 @@ void parse_arguments(int argc, char *argv[])
 
       params.target = argv[i];
     }
+    else if (!strcmp(argv[i], "--vector-checksums") || !strcmp(argv[i], "-v"))
+    {
+      params.vector_checksums = true;
+    }
     else if (!strcmp(argv[i], "--inject-bitflip") || !strcmp(argv[i], "-x"))
     {
       params.num_bit_flips = 1;
@@ -265,6 +1000,10 @@ void parse_arguments(int argc, char *argv[])
         {
           params.bitflip_kind = CGContext::VALUE;
         }
+        else if (!strcmp(argv[i], "VECTOR"))
+        {
+          params.bitflip_vector = true;
+        }
         else if ((params.num_bit_flips = parse_int(argv[i])) < 1)
         {
           printf("Invalid bit-flip parameter\n");
@@ -281,12 +1020,27 @@ void parse_arguments(int argc, char *argv[])
       printf(
         "  -h  --help                  Print this message\n"
         "  -b  --num-blocks      B     Number of times to block input matrix\n"
+        "  -B  --bandwidth             Estimate spmv bandwidth per NUMA node\n"
         "  -c  --convergence     C     Convergence threshold\n"
+        "  -C  --checkpoint      N     Checkpoint at most every N iterations\n"
+        "  -e  --on-error        POL   Error policy (abort/continue/rollback)\n"
         "  -f  --matrix-file     M     Path to matrix-market format file\n"
+        "  -H  --huge-pages      KIND  Page size (none/transparent/explicit)\n"
         "  -i  --iterations      I     Maximum number of iterations\n"
+        "  -I  --implicit-blocks       Store the block once, not B times\n"
+        "  -k  --check-interval  K     Check matrix for errors every K spmvs\n"
+        "  -K  --krylov-checks         Check CG invariants every iteration\n"
         "  -l  --list                  List available implementations\n"
+        "  -L  --log-level       L     Iteration log level (0, 1 or 2)\n"
         "  -m  --mode            MODE  ABFT mode\n"
+        "  -M  --matrix-cache    F     Cache the encoded matrix in F\n"
+        "  -n  --numa-replicate        Copy the spmv input to every NUMA node\n"
+        "  -p  --log-interval    N     Log every N iterations\n"
+        "  -r  --residual-history F    Write residual history to F\n"
+        "  -R  --residual-check  K     Check true residual every K iterations\n"
+        "  -s  --scrub           MS    Scrub matrix in the background\n"
         "  -t  --target          TARG  Implementation target\n"
+        "  -v  --vector-checksums      Protect vectors with block checksums\n"
         "  -x  --inject-bitflip        Inject a random bit-flip into A\n"
         "\n"
         "  The -l|--list argument will provide a list of tuples that describe\n"
@@ -295,7 +1049,62 @@ void parse_arguments(int argc, char *argv[])
         "\n"
         "  The -x|--inject-bitflip argument optionally takes a number to \n"
         "  control how many bits to flip, and either INDEX or VALUE to \n"
-        "  restrict the region of bits in the matrix element to target.\n"
+        "  restrict the region of bits in the matrix element to target,\n"
+        "  or VECTOR to flip bits in an element of p instead.\n"
+        "\n"
+        "  The -e|--on-error argument chooses what to do when a check finds\n"
+        "  an error that it cannot correct: stop with an error (abort, the\n"
+        "  default), carry on solving with the error contained (continue),\n"
+        "  or restore the matrix and roll back to the last checkpoint\n"
+        "  (rollback).\n"
+        "\n"
+        "  The -L|--log-level argument sets what is printed every -p|\n"
+        "  --log-interval iterations: nothing (0), rr (1, the default), or\n"
+        "  rr, alpha and beta (2). The -r|--residual-history argument records\n"
+        "  the same for every iteration in memory, and writes it to a CSV\n"
+        "  file (or JSON if the name ends in .json) after the solve. The\n"
+        "  iterations that a rollback undoes are dropped from the history.\n"
+        "\n"
+        "  The -R|--residual-check argument recomputes b - Ax every K\n"
+        "  iterations, and replaces r with it (restarting from p = r) if\n"
+        "  the two have drifted apart, as they do after a silent error in\n"
+        "  one of the vectors.\n"
+        "\n"
+        "  The -C|--checkpoint argument sets how many iterations apart the\n"
+        "  checkpoints that the solver rolls back to are taken (default 1).\n"
+        "\n"
+        "  The -s|--scrub argument corrects the matrix from a background\n"
+        "  thread, pausing MS milliseconds between sweeps (0 sweeps\n"
+        "  continuously), so that errors are corrected before they can\n"
+        "  accumulate. Combine it with -k to check less often in the spmv.\n"
+        "\n"
+        "  The -K|--krylov-checks argument checks that each iteration keeps\n"
+        "  the invariants of CG (pT * A*p > 0, alpha > 0, beta >= 0, and\n"
+        "  consecutive residuals orthogonal), which catches errors that the\n"
+        "  mode does not, and treats a violation as an uncorrected error.\n"
+        "\n"
+        "  The -n|--numa-replicate argument copies p to each NUMA node\n"
+        "  before every spmv, so that its gathers stay on the node, and\n"
+        "  -B|--bandwidth estimates the memory bandwidth of the spmv on\n"
+        "  each node, as the bytes its rows' arrays hold over the spmv\n"
+        "  time (a model, not measured traffic). Bind the OpenMP threads\n"
+        "  (e.g. OMP_PROC_BIND=true) for either to reflect their nodes.\n"
+        "\n"
+        "  The -H|--huge-pages argument backs the matrix and vectors with\n"
+        "  4 KiB pages only (none), transparent huge pages, or huge pages\n"
+        "  reserved in /proc/sys/vm/nr_hugepages (explicit), and reports\n"
+        "  how much of them huge pages back and the dTLB load misses that\n"
+        "  the solve took.\n"
+        "\n"
+        "  The -M|--matrix-cache argument maps the matrix from F, as the\n"
+        "  implementation encoded it, if F was written by a run with the\n"
+        "  same target, mode, -b|--num-blocks and matrix file (unchanged\n"
+        "  since). Otherwise it reads the matrix file and writes F.\n"
+        "\n"
+        "  The -I|--implicit-blocks argument stores the matrix block once,\n"
+        "  with the spmv multiplying each of the -b|--num-blocks copies\n"
+        "  along the diagonal by its slice of the vector in turn. A bit-flip\n"
+        "  injected into the block then appears in every copy.\n"
       );
       printf("\n");
       exit(0);
@@ -306,116 +1115,79 @@ void parse_arguments(int argc, char *argv[])
       exit(1);
     }
   }
-}
-
-struct matrix_entry
-{
-  uint32_t col;
-  uint32_t row;
-  double value;
-};
 
-struct matrix_block
-{
-  matrix_entry *elements;
-};
-
-static int compare_matrix_elements(const void *a, const void *b)
-{
-  matrix_entry _a = *(matrix_entry*)a;
-  matrix_entry _b = *(matrix_entry*)b;
-
-  if (_a.row < _b.row)
-  {
-    return -1;
-  }
-  else if (_a.row > _b.row)
+  // A cache holds the matrix that num_blocks copies were encoded into
+  if (params.implicit_blocks && params.matrix_cache)
   {
-    return 1;
-  }
-  else
-  {
-    return _a.col - _b.col;
+    printf("The matrix cache does not support implicit blocks\n");
+    exit(1);
   }
 }
 
-cg_matrix* load_sparse_matrix(CGContext *context, const char *filename,
-                              int num_blocks, int *N, int *nnz)
+// Map the matrix from the cache in params, if it is up to date, setting
+// source->cache to it. Returns NULL if it is not.
+cg_matrix* map_cached_matrix(CGContext *context, int *N, int *nnz,
+                             matrix_source *source)
 {
-  matrix_block *M = new matrix_block;
-
-  FILE *file = fopen(filename, "r");
-  if (file == NULL)
-  {
-    printf("Failed to open '%s'\n", filename);
-    exit(1);
-  }
-
-  int width, height, input_nnz;
-  mm_read_mtx_crd_size(file, &width, &height, &input_nnz);
-  if (width != height)
-  {
-    printf("Matrix is not square\n");
-    exit(1);
-  }
-
-  // Load the matrix block from the input file
-  int block_nnz = 0;
-  M->elements = new matrix_entry[2*input_nnz];
-  for (int i = 0; i < input_nnz; i++)
-  {
-    matrix_entry element;
-
-    int col, row;
+  source->cache = open_matrix_cache(params.matrix_cache, params.matrix_file,
+                                    params.target, params.mode,
+                                    params.num_blocks, context);
+  if (source->cache == NULL)
+    return NULL;
+
+  *N   = source->cache->N;
+  *nnz = source->cache->nnz;
+  return context->map_matrix(source->cache->data, *N, *nnz);
+}
 
-    if (fscanf(file, "%d %d %lg\n", &col, &row, &element.value) != 3)
-    {
-      printf("Failed to read matrix data\n");
-      exit(1);
-    }
-    // adjust from 1-based to 0-based
-    col--;
-    row--;
-
-    element.col = col;
-    element.row = row;
-    M->elements[block_nnz] = element;
-    block_nnz++;
-
-    if (element.col == element.row)
-      continue;
-
-    element.row = col;
-    element.col = row;
-    M->elements[block_nnz] = element;
-    block_nnz++;
-  }
+// Read a matrix and create it in the context, handing the arrays it was
+// created from to source if given
+cg_matrix* load_sparse_matrix(CGContext *context, const char *filename,
+                              int num_blocks, int *N, int *nnz,
+                              matrix_source *source)
+{
+  int width, block_nnz;
+  matrix_entry *elements = read_matrix_market(filename, &width, &block_nnz);
 
-  qsort(M->elements, block_nnz, sizeof(matrix_entry), compare_matrix_elements);
+  *N   = width*num_blocks;
+  *nnz = block_nnz*num_blocks;
 
-  uint32_t *columns = new uint32_t[block_nnz * num_blocks];
-  uint32_t *rows    = new uint32_t[block_nnz * num_blocks];
-  double   *values  = new double[block_nnz * num_blocks];
+  // Keep the block as it is for implicit blocks, or duplicate it across the
+  // diagonal of the full matrix
+  int copies = params.implicit_blocks ? 1 : num_blocks;
+  uint32_t *columns = new uint32_t[block_nnz * copies];
+  uint32_t *rows    = new uint32_t[block_nnz * copies];
+  double   *values  = new double[block_nnz * copies];
 
-  // Duplicate block across diagonal of full matrix
-  *nnz = 0;
-  for (int j = 0; j < num_blocks; j++)
+#pragma omp parallel for collapse(2)
+  for (int j = 0; j < copies; j++)
   {
     for (int i = 0; i < block_nnz; i++)
     {
-      matrix_entry element = M->elements[i];
+      matrix_entry element = elements[i];
+      int index = j*block_nnz + i;
 
-      columns[*nnz] = element.col + j*width;
-      rows[*nnz]    = element.row + j*height;
-      values[*nnz]  = element.value;
-
-      (*nnz)++;
+      columns[index] = element.col + j*width;
+      rows[index]    = element.row + j*width;
+      values[index]  = element.value;
     }
   }
+  delete[] elements;
 
-  *N = width*num_blocks;
+  cg_matrix *result;
+  if (params.implicit_blocks)
+    result = context->create_block_matrix(columns, rows, values,
+                                          width, block_nnz, num_blocks);
+  else
+    result = context->create_matrix(columns, rows, values, *N, *nnz);
 
-  cg_matrix *result = context->create_matrix(columns, rows, values, *N, *nnz);
+  if (source)
+  {
+    source->columns = columns;
+    source->rows    = rows;
+    source->values  = values;
+    return result;
+  }
 
   delete[] columns;
   delete[] rows;